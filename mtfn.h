@@ -22,75 +22,266 @@
 #define __MTFN_H__
 
 #include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <atomic>
+
+// Built with MTFN_PROFILE defined, the rules count every branch they take,
+// every test of the name they make and every step of the cursor, for
+// rule_counts() in mtfn_profile.h. Otherwise the counting compiles away,
+// and the tests don't take the place they are called from.
+#ifdef MTFN_PROFILE
+#include "mtfn_profile.h"
+
+#define MTFN_COUNT( event, where, function ) \
+    ( __builtin_is_constant_evaluated() ? (void)0 : \
+      ::mtfn::count_rule( ::mtfn::event, where, function ) )
+#define MTFN_BRANCH() MTFN_COUNT( rule_branch, __LINE__, __func__ )
+#define MTFN_PROBE() MTFN_COUNT( rule_probe, line, function )
+#define MTFN_ADVANCE( from ) MTFN_COUNT( rule_advance, \
+    (unsigned char)m_name[from] << 8 | ( m_cursor - from ), "step" )
+#define MTFN_SITE , int line = __builtin_LINE(), \
+    const char* function = __builtin_FUNCTION()
+#define MTFN_SITE_PARAMS , int line, const char* function
+#define MTFN_SITE_ARGS , line, function
+#else
+#define MTFN_BRANCH() ( (void)0 )
+#define MTFN_PROBE() ( (void)0 )
+#define MTFN_ADVANCE( from ) ( (void)( from ) )
+#define MTFN_SITE
+#define MTFN_SITE_PARAMS
+#define MTFN_SITE_ARGS
+#endif
 
 namespace mtfn
 {
 
 const int stop_len = 4;
 
+// Codes up to this long pack exactly into a uint64_t, 4 bits per code.
+// Longer ones are packed into a fingerprint, see rules::pack().
+const int packed_len = 16;
+
+// The longest key_length whose codes pack exactly
+const int max_key_len = packed_len;
+
+// How many codes the constructors that take one stop at, as in
+// encoder enc( mtfn::key_length( 8 ) ), in place of the stop_len codes
+// that limit_length stops at. 0, or less, doesn't limit them at all.
+// Codes past max_key_len only pack into fingerprints, see long_key.
+struct key_length
+{
+    constexpr explicit key_length( int codes )
+    : codes( codes > 0 ? codes : 0 ) {};
+
+    static constexpr key_length limited( bool limit_length )
+    { return key_length( limit_length ? stop_len : 0 ); };
+
+    int codes;
+};
+
+// True for the packed codes of codes longer than packed_len, which are
+// hashes rather than exact.
+constexpr bool is_fingerprint( uint64_t code )
+{
+    return ( code >> 60 ) == 0xF;
+}
+
+// The length limited codes of a sound, packed 4 bits per code, without any
+// of the state it took to work them out. A sound_key is trivially copyable
+// and compares the same way as sound::operator== does for length limited
+// sounds, so large numbers of them can be kept in plain arrays.
+struct sound_key
+{
+    enum
+    {
+        has_alt = 0x01
+    };
+
+    uint16_t primary;
+
+    // Same as primary when there is no alternate pronounciation, which lets
+    // operator== compare the four pairs without looking at the flags.
+    uint16_t alternate;
+
+    uint8_t flags;
+
+    static constexpr sound_key make( int primary, int alternate,
+        bool has_alternate )
+    {
+        return sound_key{ (uint16_t)primary,
+            (uint16_t)( has_alternate ? alternate : primary ),
+            (uint8_t)( has_alternate ? has_alt : 0 ) };
+    };
+
+    constexpr bool has_alternate( void ) const { return flags & has_alt; };
+
+    constexpr bool operator ==( const sound_key& rhs ) const
+    {
+        return primary == rhs.primary || primary == rhs.alternate ||
+               alternate == rhs.alternate || alternate == rhs.primary;
+    };
+
+    constexpr bool operator !=( const sound_key& rhs ) const
+    {
+        return !(*this == rhs);
+    };
+};
+
+static_assert( std::is_trivially_copyable<sound_key>::value,
+               "sound_key must be safe to memcpy" );
+static_assert( sizeof( sound_key ) <= 6, "sound_key has grown" );
+
+// All the codes of a sound, packed by rules::pack() into 64 bits each, so
+// sounds made with a key_length longer than stop_len compare and hash as
+// integers too. Exact for up to max_key_len codes; longer codes are
+// fingerprints, which are only the same by chance when the codes aren't.
+struct long_key
+{
+    uint64_t primary;
+
+    // Same as primary when there is no alternate pronounciation
+    uint64_t alternate;
+
+    uint8_t flags;          // sound_key::has_alt
+
+    static constexpr long_key make( uint64_t primary, uint64_t alternate,
+        bool has_alternate )
+    {
+        return long_key{ primary, has_alternate ? alternate : primary,
+            (uint8_t)( has_alternate ? sound_key::has_alt : 0 ) };
+    };
+
+    constexpr bool has_alternate( void ) const
+    { return flags & sound_key::has_alt; };
+
+    constexpr bool operator ==( const long_key& rhs ) const
+    {
+        return primary == rhs.primary || primary == rhs.alternate ||
+               alternate == rhs.alternate || alternate == rhs.primary;
+    };
+
+    constexpr bool operator !=( const long_key& rhs ) const
+    {
+        return !(*this == rhs);
+    };
+};
+
+class encoder;
+
+// The calls enable_metrics() in mtfn_metrics.h counts
+enum metric_call
+{
+    metric_encode,          // the sound constructors that take a name
+    metric_compare,         // sound::operator==
+    metric_sounds_like,
+    metric_calls
+};
+
+// Set by enable_metrics(). The calls check it first, and only time
+// themselves when it is set.
+extern std::atomic<bool> metrics_on;
+
+// Set while sounds_like() counts itself, so the encodes and the compare it
+// is made of aren't counted as well
+extern thread_local bool metrics_nested;
+
+// Sets metrics_nested for as long as it is in scope, and puts back what it
+// was when it goes, even when what it was counting threw
+class nested_metrics
+{
+public:
+    nested_metrics( void ) : m_was( metrics_nested )
+    { metrics_nested = true; };
+    ~nested_metrics() { metrics_nested = m_was; };
+
+private:
+    nested_metrics( const nested_metrics& );
+    const nested_metrics& operator =( const nested_metrics& );
+
+    bool m_was;
+};
+
+// The time in ns, for count_call()
+uint64_t metrics_now( void );
+
+// Adds a call that started at start, for a name len long if it encoded
+// one, with flagged as call_metrics has it
+void count_call( metric_call call, uint64_t start, size_t len, bool flagged );
+
+// Marks a string as UTF-8 for the constructors that take one, as in
+// sound snd( name, mtfn::utf8 );
+struct utf8_t {};
+constexpr utf8_t utf8 = {};
+
 class sound
 {
 public:
     // str coded in ASCII or ISO-8859-15 (if it includes a "ç" or "ñ" in it)
-    sound( const std::string& str, bool limit_length = true );
+    sound( const std::string& str, bool limit_length = true )
+    : sound( str, key_length::limited( limit_length ) ) {};
     sound( const char* str, bool limit_length = true )
-    { *this = sound( std::string( str ), limit_length ); };
+    : sound( str, key_length::limited( limit_length ) ) {};
+    sound( const std::string& str, key_length codes );
+    sound( const char* str, key_length codes );
 
     // This takes a wstring, but it assumes that all glyphs are in the range
     // [A-Za-zÇçÑñ ], which are the characters typically used in Engli
     // names. Any glyph outside that range is skipped
-    sound( const std::wstring& wstr, bool limit_length = true );
+    sound( const std::wstring& wstr, bool limit_length = true )
+    : sound( wstr, key_length::limited( limit_length ) ) {};
     sound( const wchar_t* wstr, bool limit_length = true )
-    { *this = sound( std::wstring( wstr ), limit_length ); };
+    : sound( std::wstring( wstr ), limit_length ) {};
+    sound( const std::wstring& wstr, key_length codes );
+    sound( const wchar_t* wstr, key_length codes )
+    : sound( std::wstring( wstr ), codes ) {};
+
+    // str coded in UTF-8. Accented Latin letters count as the letters
+    // without their accents, except for Ç and Ñ, and other glyphs are
+    // skipped.
+    sound( std::string_view str, utf8_t, bool limit_length = true )
+    : sound( str, utf8, key_length::limited( limit_length ) ) {};
+    sound( std::string_view str, utf8_t, key_length codes );
+
+    // Takes the codes of the last name run through enc
+    explicit sound( const encoder& enc );
 
     // Copy constructor
     sound( const sound& init )
-    : m_name( init.m_name ),
-      m_first( init.m_first ),
-      m_last( init.m_last ),
-      m_cursor( init.m_cursor ),
-      m_has_alternate( init.m_has_alternate ),
+    : m_has_alternate( init.m_has_alternate ),
       m_primary( init.m_primary ),
       m_alternate( init.m_alternate ),
-      m_prim_int( init.m_prim_int ),
-      m_alt_int( init.m_alt_int ),
-      m_length_limited( init.m_length_limited )
+      m_prim_code( init.m_prim_code ),
+      m_alt_code( init.m_alt_code ),
+      m_key_len( init.m_key_len )
     { };
 
     // Assignment operator
     const sound& operator =( const sound& init )
     {
-        m_name = init.m_name;
-        m_first = init.m_first;
-        m_last = init.m_last;
-        m_cursor = init.m_cursor;
         m_has_alternate = init.m_has_alternate;
         m_primary = init.m_primary;
         m_alternate = init.m_alternate;
-        m_prim_int = init.m_prim_int;
-        m_alt_int = init.m_alt_int;
-        m_length_limited = init.m_length_limited;
+        m_prim_code = init.m_prim_code;
+        m_alt_code = init.m_alt_code;
+        m_key_len = init.m_key_len;
 
         return *this;
     };
 
-    // Equality test returns true if the sounds are pronounced the same way
+    // Equality test returns true if the sounds are pronounced the same way.
+    // It compares the packed codes, so it costs a few integer compares
+    // whether or not the length is limited. Sounds made with different key
+    // lengths have different codes, so only compare ones made the same way.
     bool operator ==( const sound& rhs ) const
     {
-        if ( m_length_limited )
-        {
-            return m_prim_int == rhs.m_prim_int ||
-               ( rhs.m_has_alternate && m_prim_int == rhs.m_alt_int ) ||
-               ( m_has_alternate && rhs.m_has_alternate && m_alt_int == rhs.m_alt_int ) ||
-               ( m_has_alternate && m_alt_int == rhs.m_prim_int );
-        }
-        else
+        if ( metrics_on.load( std::memory_order_relaxed ) && !metrics_nested )
         {
-            return m_primary == rhs.m_primary ||
-               ( rhs.m_has_alternate && m_primary == rhs.m_alternate ) ||
-               ( m_has_alternate && rhs.m_has_alternate && m_alternate == rhs.m_alternate ) ||
-               ( m_has_alternate && m_alternate == rhs.m_primary );
+            return counted_equals( rhs );
         }
+        return equals( rhs );
     };
 
     // Inequality operator
@@ -107,13 +298,13 @@ public:
     template <typename STRING>
     bool operator ==( const STRING& rhs ) const
     {
-        return *this == sound( rhs, m_length_limited );
+        return *this == sound( rhs, key_length( m_key_len ) );
     };
 
     template <typename STRING>
     bool operator !=( const STRING& rhs ) const
     {
-        return *this != sound( rhs, m_length_limited );
+        return *this != sound( rhs, key_length( m_key_len ) );
     };
 
     // Primary English pronounciation in America
@@ -126,116 +317,480 @@ public:
     // Returns true if there is an alternate pronounciation
     const bool has_alternate( void ) const { return m_has_alternate; };
 
+    // The first stop_len codes packed, the same codes as in the key of the
+    // name made with limit_length, whatever the key length of this sound.
+    // The flags are this sound's, so has_alt can be set by an alternate
+    // that only differs after those codes.
+    sound_key key( void ) const;
+
+    // All the codes packed, 64 bits each
+    long_key full_key( void ) const
+    { return long_key::make( m_prim_code, m_alt_code, m_has_alternate ); };
+
+    // The codes packed into 64 bits by rules::pack(), which is exact for
+    // up to packed_len codes. Sounds that are equal have equal primary or
+    // alternate codes, so they are what to hash sounds by.
+    uint64_t primary_code( void ) const { return m_prim_code; };
+    uint64_t alternate_code( void ) const { return m_alt_code; };
+
+    bool length_limited( void ) const { return m_key_len > 0; };
+
+    // How many codes the sound stopped at, or 0 if it didn't
+    int key_len( void ) const { return m_key_len; };
+
 protected:
-    void add( char c )
+    void assign( const encoder& enc );
+
+    bool equals( const sound& rhs ) const
     {
-        m_primary += c;
-        m_alternate += c;
+        return same( m_prim_code, m_primary, rhs.m_prim_code, rhs.m_primary ) ||
+           ( rhs.m_has_alternate &&
+             same( m_prim_code, m_primary, rhs.m_alt_code, rhs.m_alternate ) ) ||
+           ( m_has_alternate && rhs.m_has_alternate &&
+             same( m_alt_code, m_alternate, rhs.m_alt_code, rhs.m_alternate ) ) ||
+           ( m_has_alternate &&
+             same( m_alt_code, m_alternate, rhs.m_prim_code, rhs.m_primary ) );
     };
 
-    void add( const std::string& s )
+    // operator== while metrics are on
+    bool counted_equals( const sound& rhs ) const;
+
+    // Packed codes are exact unless they are fingerprints of long codes,
+    // which are only the same if the codes themselves are.
+    static bool same( uint64_t lhs, const std::string& lhs_codes,
+        uint64_t rhs, const std::string& rhs_codes )
     {
-        m_primary.append( s );
-        m_alternate.append( s );
+        return lhs == rhs &&
+            ( !is_fingerprint( lhs ) || lhs_codes == rhs_codes );
     };
 
-    void add( char c, char a )
-    {
-        m_has_alternate = true;
-        m_primary += c;
-        m_alternate += a;
-    }
+    bool m_has_alternate;
+    std::string m_primary;
+    std::string m_alternate;
 
-    void add( const std::string& s, const std::string& a )
-    {
-        m_has_alternate = true;
-        m_primary.append( s );
-        m_alternate.append( a );
-    }
+    // This integers encode the m_primary and m_alternate sounds in 
+    // a way that speeds comparison.
+    uint64_t m_prim_code;
+    uint64_t m_alt_code;
+
+    // 0 when the length is not limited
+    int m_key_len;
+private:
+};
 
-    bool is_ready( void )
+// The rules as tables, made by mtfn_gen from mtfn_rules.tab for the table
+// engine of rules::step(). A rule passes when each of its clauses does, a
+// clause being a run of tests of which any one passing is enough.
+enum table_kind
+{
+    table_char,         // the character at pos is in set
+    table_text,         // one of the patterns starts at pos
+    table_cursor_at,    // the cursor is at pos
+    table_cursor_after, // the cursor is after pos
+    table_last_at,      // the name's last character is at pos
+    table_slavo,        // the name is Slavo-Germanic
+    table_never
+};
+
+// What a test's offset is from
+enum table_base
+{
+    table_cursor,
+    table_start,
+    table_last
+};
+
+enum table_flags
+{
+    table_negated = 0x01,
+    table_ends_clause = 0x02
+};
+
+struct table_test
+{
+    uint8_t kind;
+    uint8_t base;
+    int8_t offset;
+    uint8_t flags;
+    uint8_t len;            // of each of the patterns
+    uint8_t count;          // patterns, from table_patterns[patterns]
+    uint16_t patterns;
+    uint64_t set;           // as a _set literal packs it
+};
+
+struct table_rule
+{
+    uint16_t tests;         // table_tests from tests up to tests_end
+    uint16_t tests_end;
+    char primary[3];
+    char alternate[3];
+    bool alternates;        // whether it marks the name as having any
+    uint8_t advance;        // 0 to go on with the rules from next
+    uint16_t next;
+};
+
+// The double metaphone rules, run over a name that has already been upper
+// cased and stripped of the characters the rules don't know about.
+// Characters before the start or past the end of the name read as '_', so
+// the name needs no padding. The rules only use the buffers they are given,
+// which lets them run in constant expressions; encoder and encode() are the
+// ways to use them.
+class rules
+{
+public:
+    // Define the allowed special characters in iso-8859-1 / UCS-2
+    static constexpr char sm_c_cedilla = (char)0xe7;
+    static constexpr char cap_c_cedilla = (char)( 0xe7 - 0x20 );
+    static constexpr char sm_n_tilde = (char)0xf1;
+    static constexpr char cap_n_tilde = (char)( 0xf1 - 0x20 );
+
+    constexpr rules( bool limit_length = true )
+    : rules( key_length::limited( limit_length ) ) {};
+    constexpr rules( key_length codes );
+
+    // Upper cases the len characters of str into name, leaving out the
+    // ones the rules don't know about, and returns how many are left.
+    static constexpr int normalize( const char* str, size_t len, char* name );
+
+    // normalize() for UTF-8. Letters from Latin-1 and Latin Extended-A
+    // are folded to the letters without their accents, or to two letters
+    // for ligatures such as Æ and ß, so name needs no more than len bytes.
+    static constexpr int normalize_utf8( const char* str, size_t len,
+        char* name );
+
+    // Runs the rules over the len characters of a normalized name. primary
+    // and alternate need room for key_len() codes, or for 2 * len codes when
+    // the length is not limited: every code uses up at least half a
+    // character of the name.
+    constexpr void run( const char* name, int len,
+        char* primary, char* alternate );
+
+    // Runs the rules like run(), but only while the primary or alternate
+    // codes so far are the start of target or target_alt. Returns false if
+    // it stopped early, when the codes could no longer equal either.
+    constexpr bool run_while( const char* name, int len,
+        char* primary, char* alternate, std::string_view target,
+        std::string_view target_alt );
+
+    // The steps of run(), for callers that look at the codes between
+    // steps: start(), then step() until is_ready(), then finish().
+    constexpr void start( const char* name, int len,
+        char* primary, char* alternate );
+    constexpr void step( void );
+    constexpr void finish( void );
+
+    constexpr bool is_ready( void ) const
     {
         if ( m_cursor > m_last )
         {
             return true;
         }
 
-        if ( m_length_limited )
+        if ( m_key_len > 0 )
         {
-            return m_primary.size() >= stop_len &&
-                   m_alternate.size() >= stop_len;
+            return m_prim_len >= m_key_len && m_alt_len >= m_key_len;
         }
 
         return false;
     };
 
-    bool is_slavo_germanic( void );
-    bool is_spanish_ll( void );
-    bool is_germanic_c( void );
-    bool starts_german( void );
-
-    static bool is_one_of( char needle, const std::string& haystack );
-    static bool is_one_of( const std::string& needle,
-        const char* haystack, ... );
-    static bool is_one_of( const std::string::const_iterator& needle_start,
-        int count, const char* haystack, ... );
-
-    void vowel( void );
-    void letter_b( void );
-    void letter_c_cedilla( void );
-    void letter_c( void );
-    void letter_combo_ch( void );
-    void letter_combo_cc( void );
-    void letter_d( void );
-    void letter_f( void );
-    void letter_g( void );
-    void letter_combo_gh( void );
-    void letter_h( void );
-    void letter_j( void );
-    void letter_k( void );
-    void letter_l( void );
-    void letter_m( void );
-    void letter_n( void );
-    void letter_n_tilde( void );
-    void letter_p( void );
-    void letter_q( void );
-    void letter_r( void );
-    void letter_s( void );
-    void letter_t( void );
-    void letter_v( void );
-    void letter_w( void );
-    void letter_x( void );
-    void letter_z( void );
-
-    // m_name is padded on the left and right with several '_' characters
-    // to allow easy reference to earlier and later characters, or to
-    // detect the start or end of the name without comparing the 
-    // cursor to m_first or m_last.
-    std::string m_name;
-
-    std::string::const_iterator m_first;
-    std::string::const_iterator m_last;
-    std::string::const_iterator m_cursor;
+    // Where a run had got to before one of its steps. Given the same name
+    // with more characters after it, resume() carries on from there, which
+    // gives the same codes as starting again as long as none of the steps
+    // before it looked past the end of the shorter name, and the longer
+    // name is no more Slavo-Germanic than the shorter one.
+    struct checkpoint
+    {
+        int cursor;
+        int prim_len;
+        int alt_len;
+        bool has_alternate;
+        bool asked_slavo_germanic;
+    };
+
+    constexpr checkpoint save( void ) const
+    { return checkpoint{ m_cursor, m_prim_len, m_alt_len, m_has_alternate,
+        m_slavo_germanic >= 0 }; };
+
+    constexpr void resume( const char* name, int len,
+        char* primary, char* alternate, const checkpoint& from );
+
+    // Packs len codes into a number, first code in the highest bits, as
+    // primary_code() and alternate_code() are.
+    static constexpr uint64_t pack( const char* codes, int len );
+
+    // What pack() makes of codes too long to pack exactly, for any length
+    static constexpr uint64_t fingerprint( const char* codes, int len );
+
+    constexpr std::string_view primary( void ) const
+    { return std::string_view( m_primary, m_prim_len ); };
+
+    constexpr std::string_view alternate( void ) const
+    { return std::string_view( m_alternate, m_alt_len ); };
+
+    constexpr bool has_alternate( void ) const { return m_has_alternate; };
+    constexpr int primary_int( void ) const { return (int)m_prim_code; };
+    constexpr int alternate_int( void ) const { return (int)m_alt_code; };
+    constexpr uint64_t primary_code( void ) const { return m_prim_code; };
+    constexpr uint64_t alternate_code( void ) const { return m_alt_code; };
+
+    constexpr bool length_limited( void ) const { return m_key_len > 0; };
+    constexpr int key_len( void ) const { return m_key_len; };
+
+    // The first stop_len codes, which are the same whatever the key length
+    // as long as it is at least stop_len; the flags are not, as in
+    // sound::key()
+    constexpr sound_key key( void ) const
+    { return sound_key::make( (int)short_code( m_primary, m_prim_len,
+        m_prim_code ), (int)short_code( m_alternate, m_alt_len, m_alt_code ),
+        m_has_alternate ); };
+
+    constexpr long_key full_key( void ) const
+    { return long_key::make( m_prim_code, m_alt_code, m_has_alternate ); };
+
+    // The packed first stop_len of the len codes packed into code
+    static constexpr uint64_t short_code( const char* codes, int len,
+        uint64_t code )
+    { return len <= stop_len ? code : pack( codes, stop_len ); };
+
+protected:
+    // The two ways step() can run the rule for the letter at the cursor: the
+    // letter_*() functions, or the tables in mtfn_table.h, which step() walks
+    // when built with MTFN_RULE_TABLE. Either moves the cursor on.
+    constexpr void dispatch( void );
+    constexpr void walk_table( void );
+
+private:
+    constexpr char at( int pos ) const
+    {
+        return ( 0 <= pos && pos < m_len ) ? m_name[pos] : '_';
+    };
+
+    constexpr void push( char* codes, int& len, char c )
+    {
+        if ( len < m_code_cap )
+        {
+            codes[len++] = c;
+        }
+    };
+
+    constexpr void add( char c )
+    {
+        push( m_primary, m_prim_len, c );
+        push( m_alternate, m_alt_len, c );
+    };
+
+    constexpr void add( const char* s )
+    {
+        for ( ; *s; s++ )
+        {
+            add( *s );
+        }
+    };
+
+    constexpr void add( char c, char a )
+    {
+        m_has_alternate = true;
+        push( m_primary, m_prim_len, c );
+        push( m_alternate, m_alt_len, a );
+    };
+
+    constexpr void add( const char* s, const char* a )
+    {
+        m_has_alternate = true;
+        for ( ; *s; s++ )
+        {
+            push( m_primary, m_prim_len, *s );
+        }
+        for ( ; *a; a++ )
+        {
+            push( m_alternate, m_alt_len, *a );
+        }
+    };
+
+    static constexpr bool begins( const char* codes, int len,
+        std::string_view target, std::string_view target_alt );
+
+    static constexpr int fold( uint32_t code_point, char* name );
+
+    static constexpr bool is_vowel( char c );
+    static constexpr int char_value( char c );
+
+    constexpr bool is_slavo_germanic( void );
+    constexpr bool is_spanish_ll( void ) const;
+    constexpr bool is_germanic_c( void ) const;
+    constexpr bool starts_german( void ) const;
+
+    // The rules' character tests. The sets and patterns are packed into
+    // integers at compile time by the _set and _pat literals in mtfn_rules.h,
+    // so a test is a bit test or a load and a few integer compares.
+    template <uint64_t SET>
+    constexpr static bool is_one_of( char needle MTFN_SITE );
+    template <uint64_t FIRST, uint64_t... REST>
+    constexpr bool is_one_of( int pos MTFN_SITE ) const;
+    template <uint64_t PATTERN>
+    constexpr bool is_at( int pos MTFN_SITE ) const
+    { return is_one_of<PATTERN>( pos MTFN_SITE_ARGS ); };
+    template <int N>
+    constexpr uint64_t window( int pos ) const;
+    constexpr uint64_t window( int pos, int len ) const;
+
+    constexpr bool passes( const table_rule& rule );
+    constexpr bool passes( const table_test& test );
+
+    constexpr void vowel( void );
+    constexpr void letter_b( void );
+    constexpr void letter_c_cedilla( void );
+    constexpr void letter_c( void );
+    constexpr void letter_combo_ch( void );
+    constexpr void letter_combo_cc( void );
+    constexpr void letter_d( void );
+    constexpr void letter_f( void );
+    constexpr void letter_g( void );
+    constexpr void letter_combo_gh( void );
+    constexpr void letter_h( void );
+    constexpr void letter_j( void );
+    constexpr void letter_k( void );
+    constexpr void letter_l( void );
+    constexpr void letter_m( void );
+    constexpr void letter_n( void );
+    constexpr void letter_n_tilde( void );
+    constexpr void letter_p( void );
+    constexpr void letter_q( void );
+    constexpr void letter_r( void );
+    constexpr void letter_s( void );
+    constexpr void letter_t( void );
+    constexpr void letter_v( void );
+    constexpr void letter_w( void );
+    constexpr void letter_x( void );
+    constexpr void letter_z( void );
+
+    const char* m_name;
+    int m_len;
+    int m_last;
+    int m_cursor;
+
+    // -1 until is_slavo_germanic() has looked at the name
+    int m_slavo_germanic;
 
     bool m_has_alternate;
-    std::string m_primary;
-    std::string m_alternate;
+    char* m_primary;
+    char* m_alternate;
+    int m_prim_len;
+    int m_alt_len;
+    int m_code_cap;
 
-    // This integers encode the m_primary and m_alternate sounds in 
-    // a way that speeds comparison.
-    int m_prim_int;
-    int m_alt_int;
+    uint64_t m_prim_code;
+    uint64_t m_alt_code;
+
+    int m_key_len;          // 0 when the length is not limited
+};
+
+// Runs the rules without touching the heap. The name and the codes are
+// kept in fixed inline buffers, so an encoder is meant to be created once
+// and reused for many names; its results are valid until the next call to
+// encode().
+class encoder
+{
+public:
+    // Names up to this many bytes long are encoded in the inline buffers.
+    // Longer names use a heap buffer that is kept for the next names.
+    static const int inline_len = 128;
+
+    encoder( bool limit_length = true );
+    encoder( key_length codes );
+    ~encoder();
+
+    // str coded in ASCII or ISO-8859-15, same as sound( const std::string& )
+    void encode( const char* str, size_t len );
+    void encode( std::string_view str ) { encode( str.data(), str.size() ); };
+
+    // str coded in UTF-8, same as sound( str, utf8 )
+    void encode_utf8( const char* str, size_t len );
+    void encode_utf8( std::string_view str )
+    { encode_utf8( str.data(), str.size() ); };
+
+    // Primary English pronounciation in America
+    std::string_view primary( void ) const { return m_rules.primary(); };
+
+    // Alternate English pronounciation in America, empty if
+    // this->has_alternate() == false.
+    std::string_view alternate( void ) const { return m_rules.alternate(); };
+
+    // Returns true if there is an alternate pronounciation
+    bool has_alternate( void ) const { return m_rules.has_alternate(); };
+
+    // The codes packed the same way as in sound, 4 bits per code. The ints
+    // are only meaningful when the key length is stop_len.
+    int primary_int( void ) const { return m_rules.primary_int(); };
+    int alternate_int( void ) const { return m_rules.alternate_int(); };
+    uint64_t primary_code( void ) const { return m_rules.primary_code(); };
+    uint64_t alternate_code( void ) const { return m_rules.alternate_code(); };
+
+    bool length_limited( void ) const { return m_rules.length_limited(); };
+    int key_len( void ) const { return m_rules.key_len(); };
+
+    // The first stop_len codes packed, as in sound::key()
+    sound_key key( void ) const { return m_rules.key(); };
+
+    // All the codes packed, as in sound::full_key()
+    long_key full_key( void ) const { return m_rules.full_key(); };
 
-    bool m_length_limited;
 private:
+    encoder( const encoder& );
+    const encoder& operator =( const encoder& );
+
+    void reserve( size_t len );
+
+    rules m_rules;
+
+    // Point into the inline buffers or m_heap
+    char* m_name;
+    char* m_primary;
+    char* m_alternate;
+
+    char m_name_buf[inline_len];
+    char m_prim_buf[2 * inline_len];
+    char m_alt_buf[2 * inline_len];
+
+    char* m_heap;
+    size_t m_heap_len;
 };
 
+// The length limited key of a name, str coded the same as for encoder.
+// encode() is constexpr, so keys of names known when compiling can be
+// worked out by the compiler:
+//
+//     constexpr mtfn::sound_key smith = mtfn::encode( "Smith" );
+//
+// Only names up to encoder::inline_len bytes can be encoded that way.
+constexpr sound_key encode( std::string_view name );
+
+// encode() for names too long for it to keep on the stack
+sound_key encode_long( std::string_view name );
+
+// encode() for names coded in UTF-8
+constexpr sound_key encode_utf8( std::string_view name );
+sound_key encode_long_utf8( std::string_view name );
+
 // This lets you compare the sound of a std::string with a std::wstring, 
 // a std::string with a std::string, or a std::wstring with a std::wstring
 template <typename STRA, typename STRB>
 bool sounds_like( const STRA& lhs, const STRB& rhs, bool limit_length = true )
 {
-    return sound( lhs, limit_length ) == sound( rhs, limit_length );
+    if ( !metrics_on.load( std::memory_order_relaxed ) )
+    {
+        return sound( lhs, limit_length ) == sound( rhs, limit_length );
+    }
+
+    uint64_t start = metrics_now();
+    bool same;
+    {
+        nested_metrics nested;
+        same = sound( lhs, limit_length ) == sound( rhs, limit_length );
+    }
+    count_call( metric_sounds_like, start, 0, same );
+    return same;
 }
 
 // This lets you compare the sound of any pair of const char* and 
@@ -243,10 +798,23 @@ bool sounds_like( const STRA& lhs, const STRB& rhs, bool limit_length = true )
 template <typename CHARA, typename CHARB>
 bool sounds_like( const CHARA* lhs, const CHARB* rhs, bool limit_length = true )
 {
-    return sound( lhs, limit_length ) == sound( rhs, limit_length );
+    if ( !metrics_on.load( std::memory_order_relaxed ) )
+    {
+        return sound( lhs, limit_length ) == sound( rhs, limit_length );
+    }
+
+    uint64_t start = metrics_now();
+    bool same;
+    {
+        nested_metrics nested;
+        same = sound( lhs, limit_length ) == sound( rhs, limit_length );
+    }
+    count_call( metric_sounds_like, start, 0, same );
+    return same;
 }
 
 }; // namespace mtfn
 
+#include "mtfn_rules.h"
 
 #endif
@@ -0,0 +1,337 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include "mtfn.h"
+#include "mtfn_cache.h"
+#include "mtfn_match.h"
+#include "mtfn_incremental.h"
+#include "mtfn_normalize.h"
+#include "mtfn_name.h"
+#include "mtfn_fuzzy.h"
+
+using namespace std;
+using namespace mtfn;
+
+#define error cerr << __FILE__ << ':' << __LINE__ << ' '
+
+// Every allocation the library makes goes through here, so each benchmark
+// can report how many it takes per name
+static atomic<size_t> allocations( 0 );
+
+void* operator new( size_t size )
+{
+    allocations.fetch_add( 1, memory_order_relaxed );
+    void* p = malloc( size ? size : 1 );
+    if ( p == NULL )
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete( void* p ) noexcept
+{
+    free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+    free( p );
+}
+
+// Stops the compiler from dropping work whose result is never used
+static volatile size_t sink;
+
+// Runs op over every name, round after round, for at least min_seconds
+template<typename OP>
+static void bench( const char* corpus, const char* what, size_t names,
+    double min_seconds, OP op )
+{
+    typedef chrono::steady_clock clock;
+
+    size_t ops = 0, allocs = allocations.load();
+    clock::time_point start = clock::now();
+    double seconds = 0;
+
+    do
+    {
+        for ( size_t i = 0; i < names; i++ )
+        {
+            sink += op( i );
+        }
+        ops += names;
+        seconds = chrono::duration<double>( clock::now() - start ).count();
+    } while ( seconds < min_seconds );
+
+    allocs = allocations.load() - allocs;
+
+    cout << left << setw( 12 ) << corpus << setw( 28 ) << what << right
+         << fixed << setprecision( 1 ) << setw( 10 ) << seconds * 1e9 / ops
+         << setprecision( 0 ) << setw( 14 ) << ops / seconds
+         << setprecision( 2 ) << setw( 10 ) << (double)allocs / ops << endl;
+}
+
+// Small and fast, so every run makes the same corpora
+static uint32_t next_random( uint64_t& state )
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 33;
+}
+
+// Names built the way real ones are: mostly one surname-like word made of
+// common syllables, some taken straight from the test names, some
+// hyphenated or with a particle in front, and a few very long ones
+static vector<string> synthetic_names( const vector<string>& seeds,
+    size_t count, size_t parts )
+{
+    static const char* syllables[] = {
+        "an", "ber", "ch", "dt", "el", "er", "gh", "hau", "ing", "ja",
+        "ke", "kn", "li", "mac", "mann", "mc", "mi", "ne", "o", "ph",
+        "que", "ri", "sch", "sen", "son", "st", "th", "ton", "tz", "ugh",
+        "va", "wr", "x", "y", "zi", "ll", "ci", "gn", "wic", "cz"
+    };
+    static const char* particles[] = { "van ", "de ", "von ", "o'", "st " };
+    const size_t n_syllables = sizeof( syllables ) / sizeof( syllables[0] );
+    const size_t n_particles = sizeof( particles ) / sizeof( particles[0] );
+
+    uint64_t state = 0x6d74666eULL + count + parts;
+    vector<string> names;
+    names.reserve( count );
+
+    for ( size_t i = 0; i < count; i++ )
+    {
+        string name;
+        for ( size_t p = 0; p < parts; p++ )
+        {
+            if ( p > 0 )
+            {
+                name += '-';
+            }
+
+            uint32_t r = next_random( state ) % 100;
+            if ( r < 30 )
+            {
+                name += seeds[next_random( state ) % seeds.size()];
+                continue;
+            }
+            if ( r < 38 )
+            {
+                name += particles[next_random( state ) % n_particles];
+            }
+
+            size_t n = 2 + next_random( state ) % 3;
+            for ( size_t s = 0; s < n; s++ )
+            {
+                name += syllables[next_random( state ) % n_syllables];
+            }
+        }
+
+        // A few capitalised, as names usually are
+        if ( next_random( state ) % 4 == 0 )
+        {
+            name[0] = toupper( name[0] );
+        }
+        names.push_back( name );
+    }
+
+    return names;
+}
+
+// Names drawn from the corpus with the Zipf distribution of real traffic,
+// where the most common name comes up twice as often as the second
+static vector<string> zipf_names( const vector<string>& corpus, size_t count )
+{
+    vector<double> cumulative( corpus.size() );
+    double total = 0;
+    for ( size_t i = 0; i < corpus.size(); i++ )
+    {
+        total += 1.0 / ( i + 1 );
+        cumulative[i] = total;
+    }
+
+    uint64_t state = 0x7a697066ULL;
+    vector<string> names;
+    names.reserve( count );
+    for ( size_t i = 0; i < count; i++ )
+    {
+        double r = total * next_random( state ) / 4294967296.0;
+        size_t rank = lower_bound( cumulative.begin(), cumulative.end(), r ) -
+            cumulative.begin();
+        names.push_back( corpus[rank < corpus.size() ? rank : 0] );
+    }
+
+    return names;
+}
+
+static void bench_corpus( const char* corpus, const vector<string>& names,
+    double min_seconds )
+{
+    const size_t n = names.size();
+    vector<const char*> cstrs;
+    vector<wstring> wstrs;
+    vector<sound> limited, unlimited;
+
+    for ( size_t i = 0; i < n; i++ )
+    {
+        cstrs.push_back( names[i].c_str() );
+        wstrs.push_back( wstring( names[i].begin(), names[i].end() ) );
+        limited.push_back( sound( names[i] ) );
+        unlimited.push_back( sound( names[i], false ) );
+    }
+
+    bench( corpus, "sound( string )", n, min_seconds, [&]( size_t i ) {
+        return sound( names[i] ).primary().size(); } );
+    bench( corpus, "sound( string, false )", n, min_seconds, [&]( size_t i ) {
+        return sound( names[i], false ).primary().size(); } );
+    bench( corpus, "sound( const char* )", n, min_seconds, [&]( size_t i ) {
+        return sound( cstrs[i] ).primary().size(); } );
+    bench( corpus, "sound( wstring )", n, min_seconds, [&]( size_t i ) {
+        return sound( wstrs[i] ).primary().size(); } );
+    bench( corpus, "sound( string, utf8 )", n, min_seconds, [&]( size_t i ) {
+        return sound( names[i], utf8 ).primary().size(); } );
+
+    // Normalizing alone, into a buffer big enough for any of the names
+    size_t longest = 0;
+    for ( size_t i = 0; i < n; i++ )
+    {
+        longest = max( longest, names[i].size() );
+    }
+    vector<char> normal( longest );
+    bench( corpus, "rules::normalize", n, min_seconds, [&]( size_t i ) {
+        return (size_t)rules::normalize( names[i].data(), names[i].size(),
+            normal.data() ); } );
+    bench( corpus, "normalize_name", n, min_seconds, [&]( size_t i ) {
+        return (size_t)normalize_name( names[i].data(), names[i].size(),
+            normal.data() ); } );
+
+    encoder enc;
+    bench( corpus, "encoder::encode", n, min_seconds, [&]( size_t i ) {
+        enc.encode( names[i] );
+        return enc.primary().size(); } );
+    bench( corpus, "encode", n, min_seconds, [&]( size_t i ) {
+        return (size_t)encode( names[i] ).primary; } );
+
+    // Warm after the first round, except for corpora bigger than the cache
+    encode_cache cache;
+    bench( corpus, "encode_cache::encode", n, min_seconds, [&]( size_t i ) {
+        return (size_t)cache.encode( names[i] ).primary; } );
+
+    // Each name against one some way off, so most pairs differ
+    bench( corpus, "operator==", n, min_seconds, [&]( size_t i ) {
+        return (size_t)( limited[i] == limited[( i * 7 + 1 ) % n] ); } );
+    bench( corpus, "operator== unlimited", n, min_seconds, [&]( size_t i ) {
+        return (size_t)( unlimited[i] == unlimited[( i * 7 + 1 ) % n] ); } );
+    bench( corpus, "sounds_like", n, min_seconds, [&]( size_t i ) {
+        return (size_t)sounds_like( names[i], names[( i * 7 + 1 ) % n] ); } );
+    bench( corpus, "key_distance", n, min_seconds, [&]( size_t i ) {
+        return (size_t)key_distance( limited[i].key(),
+            limited[( i * 7 + 1 ) % n].key() ); } );
+    bench( corpus, "sound_distance unlimited", n, min_seconds, [&]( size_t i ) {
+        return (size_t)sound_distance( unlimited[i],
+            unlimited[( i * 7 + 1 ) % n] ); } );
+
+    // Each name's neighbours within one code, from an index of them all
+    fuzzy_index fuzzy( 1 );
+    for ( size_t i = 0; i < n; i++ )
+    {
+        fuzzy.insert( limited[i].key() );
+    }
+    vector<fuzzy_index::record_id> near;
+    bench( corpus, "fuzzy_index::find, 1", n, min_seconds, [&]( size_t i ) {
+        near.clear();
+        fuzzy.find( limited[i].key(), 1, near );
+        return near.size(); } );
+
+    // Every prefix of each name, as a search box sees it being typed
+    bench( corpus, "typing, encoder", n, min_seconds, [&]( size_t i ) {
+        size_t codes = 0;
+        for ( size_t len = 1; len <= names[i].size(); len++ )
+        {
+            enc.encode( names[i].data(), len );
+            codes += enc.primary().size();
+        }
+        return codes; } );
+    incremental_encoder typed;
+    bench( corpus, "typing, incremental_encoder", n, min_seconds, [&]( size_t i ) {
+        size_t codes = 0;
+        typed.clear();
+        for ( size_t len = 0; len < names[i].size(); len++ )
+        {
+            typed.append( names[i][len] );
+            codes += typed.primary().size();
+        }
+        return codes; } );
+
+    // Every word of a full name, by hand with a sound each and all at once
+    bench( corpus, "sound per token", n, min_seconds, [&]( size_t i ) {
+        size_t codes = 0;
+        string_view s( names[i] );
+        for ( size_t begin = 0; begin <= s.size(); )
+        {
+            size_t end = min( s.find_first_of( name_sound::separators, begin ),
+                s.size() );
+            codes += sound( string( s.substr( begin, end - begin ) ) )
+                .primary().size();
+            begin = end + 1;
+        }
+        return codes; } );
+    bench( corpus, "name_sound", n, min_seconds, [&]( size_t i ) {
+        return name_sound( names[i] ).composite().size(); } );
+
+    // One needle against every name, as a linear scan does
+    sound needle( names[n / 2] );
+    bench( corpus, "operator==( string )", n, min_seconds, [&]( size_t i ) {
+        return (size_t)( needle == names[i] ); } );
+    matcher m( needle );
+    bench( corpus, "matcher::matches", n, min_seconds, [&]( size_t i ) {
+        return (size_t)m.matches( names[i] ); } );
+}
+
+// Reports ns/name, names/sec and allocations per name for each way of
+// making and comparing sounds, over the names in the file given and over
+// larger made up corpora
+int main ( int argc, char** argv )
+{
+    if ( argc < 2 )
+    {
+        error << "USAGE: mtfn_bench <filename> [seconds]" << endl;
+        return 1;
+    }
+
+    double min_seconds = argc > 2 ? atof( argv[2] ) : 0.2;
+
+    ifstream istrm( argv[1] );
+    vector<string> seeds;
+    string s;
+    while ( getline( istrm, s ) )
+    {
+        seeds.push_back( s );
+    }
+
+    if ( seeds.empty() )
+    {
+        error << "no names in " << argv[1] << endl;
+        return 1;
+    }
+
+    cout << left << setw( 12 ) << "corpus" << setw( 28 ) << "benchmark"
+         << right << setw( 10 ) << "ns/name" << setw( 14 ) << "names/sec"
+         << setw( 10 ) << "allocs" << endl;
+
+    bench_corpus( "input", seeds, min_seconds );
+    vector<string> synthetic( synthetic_names( seeds, 100000, 1 ) );
+    bench_corpus( "synthetic", synthetic, min_seconds );
+    bench_corpus( "zipf", zipf_names( synthetic, 100000 ), min_seconds );
+    bench_corpus( "compound", synthetic_names( seeds, 20000, 3 ),
+        min_seconds );
+    bench_corpus( "long", synthetic_names( seeds, 2000, 24 ), min_seconds );
+
+    return 0;
+}
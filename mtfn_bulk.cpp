@@ -0,0 +1,252 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "mtfn_bulk.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define MTFN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace mtfn;
+
+// Every kernel fills whole 64 bit words of the bitmap, 64 rows at a time
+typedef void (*kernel_fn)( uint16_t np, uint16_t na, const uint16_t* p,
+    const uint16_t* a, size_t words, uint64_t* matches );
+
+static uint64_t match_row( uint16_t np, uint16_t na, uint16_t p, uint16_t a )
+{
+    return p == np || p == na || a == np || a == na;
+}
+
+static void match_scalar( uint16_t np, uint16_t na, const uint16_t* p,
+    const uint16_t* a, size_t words, uint64_t* matches )
+{
+    for ( size_t w = 0; w < words; w++, p += 64, a += 64 )
+    {
+        uint64_t bits = 0;
+        for ( int i = 0; i < 64; i++ )
+        {
+            bits |= match_row( np, na, p[i], a[i] ) << i;
+        }
+        matches[w] = bits;
+    }
+}
+
+#ifdef MTFN_X86
+
+// SSE2 is all x86-64 has to have, and 16 bit compares need nothing newer
+__attribute__(( target( "sse2" ) ))
+static void match_sse2( uint16_t np, uint16_t na, const uint16_t* p,
+    const uint16_t* a, size_t words, uint64_t* matches )
+{
+    const __m128i vp = _mm_set1_epi16( np );
+    const __m128i va = _mm_set1_epi16( na );
+
+    for ( size_t w = 0; w < words; w++ )
+    {
+        uint64_t bits = 0;
+        for ( int i = 0; i < 64; i += 16, p += 16, a += 16 )
+        {
+            __m128i p0 = _mm_loadu_si128( (const __m128i*)p );
+            __m128i p1 = _mm_loadu_si128( (const __m128i*)( p + 8 ) );
+            __m128i a0 = _mm_loadu_si128( (const __m128i*)a );
+            __m128i a1 = _mm_loadu_si128( (const __m128i*)( a + 8 ) );
+
+            __m128i m0 = _mm_or_si128(
+                _mm_or_si128( _mm_cmpeq_epi16( p0, vp ), _mm_cmpeq_epi16( p0, va ) ),
+                _mm_or_si128( _mm_cmpeq_epi16( a0, vp ), _mm_cmpeq_epi16( a0, va ) ) );
+            __m128i m1 = _mm_or_si128(
+                _mm_or_si128( _mm_cmpeq_epi16( p1, vp ), _mm_cmpeq_epi16( p1, va ) ),
+                _mm_or_si128( _mm_cmpeq_epi16( a1, vp ), _mm_cmpeq_epi16( a1, va ) ) );
+
+            // One byte per row, then one bit per row
+            uint64_t mask = (uint16_t)_mm_movemask_epi8( _mm_packs_epi16( m0, m1 ) );
+            bits |= mask << i;
+        }
+        matches[w] = bits;
+    }
+}
+
+__attribute__(( target( "avx2" ) ))
+static void match_avx2( uint16_t np, uint16_t na, const uint16_t* p,
+    const uint16_t* a, size_t words, uint64_t* matches )
+{
+    const __m256i vp = _mm256_set1_epi16( np );
+    const __m256i va = _mm256_set1_epi16( na );
+
+    for ( size_t w = 0; w < words; w++ )
+    {
+        uint64_t bits = 0;
+        for ( int i = 0; i < 64; i += 32, p += 32, a += 32 )
+        {
+            __m256i p0 = _mm256_loadu_si256( (const __m256i*)p );
+            __m256i p1 = _mm256_loadu_si256( (const __m256i*)( p + 16 ) );
+            __m256i a0 = _mm256_loadu_si256( (const __m256i*)a );
+            __m256i a1 = _mm256_loadu_si256( (const __m256i*)( a + 16 ) );
+
+            __m256i m0 = _mm256_or_si256(
+                _mm256_or_si256( _mm256_cmpeq_epi16( p0, vp ), _mm256_cmpeq_epi16( p0, va ) ),
+                _mm256_or_si256( _mm256_cmpeq_epi16( a0, vp ), _mm256_cmpeq_epi16( a0, va ) ) );
+            __m256i m1 = _mm256_or_si256(
+                _mm256_or_si256( _mm256_cmpeq_epi16( p1, vp ), _mm256_cmpeq_epi16( p1, va ) ),
+                _mm256_or_si256( _mm256_cmpeq_epi16( a1, vp ), _mm256_cmpeq_epi16( a1, va ) ) );
+
+            // packs works within each 128 bit lane, so put the quarters
+            // back in row order before taking one bit per row
+            __m256i packed = _mm256_permute4x64_epi64(
+                _mm256_packs_epi16( m0, m1 ), 0xD8 );
+            uint64_t mask = (uint32_t)_mm256_movemask_epi8( packed );
+            bits |= mask << i;
+        }
+        matches[w] = bits;
+    }
+}
+
+__attribute__(( target( "avx512f,avx512bw" ) ))
+static void match_avx512( uint16_t np, uint16_t na, const uint16_t* p,
+    const uint16_t* a, size_t words, uint64_t* matches )
+{
+    const __m512i vp = _mm512_set1_epi16( np );
+    const __m512i va = _mm512_set1_epi16( na );
+
+    for ( size_t w = 0; w < words; w++ )
+    {
+        uint64_t bits = 0;
+        for ( int i = 0; i < 64; i += 32, p += 32, a += 32 )
+        {
+            __m512i p0 = _mm512_loadu_si512( p );
+            __m512i a0 = _mm512_loadu_si512( a );
+
+            uint64_t mask = (uint32_t)( _mm512_cmpeq_epi16_mask( p0, vp ) |
+                _mm512_cmpeq_epi16_mask( p0, va ) |
+                _mm512_cmpeq_epi16_mask( a0, vp ) |
+                _mm512_cmpeq_epi16_mask( a0, va ) );
+            bits |= mask << i;
+        }
+        matches[w] = bits;
+    }
+}
+
+#endif
+
+static kernel_fn kernel_for( bulk_kernel kernel )
+{
+#ifdef MTFN_X86
+    switch ( kernel )
+    {
+        case kernel_avx512:
+            return match_avx512;
+        case kernel_avx2:
+            return match_avx2;
+        case kernel_sse2:
+            return match_sse2;
+        default:
+            break;
+    }
+#endif
+    return match_scalar;
+}
+
+bulk_kernel mtfn::best_bulk_kernel( void )
+{
+#ifdef MTFN_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx512bw" ) )
+    {
+        return kernel_avx512;
+    }
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        return kernel_avx2;
+    }
+    if ( __builtin_cpu_supports( "sse2" ) )
+    {
+        return kernel_sse2;
+    }
+#endif
+    return kernel_scalar;
+}
+
+const char* mtfn::bulk_kernel_name( bulk_kernel kernel )
+{
+    switch ( kernel )
+    {
+        case kernel_avx512:
+            return "avx512";
+        case kernel_avx2:
+            return "avx2";
+        case kernel_sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+void mtfn::match_keys( const sound_key& needle, const uint16_t* primary,
+    const uint16_t* alternate, size_t count, uint64_t* matches,
+    bulk_kernel kernel )
+{
+    size_t words = count / 64;
+    kernel_for( kernel )( needle.primary, needle.alternate,
+        primary, alternate, words, matches );
+
+    // The last few rows don't fill a word
+    size_t done = words * 64;
+    if ( done < count )
+    {
+        uint64_t bits = 0;
+        for ( size_t i = done; i < count; i++ )
+        {
+            bits |= match_row( needle.primary, needle.alternate,
+                primary[i], alternate[i] ) << ( i - done );
+        }
+        matches[words] = bits;
+    }
+}
+
+void mtfn::match_keys( const sound_key& needle, const uint16_t* primary,
+    const uint16_t* alternate, size_t count, uint64_t* matches )
+{
+    static const bulk_kernel best = best_bulk_kernel();
+
+    match_keys( needle, primary, alternate, count, matches, best );
+}
+
+size_t mtfn::find_keys( const sound_key& needle, const uint16_t* primary,
+    const uint16_t* alternate, size_t count, vector<size_t>& rows )
+{
+    // Small enough to stay in L1 between filling it and reading it back
+    const size_t chunk_rows = 64 * 64;
+    uint64_t bits[64];
+    size_t found = rows.size();
+
+    for ( size_t start = 0; start < count; start += chunk_rows )
+    {
+        size_t n = count - start < chunk_rows ? count - start : chunk_rows;
+        match_keys( needle, primary + start, alternate + start, n, bits );
+
+        for ( size_t w = 0; w * 64 < n; w++ )
+        {
+            for ( uint64_t b = bits[w]; b != 0; b &= b - 1 )
+            {
+                rows.push_back( start + w * 64 + __builtin_ctzll( b ) );
+            }
+        }
+    }
+
+    return rows.size() - found;
+}
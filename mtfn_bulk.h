@@ -0,0 +1,81 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * match_keys(), find_keys() - compare one sound_key against columns of
+ * millions of packed codes at a time.
+ */
+
+#ifndef __MTFN_BULK_H__
+#define __MTFN_BULK_H__
+
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// The primary and alternate codes of many sound_keys, one column each, so
+// that a scan reads them as contiguous arrays of uint16_t.
+struct key_columns
+{
+    std::vector<uint16_t> primary;
+    std::vector<uint16_t> alternate;
+
+    void push_back( const sound_key& key )
+    {
+        primary.push_back( key.primary );
+        alternate.push_back( key.alternate );
+    };
+
+    size_t size( void ) const { return primary.size(); };
+};
+
+// The ways match_keys() can compare the columns, best first. By default it
+// uses the best one the CPU it runs on supports.
+enum bulk_kernel
+{
+    kernel_avx512,
+    kernel_avx2,
+    kernel_sse2,
+    kernel_scalar
+};
+
+bulk_kernel best_bulk_kernel( void );
+const char* bulk_kernel_name( bulk_kernel kernel );
+
+// Sets bit i % 64 of matches[i / 64] when row i sounds like needle, and
+// clears it otherwise. matches has to have room for (count + 63) / 64
+// words. The columns hold sound_key::primary and sound_key::alternate, so
+// rows without an alternate have the primary code in both.
+void match_keys( const sound_key& needle, const uint16_t* primary,
+    const uint16_t* alternate, size_t count, uint64_t* matches );
+void match_keys( const sound_key& needle, const uint16_t* primary,
+    const uint16_t* alternate, size_t count, uint64_t* matches,
+    bulk_kernel kernel );
+
+// Appends the number of every row that sounds like needle to rows, in
+// order, and returns how many were appended.
+size_t find_keys( const sound_key& needle, const uint16_t* primary,
+    const uint16_t* alternate, size_t count, std::vector<size_t>& rows );
+
+inline size_t find_keys( const sound_key& needle, const key_columns& keys,
+    std::vector<size_t>& rows )
+{
+    return find_keys( needle, keys.primary.data(), keys.alternate.data(),
+        keys.size(), rows );
+}
+
+}; // namespace mtfn
+
+#endif
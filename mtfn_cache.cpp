@@ -0,0 +1,204 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <functional>
+#include "mtfn_cache.h"
+#include "mtfn_normalize.h"
+
+using namespace std;
+using namespace mtfn;
+
+static const size_t not_found = (size_t)-1;
+
+encode_cache::encode_cache( size_t capacity, int shards )
+: m_shards( shards > 0 ? shards : 1 )
+{
+    m_shard_len = ( capacity + m_shards.size() - 1 ) / m_shards.size();
+    m_shard_len = m_shard_len > 0 ? m_shard_len : 1;
+
+    // At most half full, so probes stay short
+    size_t table_len = 1;
+    while ( table_len < 2 * m_shard_len )
+    {
+        table_len *= 2;
+    }
+    m_mask = table_len - 1;
+
+    for ( size_t i = 0; i < m_shards.size(); i++ )
+    {
+        // Never reallocated, since the entries' names can't move
+        m_shards[i].entries.reserve( m_shard_len );
+        m_shards[i].slots.assign( table_len, 0 );
+        m_shards[i].hand = 0;
+        m_shards[i].hits = 0;
+        m_shards[i].misses = 0;
+        m_shards[i].evictions = 0;
+    }
+}
+
+sound_key encode_cache::encode( string_view name )
+{
+    if ( name.size() > (size_t)encoder::inline_len )
+    {
+        // Too long to cache, so only the count needs the lock
+        shard& s( m_shards[0] );
+        {
+            lock_guard<mutex> lock( s.lock );
+            s.misses++;
+        }
+        return encode_long( name );
+    }
+
+    char normal[encoder::inline_len];
+    string_view norm( normal, normalize_name( name.data(), name.size(),
+        normal ) );
+
+    // The top half picks the shard, the bottom half the slot in it
+    uint64_t h = hash<string_view>()( norm );
+    shard& s( m_shards[( h >> 32 ) % m_shards.size()] );
+
+    {
+        lock_guard<mutex> lock( s.lock );
+        size_t slot = find( s, norm, (uint32_t)h );
+        if ( slot != not_found )
+        {
+            entry& e( s.entries[(uint32_t)s.slots[slot] - 1] );
+            e.referenced = true;
+            s.hits++;
+            return e.key;
+        }
+        s.misses++;
+    }
+
+    // Run the rules without holding the lock
+    char primary[stop_len] = {};
+    char alternate[stop_len] = {};
+    rules r;
+    r.run( normal, norm.size(), primary, alternate );
+    sound_key key = r.key();
+
+    lock_guard<mutex> lock( s.lock );
+    insert( s, norm, (uint32_t)h, key );
+    return key;
+}
+
+size_t encode_cache::find( const shard& s, string_view name,
+    uint32_t tag ) const
+{
+    for ( size_t i = tag & m_mask; s.slots[i] != 0; i = ( i + 1 ) & m_mask )
+    {
+        if ( ( s.slots[i] >> 32 ) == tag &&
+             s.entries[(uint32_t)s.slots[i] - 1].name == name )
+        {
+            return i;
+        }
+    }
+
+    return not_found;
+}
+
+// Moves back any slot after this one that would otherwise no longer be
+// found from where it hashes to
+void encode_cache::erase( shard& s, size_t slot )
+{
+    size_t i = slot;
+    for ( size_t j = ( i + 1 ) & m_mask; s.slots[j] != 0; j = ( j + 1 ) & m_mask )
+    {
+        size_t home = ( s.slots[j] >> 32 ) & m_mask;
+        if ( ( ( j - home ) & m_mask ) >= ( ( j - i ) & m_mask ) )
+        {
+            s.slots[i] = s.slots[j];
+            i = j;
+        }
+    }
+
+    s.slots[i] = 0;
+}
+
+void encode_cache::insert( shard& s, string_view name, uint32_t tag,
+    const sound_key& key )
+{
+    // Another thread may have got there first
+    if ( find( s, name, tag ) != not_found )
+    {
+        return;
+    }
+
+    uint32_t index;
+    if ( s.entries.size() < m_shard_len )
+    {
+        index = s.entries.size();
+        s.entries.push_back( entry() );
+    }
+    else
+    {
+        // Sweep, giving every referenced entry a second chance
+        while ( s.entries[s.hand].referenced )
+        {
+            s.entries[s.hand].referenced = false;
+            s.hand = ( s.hand + 1 ) % s.entries.size();
+        }
+        index = s.hand;
+        s.hand = ( s.hand + 1 ) % s.entries.size();
+
+        const string& old( s.entries[index].name );
+        erase( s, find( s, old, (uint32_t)hash<string_view>()( old ) ) );
+        s.evictions++;
+    }
+
+    entry& e( s.entries[index] );
+    e.name.assign( name.data(), name.size() );
+    e.key = key;
+    e.referenced = false;
+
+    size_t i = tag & m_mask;
+    while ( s.slots[i] != 0 )
+    {
+        i = ( i + 1 ) & m_mask;
+    }
+    s.slots[i] = (uint64_t)tag << 32 | ( index + 1 );
+}
+
+cache_stats encode_cache::stats( void ) const
+{
+    cache_stats total = { 0, 0, 0, 0 };
+
+    for ( size_t i = 0; i < m_shards.size(); i++ )
+    {
+        const shard& s( m_shards[i] );
+        lock_guard<mutex> lock( s.lock );
+        total.hits += s.hits;
+        total.misses += s.misses;
+        total.evictions += s.evictions;
+        total.entries += s.entries.size();
+    }
+
+    return total;
+}
+
+void encode_cache::clear( void )
+{
+    for ( size_t i = 0; i < m_shards.size(); i++ )
+    {
+        shard& s( m_shards[i] );
+        lock_guard<mutex> lock( s.lock );
+        s.slots.assign( s.slots.size(), 0 );
+        s.entries.clear();
+        s.hand = 0;
+        s.hits = 0;
+        s.misses = 0;
+        s.evictions = 0;
+    }
+}
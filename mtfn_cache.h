@@ -0,0 +1,97 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * encode_cache - remembers the keys of the names encoded most often, so
+ * the common ones are only ever run through the rules once.
+ */
+
+#ifndef __MTFN_CACHE_H__
+#define __MTFN_CACHE_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+struct cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+};
+
+// encode() with a cache in front, keyed on the name after normalization,
+// so "Smith", "SMITH" and "smith" share an entry. It holds at most
+// capacity names, split between shards that each have their own lock, and
+// when a shard is full the one to go is picked by the CLOCK algorithm.
+// Names longer than encoder::inline_len are never cached. It can be used
+// from any number of threads at once.
+class encode_cache
+{
+public:
+    encode_cache( size_t capacity = 65536, int shards = 16 );
+
+    sound_key encode( std::string_view name );
+
+    bool sounds_like( std::string_view lhs, std::string_view rhs )
+    { return encode( lhs ) == encode( rhs ); };
+
+    cache_stats stats( void ) const;
+    void clear( void );
+
+    size_t capacity( void ) const { return m_shards.size() * m_shard_len; };
+
+private:
+    encode_cache( const encode_cache& );
+    encode_cache& operator=( const encode_cache& );
+
+    struct entry
+    {
+        std::string name;
+        sound_key key;
+        bool referenced;
+    };
+
+    // slots is open addressed, with the low half of the hash of the name
+    // in the top half of each slot and the entry plus one in the bottom,
+    // so most probes never have to look at the entries
+    struct shard
+    {
+        mutable std::mutex lock;
+        std::vector<entry> entries;
+        std::vector<uint64_t> slots;
+        size_t hand;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    size_t find( const shard& s, std::string_view name, uint32_t tag ) const;
+    void erase( shard& s, size_t slot );
+    void insert( shard& s, std::string_view name, uint32_t tag,
+        const sound_key& key );
+
+    std::vector<shard> m_shards;
+    size_t m_shard_len;
+    size_t m_mask;
+};
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,290 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "mtfn_client.h"
+
+using namespace std;
+using namespace mtfn;
+
+// Requests sent by encode() before reading their answers, enough to fill
+// the server's batches without piling up in the socket
+const size_t pipeline_len = 1024;
+
+static bool read_all( int fd, void* buf, size_t len )
+{
+    char* at = (char*)buf;
+    while ( len > 0 )
+    {
+        ssize_t got = read( fd, at, len );
+        if ( got <= 0 )
+        {
+            if ( got < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            return false;
+        }
+        at += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool lookup_client::connect( const char* path )
+{
+    close();
+    m_path = path;
+
+    sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    if ( strlen( path ) >= sizeof( addr.sun_path ) )
+    {
+        return false;
+    }
+    strcpy( addr.sun_path, path );
+
+    m_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if ( m_fd < 0 )
+    {
+        return false;
+    }
+    if ( ::connect( m_fd, (sockaddr*)&addr, sizeof( addr ) ) != 0 )
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void lookup_client::close( void )
+{
+    drop();
+    m_path.clear();
+}
+
+bool lookup_client::drop( void )
+{
+    if ( m_fd >= 0 )
+    {
+        ::close( m_fd );
+        m_fd = -1;
+    }
+    return false;
+}
+
+bool lookup_client::encode( string_view name, sound_key& key )
+{
+    string answer;
+    if ( !call( lookup_encode, 0, name.data(), name.size(), answer ) ||
+         answer.size() != lookup_key_len )
+    {
+        return false;
+    }
+    key = get_key( answer.data() );
+    return true;
+}
+
+bool lookup_client::encode_utf8( string_view name, sound_key& key )
+{
+    string answer;
+    if ( !call( lookup_encode, lookup_utf8, name.data(), name.size(),
+             answer ) ||
+         answer.size() != lookup_key_len )
+    {
+        return false;
+    }
+    key = get_key( answer.data() );
+    return true;
+}
+
+bool lookup_client::encode( const vector<string_view>& names,
+    vector<sound_key>& keys )
+{
+    keys.resize( names.size() );
+    string frames, answer;
+    bool turned_down = false;
+
+    for ( size_t done = 0; done < names.size(); )
+    {
+        size_t count = min( names.size() - done, pipeline_len );
+        uint32_t first = m_next_id;
+
+        frames.clear();
+        for ( size_t i = done; i < done + count; i++ )
+        {
+            if ( names[i].size() > lookup_max_len )
+            {
+                return false;
+            }
+            add( frames, lookup_encode, 0, names[i].data(), names[i].size() );
+        }
+        if ( !send( frames ) )
+        {
+            return false;
+        }
+
+        // In whatever order they come back. A name turned down still has
+        // its answer read, so the next call starts with its own.
+        for ( size_t i = 0; i < count; i++ )
+        {
+            lookup_response response;
+            if ( !receive( response, answer ) )
+            {
+                return false;
+            }
+            if ( (uint32_t)( response.id - first ) >= count ||
+                 ( response.status == lookup_ok &&
+                   answer.size() != lookup_key_len ) )
+            {
+                return drop();
+            }
+            turned_down |= response.status != lookup_ok;
+            if ( response.status == lookup_ok )
+            {
+                keys[done + (uint32_t)( response.id - first )] =
+                    get_key( answer.data() );
+            }
+        }
+        done += count;
+    }
+
+    return !turned_down;
+}
+
+bool lookup_client::find( string_view name, vector<record_id>& matches )
+{
+    return find( name, 0, matches );
+}
+
+bool lookup_client::find_utf8( string_view name, vector<record_id>& matches )
+{
+    return find( name, lookup_utf8, matches );
+}
+
+bool lookup_client::find( string_view name, int flags,
+    vector<record_id>& matches )
+{
+    string answer;
+    if ( !call( lookup_find, flags, name.data(), name.size(), answer ) )
+    {
+        return false;
+    }
+
+    for ( size_t at = 0; at + sizeof( uint32_t ) <= answer.size();
+          at += sizeof( uint32_t ) )
+    {
+        uint32_t record;
+        memcpy( &record, answer.data() + at, sizeof( record ) );
+        matches.push_back( record );
+    }
+    return true;
+}
+
+bool lookup_client::name( record_id id, string& name )
+{
+    uint32_t record = id;
+    return record == id &&
+        call( lookup_name, 0, &record, sizeof( record ), name );
+}
+
+bool lookup_client::stats( server_stats& stats )
+{
+    string answer;
+    if ( !call( lookup_stats, 0, NULL, 0, answer ) ||
+         answer.size() != sizeof( stats ) )
+    {
+        return false;
+    }
+    memcpy( &stats, answer.data(), sizeof( stats ) );
+    return true;
+}
+
+uint32_t lookup_client::add( string& frames, int op, int flags,
+    const void* body, size_t len )
+{
+    lookup_request request{ (uint32_t)len, m_next_id++, (uint8_t)op,
+        (uint8_t)flags, 0 };
+    frames.append( (const char*)&request, sizeof( request ) );
+    if ( len > 0 )
+    {
+        frames.append( (const char*)body, len );
+    }
+    return request.id;
+}
+
+bool lookup_client::send( const string& frames )
+{
+    if ( m_fd < 0 && !m_path.empty() )
+    {
+        string path( m_path );
+        connect( path.c_str() );
+    }
+
+    size_t sent = 0;
+    while ( m_fd >= 0 && sent < frames.size() )
+    {
+        ssize_t n = ::send( m_fd, frames.data() + sent, frames.size() - sent,
+            MSG_NOSIGNAL );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return drop();
+        }
+        sent += n;
+    }
+    return m_fd >= 0;
+}
+
+bool lookup_client::receive( lookup_response& response, string& body )
+{
+    if ( m_fd < 0 || !read_all( m_fd, &response, sizeof( response ) ) )
+    {
+        return drop();
+    }
+    body.resize( response.len );
+    return read_all( m_fd, &body[0], body.size() ) || drop();
+}
+
+bool lookup_client::call( int op, int flags, const void* body, size_t len,
+    string& answer )
+{
+    if ( len > lookup_max_len )
+    {
+        return false;
+    }
+
+    string frames;
+    uint32_t id = add( frames, op, flags, body, len );
+    lookup_response response;
+    if ( !send( frames ) || !receive( response, answer ) )
+    {
+        return false;
+    }
+    if ( response.id != id )
+    {
+        return drop();
+    }
+    return response.status == lookup_ok;
+}
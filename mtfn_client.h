@@ -0,0 +1,91 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * lookup_client - encodes names and searches an index through mtfnd, in
+ * place of an encoder and a mapped_index of its own.
+ */
+
+#ifndef __MTFN_CLIENT_H__
+#define __MTFN_CLIENT_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+#include "mtfn_index.h"
+#include "mtfn_protocol.h"
+
+namespace mtfn
+{
+
+// Each call sends its requests and waits for the answers. Every call
+// returns false if the server can't be reached or turns the request down,
+// such as for a record id past the end of the index. When an answer is cut
+// short or isn't the one asked for, the connection is dropped so that no
+// later call reads what was left of it, and the next call connects again.
+// A client is for one thread at a time; threads that share a server should
+// have one each.
+class lookup_client
+{
+public:
+    typedef mapped_index::record_id record_id;
+
+    lookup_client( void ) : m_fd( -1 ), m_next_id( 0 ) {};
+    ~lookup_client() { close(); };
+
+    // Connects to the socket mtfnd listens on. After close(), calls fail
+    // until the next connect().
+    bool connect( const char* path );
+    void close( void );
+
+    // Same as encoder::key() after encoder::encode()
+    bool encode( std::string_view name, sound_key& key );
+    bool encode_utf8( std::string_view name, sound_key& key );
+
+    // The keys of all the names, which are all sent before the first
+    // answer is read, so they can share batches on the server
+    bool encode( const std::vector<std::string_view>& names,
+        std::vector<sound_key>& keys );
+
+    // Same as mapped_index::find() and mapped_index::name()
+    bool find( std::string_view name, std::vector<record_id>& matches );
+    bool find_utf8( std::string_view name, std::vector<record_id>& matches );
+    bool name( record_id id, std::string& name );
+
+    bool stats( server_stats& stats );
+
+private:
+    lookup_client( const lookup_client& );
+    const lookup_client& operator =( const lookup_client& );
+
+    // Adds a request to frames, returning its id
+    uint32_t add( std::string& frames, int op, int flags, const void* body,
+        size_t len );
+    // Closes the socket, but keeps the path to connect to again
+    bool drop( void );
+    bool send( const std::string& frames );
+    bool receive( lookup_response& response, std::string& body );
+    bool call( int op, int flags, const void* body, size_t len,
+        std::string& answer );
+    bool find( std::string_view name, int flags,
+        std::vector<record_id>& matches );
+
+    std::string m_path;
+    int m_fd;
+    uint32_t m_next_id;
+};
+
+}; // namespace mtfn
+
+#endif
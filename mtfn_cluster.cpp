@@ -0,0 +1,264 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "mtfn_cluster.h"
+#include "mtfn_input.h"
+#include "mtfn_parallel.h"
+
+using namespace std;
+using namespace mtfn;
+
+const size_t code_count = 0x10000;
+const size_t none = (size_t)-1;
+
+// A union-find over the codes that any number of threads can join at
+// once. Roots are only ever linked under smaller roots, with a compare and
+// swap that fails if another thread got there first, and finds halve the
+// path as they go; a halving that loses a race only leaves the path as
+// long as it was.
+class code_sets
+{
+public:
+    code_sets( void ) : m_parent( code_count )
+    {
+        for ( size_t c = 0; c < code_count; c++ )
+        {
+            m_parent[c].store( c, memory_order_relaxed );
+        }
+    };
+
+    uint32_t find( uint32_t c )
+    {
+        for ( ;; )
+        {
+            uint32_t p = m_parent[c].load( memory_order_acquire );
+            if ( p == c )
+            {
+                return c;
+            }
+
+            uint32_t gp = m_parent[p].load( memory_order_acquire );
+            if ( gp != p )
+            {
+                m_parent[c].compare_exchange_weak( p, gp,
+                    memory_order_release, memory_order_relaxed );
+            }
+            c = gp;
+        }
+    };
+
+    void join( uint32_t a, uint32_t b )
+    {
+        for ( ;; )
+        {
+            a = find( a );
+            b = find( b );
+            if ( a == b )
+            {
+                return;
+            }
+
+            uint32_t high = max( a, b ), low = min( a, b );
+            if ( m_parent[high].compare_exchange_strong( high, low,
+                    memory_order_acq_rel, memory_order_acquire ) )
+            {
+                return;
+            }
+        }
+    };
+
+private:
+    vector<atomic<uint32_t> > m_parent;
+};
+
+// Once every name has joined its codes: each code's root, and for each
+// root the first name under it, then each name's cluster from those
+static void number_clusters( const vector<sound_key>& keys, int threads,
+    code_sets& sets, vector<size_t>& cluster, cluster_stats& stats )
+{
+    vector<uint16_t> root( code_count );
+    for ( size_t c = 0; c < code_count; c++ )
+    {
+        root[c] = sets.find( c );
+    }
+
+    // Each thread has names after those of the threads before it, so the
+    // first thread to see a root saw its first name
+    vector<vector<size_t> > firsts( threads, vector<size_t>() );
+    parallel_for( threads, keys.size(),
+        [&]( int t, size_t begin, size_t end ) {
+            vector<size_t>& first( firsts[t] );
+            first.assign( code_count, none );
+            for ( size_t i = begin; i < end; i++ )
+            {
+                size_t& f( first[root[keys[i].primary]] );
+                f = min( f, i );
+            }
+        } );
+
+    vector<size_t> first( code_count, none );
+    for ( int t = threads - 1; t >= 0; t-- )
+    {
+        for ( size_t c = 0; c < code_count; c++ )
+        {
+            if ( firsts[t][c] != none )
+            {
+                first[c] = firsts[t][c];
+            }
+        }
+    }
+
+    cluster.resize( keys.size() );
+    vector<size_t> clusters( threads, 0 );
+    parallel_for( threads, keys.size(),
+        [&]( int t, size_t begin, size_t end ) {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                cluster[i] = first[root[keys[i].primary]];
+                clusters[t] += cluster[i] == i;
+            }
+        } );
+
+    stats.names = keys.size();
+    stats.clusters = 0;
+    for ( size_t n : clusters )
+    {
+        stats.clusters += n;
+    }
+}
+
+static void join_codes( code_sets& sets, const sound_key& key )
+{
+    if ( key.alternate != key.primary )
+    {
+        sets.join( key.primary, key.alternate );
+    }
+}
+
+void mtfn::cluster_keys( const vector<sound_key>& keys, int threads,
+    vector<size_t>& cluster, cluster_stats& stats )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    threads = thread_count( threads );
+    code_sets sets;
+    parallel_for( threads, keys.size(),
+        [&]( int, size_t begin, size_t end ) {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                join_codes( sets, keys[i] );
+            }
+        } );
+
+    number_clusters( keys, threads, sets, cluster, stats );
+
+    stats.threads = threads;
+    stats.seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start ).count();
+}
+
+void mtfn::cluster_names( const vector<string_view>& names, int threads,
+    vector<size_t>& cluster, cluster_stats& stats )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Each name joins its codes as soon as it is encoded
+    threads = thread_count( threads );
+    code_sets sets;
+    vector<sound_key> keys( names.size() );
+    parallel_for( threads, names.size(),
+        [&]( int, size_t begin, size_t end ) {
+            encoder enc;
+            for ( size_t i = begin; i < end; i++ )
+            {
+                enc.encode( names[i] );
+                keys[i] = enc.key();
+                join_codes( sets, keys[i] );
+            }
+        } );
+
+    number_clusters( keys, threads, sets, cluster, stats );
+
+    stats.threads = threads;
+    stats.seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start ).count();
+}
+
+bool mtfn::cluster_file( const char* filename, FILE* out, int threads,
+    cluster_stats& stats )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    input_file input;
+    if ( !input.open( filename ) )
+    {
+        return false;
+    }
+
+    vector<string_view> names;
+    for ( const char* line = input.begin(); line < input.end(); )
+    {
+        const char* nl = (const char*)memchr( line, '\n',
+            input.end() - line );
+        const char* eol = nl == NULL ? input.end() : nl;
+
+        names.push_back( string_view( line, eol - line ) );
+        line = eol + 1;
+    }
+
+    vector<size_t> cluster;
+    cluster_names( names, threads, cluster, stats );
+
+    // Written a block of names per thread at a time, formatted in parallel
+    const size_t block_names = 1 << 16;
+    vector<string> blocks( stats.threads );
+    bool worked = true;
+
+    for ( size_t done = 0; done < names.size(); )
+    {
+        size_t count = min( names.size() - done,
+            block_names * stats.threads );
+        parallel_for( stats.threads, count,
+            [&]( int t, size_t begin, size_t end ) {
+                string& b( blocks[t] );
+                b.clear();
+                for ( size_t i = done + begin; i < done + end; i++ )
+                {
+                    b.append( names[i] );
+                    b += ',';
+                    b += to_string( cluster[i] );
+                    b += '\n';
+                }
+            } );
+
+        for ( const string& b : blocks )
+        {
+            worked = worked && fwrite( b.data(), 1, b.size(), out ) == b.size();
+        }
+        done += count;
+    }
+
+    worked = fflush( out ) == 0 && worked;
+
+    stats.seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start ).count();
+
+    return worked;
+}
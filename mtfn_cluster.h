@@ -0,0 +1,65 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * cluster_names() - groups names that sound alike, on several threads,
+ * without comparing every name with every other.
+ */
+
+#ifndef __MTFN_CLUSTER_H__
+#define __MTFN_CLUSTER_H__
+
+#include <cstdio>
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+struct cluster_stats
+{
+    size_t names;
+    size_t clusters;
+    double seconds;
+    int threads;
+};
+
+// Two names are in the same cluster when they sound the same, or when
+// there is a chain of names from one to the other that each sound like
+// the next: a name whose primary code is one name's and whose alternate
+// is another's joins all three. Each name joins the clusters of its
+// primary and alternate codes, so the clusters are those of a union-find
+// over the 65536 length limited codes, which the threads share without
+// locks.
+//
+// Sets cluster[i] to the index of the first name in the same cluster as
+// name i, so names i with cluster[i] == i start the clusters. The names
+// are split between threads threads, or one per core if threads is 0.
+void cluster_names( const std::vector<std::string_view>& names, int threads,
+    std::vector<size_t>& cluster, cluster_stats& stats );
+
+// The same for names already encoded
+void cluster_keys( const std::vector<sound_key>& keys, int threads,
+    std::vector<size_t>& cluster, cluster_stats& stats );
+
+// Writes "name,cluster" to out for every line of the file, in the order of
+// the file, with cluster the line number (from 0) of the first name in its
+// cluster. This is what mtfn -c writes. Returns false if the file can't be
+// read or out can't be written.
+bool cluster_file( const char* filename, FILE* out, int threads,
+    cluster_stats& stats );
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,269 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstdlib>
+#include <algorithm>
+#include "mtfn_fuzzy.h"
+
+using namespace std;
+using namespace mtfn;
+
+typedef fuzzy_index::record_id record_id;
+
+// No code packs to 0, so the number of codes is the number of nibbles
+// from the highest one set
+static int code_count( uint64_t code )
+{
+    return code == 0 ? 0 : ( 67 - __builtin_clzll( code ) ) / 4;
+}
+
+static int code_at( uint64_t code, int len, int i )
+{
+    return ( code >> ( 4 * ( len - 1 - i ) ) ) & 0xF;
+}
+
+int mtfn::code_distance( uint64_t lhs, uint64_t rhs, int bound )
+{
+    if ( is_fingerprint( lhs ) || is_fingerprint( rhs ) )
+    {
+        return lhs == rhs ? 0 : bound + 1;
+    }
+
+    int m = code_count( lhs );
+    int n = code_count( rhs );
+    if ( abs( m - n ) > bound )
+    {
+        return bound + 1;
+    }
+    if ( m == 0 )
+    {
+        return n;
+    }
+
+    // Bit i of peq[c] is set where code i of lhs is c. Bit i of pv and mv
+    // is set where row i + 1 of the current column is one more or one less
+    // than row i, and score is the last row.
+    uint32_t peq[16] = { 0 };
+    for ( int i = 0; i < m; i++ )
+    {
+        peq[code_at( lhs, m, i )] |= 1u << i;
+    }
+
+    uint32_t pv = ( 1u << m ) - 1;
+    uint32_t mv = 0;
+    uint32_t last = 1u << ( m - 1 );
+    int score = m;
+
+    for ( int j = 0; j < n; j++ )
+    {
+        uint32_t eq = peq[code_at( rhs, n, j )];
+        uint32_t xv = eq | mv;
+        uint32_t xh = ( ( ( eq & pv ) + pv ) ^ pv ) | eq;
+        uint32_t ph = mv | ~( xh | pv );
+        uint32_t mh = pv & xh;
+
+        if ( ph & last )
+        {
+            score++;
+        }
+        else if ( mh & last )
+        {
+            score--;
+        }
+
+        // The top row counts up, one more insertion per column
+        ph = ( ph << 1 ) | 1;
+        mh <<= 1;
+        pv = mh | ~( xv | ph );
+        mv = ph & xv;
+
+        // Neighbouring columns differ by at most one
+        if ( score - ( n - 1 - j ) > bound )
+        {
+            return bound + 1;
+        }
+    }
+
+    return min( score, bound + 1 );
+}
+
+int mtfn::key_distance( const sound_key& lhs, const sound_key& rhs,
+    int bound )
+{
+    if ( lhs == rhs )
+    {
+        return 0;
+    }
+
+    // The alternates are the primaries when there aren't any, and those
+    // pairs have been tried already
+    int d = code_distance( lhs.primary, rhs.primary, bound );
+    if ( rhs.alternate != rhs.primary )
+    {
+        d = min( d, code_distance( lhs.primary, rhs.alternate, d ) );
+    }
+    if ( lhs.alternate != lhs.primary )
+    {
+        d = min( d, code_distance( lhs.alternate, rhs.primary, d ) );
+        if ( rhs.alternate != rhs.primary )
+        {
+            d = min( d, code_distance( lhs.alternate, rhs.alternate, d ) );
+        }
+    }
+    return d;
+}
+
+int mtfn::sound_distance( const sound& lhs, const sound& rhs, int bound )
+{
+    uint64_t lhs_alt = lhs.has_alternate() ? lhs.alternate_code()
+                                           : lhs.primary_code();
+    uint64_t rhs_alt = rhs.has_alternate() ? rhs.alternate_code()
+                                           : rhs.primary_code();
+
+    int d = code_distance( lhs.primary_code(), rhs.primary_code(), bound );
+    d = min( d, code_distance( lhs.primary_code(), rhs_alt, d ) );
+    d = min( d, code_distance( lhs_alt, rhs_alt, d ) );
+    return min( d, code_distance( lhs_alt, rhs.primary_code(), d ) );
+}
+
+// Appends every code that deleting up to count codes from code leaves,
+// code itself included, possibly more than once
+static void deletions( uint16_t code, int count, vector<uint16_t>& out )
+{
+    out.push_back( code );
+    if ( count == 0 )
+    {
+        return;
+    }
+
+    int len = code_count( code );
+    for ( int i = 0; i < len; i++ )
+    {
+        int low_bits = 4 * ( len - 1 - i );
+        uint32_t high = code >> ( low_bits + 4 );
+        uint32_t low = code & ( ( 1u << low_bits ) - 1 );
+        deletions( (uint16_t)( ( high << low_bits ) | low ), count - 1, out );
+    }
+}
+
+static void sort_unique( vector<uint16_t>& codes )
+{
+    sort( codes.begin(), codes.end() );
+    codes.erase( unique( codes.begin(), codes.end() ), codes.end() );
+}
+
+fuzzy_index::fuzzy_index( int max_distance )
+: m_max_distance( max_distance )
+{
+}
+
+record_id fuzzy_index::insert( string_view name )
+{
+    encoder enc;
+    enc.encode( name );
+    return insert( enc.key() );
+}
+
+record_id fuzzy_index::insert( const sound_key& key )
+{
+    record_id id = m_keys.size();
+    m_keys.push_back( key );
+
+    post( key.primary, id );
+    if ( key.alternate != key.primary )
+    {
+        post( key.alternate, id );
+    }
+
+    return id;
+}
+
+void fuzzy_index::post( uint16_t code, record_id id )
+{
+    vector<record_id>& postings( m_postings[code] );
+
+    // Only a code's first record makes it new to the deletions
+    if ( postings.empty() )
+    {
+        vector<uint16_t> deleted;
+        deletions( code, m_max_distance, deleted );
+        sort_unique( deleted );
+        for ( uint16_t d : deleted )
+        {
+            m_deletions[d].push_back( code );
+        }
+    }
+
+    postings.push_back( id );
+}
+
+void fuzzy_index::find( string_view name, int distance,
+    vector<record_id>& matches ) const
+{
+    encoder enc;
+    enc.encode( name );
+    find( enc.key(), distance, matches );
+}
+
+void fuzzy_index::find( const sound_key& key, int distance,
+    vector<record_id>& matches ) const
+{
+    distance = min( distance, m_max_distance );
+
+    vector<uint16_t> deleted;
+    deletions( key.primary, distance, deleted );
+    if ( key.alternate != key.primary )
+    {
+        deletions( key.alternate, distance, deleted );
+    }
+    sort_unique( deleted );
+
+    // Codes sharing a deletion with the key are only candidates
+    vector<uint16_t> codes;
+    for ( uint16_t d : deleted )
+    {
+        auto found = m_deletions.find( d );
+        if ( found != m_deletions.end() )
+        {
+            codes.insert( codes.end(), found->second.begin(),
+                found->second.end() );
+        }
+    }
+    sort_unique( codes );
+
+    vector<uint16_t> near;
+    for ( uint16_t code : codes )
+    {
+        if ( min( code_distance( code, key.primary, distance ),
+                  code_distance( code, key.alternate, distance ) ) <= distance )
+        {
+            near.push_back( code );
+        }
+    }
+
+    // A record posted under both of its codes is taken from its primary
+    for ( uint16_t code : near )
+    {
+        for ( record_id id : m_postings.at( code ) )
+        {
+            const sound_key& k( m_keys[id] );
+            if ( code == k.primary ||
+                 !binary_search( near.begin(), near.end(), k.primary ) )
+            {
+                matches.push_back( id );
+            }
+        }
+    }
+}
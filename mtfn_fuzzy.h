@@ -0,0 +1,93 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * code_distance() - the edit distance between packed codes.
+ *
+ * class fuzzy_index - finds every key within an edit distance of another
+ * without comparing it against them all.
+ */
+
+#ifndef __MTFN_FUZZY_H__
+#define __MTFN_FUZZY_H__
+
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// The number of codes that inserting, deleting or replacing one at a time
+// takes to turn the codes packed in lhs into the ones packed in rhs, such
+// as 1 for "KRSN" and "KRST". It works on the packed codes a bit per code
+// at a time (Myers' bit-parallel algorithm), and gives up as soon as the
+// distance must be more than bound, returning bound + 1. Fingerprints of
+// codes longer than packed_len are 0 apart if equal and bound + 1 if not.
+int code_distance( uint64_t lhs, uint64_t rhs, int bound = packed_len );
+
+// The least distance between a primary or alternate code of each, so 0
+// when operator== is true. key_distance() is for the length limited codes.
+int key_distance( const sound_key& lhs, const sound_key& rhs,
+    int bound = stop_len );
+int sound_distance( const sound& lhs, const sound& rhs,
+    int bound = packed_len );
+
+// Each record is posted under its primary and alternate codes, as in a
+// sound_index. Each distinct code is also posted under every code that
+// deleting up to max_distance codes from it leaves, so two codes within
+// distance k of each other always have a deletion in common: a search
+// looks up the deletions of the codes searched for, checks the distance of
+// each code found there, and takes the records of the ones close enough.
+// The deletions are of distinct codes, of which there are at most 65536,
+// so the records only cost their postings.
+class fuzzy_index
+{
+public:
+    typedef size_t record_id;
+
+    fuzzy_index( int max_distance = 1 );
+
+    // Records are numbered from 0 in the order they are inserted. name is
+    // coded in ASCII or ISO-8859-15, same as sound( const std::string& )
+    record_id insert( std::string_view name );
+    record_id insert( const sound_key& key );
+
+    // Appends the ids of all the records whose keys are no more than
+    // distance from the name or key, each of them once, in the order they
+    // were inserted for each code. A distance more than max_distance() is
+    // taken as max_distance().
+    void find( std::string_view name, int distance,
+        std::vector<record_id>& matches ) const;
+    void find( const sound_key& key, int distance,
+        std::vector<record_id>& matches ) const;
+
+    size_t size( void ) const { return m_keys.size(); };
+    const sound_key& key( record_id id ) const { return m_keys[id]; };
+    int max_distance( void ) const { return m_max_distance; };
+
+private:
+    void post( uint16_t code, record_id id );
+
+    int m_max_distance;
+    std::vector<sound_key> m_keys;
+
+    // Records by code, and codes by what deletions leave of them
+    std::unordered_map<uint16_t, std::vector<record_id> > m_postings;
+    std::unordered_map<uint16_t, std::vector<uint16_t> > m_deletions;
+};
+
+}; // namespace mtfn
+
+#endif
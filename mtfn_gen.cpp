@@ -0,0 +1,951 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * Turns the rules of mtfn_rules.tab into the tables of mtfn_table.h that
+ * rules::walk_table() runs. See mtfn_rules.tab for what it says.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+#define error cerr << __FILE__ << ':' << __LINE__ << ' '
+
+// The same as table_kind and table_base in mtfn.h
+enum kind
+{
+    kind_char,
+    kind_text,
+    kind_cursor_at,
+    kind_cursor_after,
+    kind_last_at,
+    kind_slavo,
+    kind_never
+};
+
+const char* const kind_names[] = { "table_char", "table_text",
+    "table_cursor_at", "table_cursor_after", "table_last_at", "table_slavo",
+    "table_never" };
+
+enum base
+{
+    base_cursor,
+    base_start,
+    base_last
+};
+
+const char* const base_names[] = { "table_cursor", "table_start",
+    "table_last" };
+
+const int max_codes = 2;
+const int max_pattern = 7;
+
+struct test
+{
+    int kind;
+    int base;
+    int offset;
+    bool negated;
+    string set;                 // kind_char
+    vector<string> patterns;    // kind_text, all the same length
+};
+
+// Any one of its tests passing is enough
+typedef vector<test> clause;
+
+struct rule
+{
+    int line;
+    vector<clause> clauses;     // all of them have to pass
+    string primary;
+    string alternate;
+    bool alternates;
+    int advance;                // 0 to go on with the next group
+};
+
+typedef vector<rule> group;
+
+struct letter_block
+{
+    vector<int> letters;        // -1 for other
+    vector<group> groups;
+};
+
+// Splits s at the spaces, or at sep, that aren't in quotes
+static vector<string> split( const string& s, char sep )
+{
+    vector<string> pieces;
+    string piece;
+    bool quoted = false;
+
+    for ( size_t i = 0; i < s.size(); i++ )
+    {
+        char c = s[i];
+        if ( c == '\\' && quoted && i + 1 < s.size() )
+        {
+            piece += c;
+            piece += s[++i];
+            continue;
+        }
+        if ( c == '"' )
+        {
+            quoted = !quoted;
+        }
+        if ( !quoted && ( sep == ' ' ? isspace( (unsigned char)c ) : c == sep ) )
+        {
+            if ( !piece.empty() || sep != ' ' )
+            {
+                pieces.push_back( piece );
+            }
+            piece.clear();
+            continue;
+        }
+        piece += c;
+    }
+    if ( !piece.empty() || ( sep != ' ' && !pieces.empty() ) )
+    {
+        pieces.push_back( piece );
+    }
+
+    return pieces;
+}
+
+// The characters of s, with \xHH for any character and \\ and \" for
+// those two. Returns false if an escape is bad.
+static bool unescape( const string& s, string& out )
+{
+    out.clear();
+    for ( size_t i = 0; i < s.size(); i++ )
+    {
+        if ( s[i] != '\\' )
+        {
+            out += s[i];
+            continue;
+        }
+        if ( i + 1 < s.size() && ( s[i + 1] == '\\' || s[i + 1] == '"' ) )
+        {
+            out += s[++i];
+            continue;
+        }
+        if ( i + 3 >= s.size() || s[i + 1] != 'x' ||
+             !isxdigit( (unsigned char)s[i + 2] ) ||
+             !isxdigit( (unsigned char)s[i + 3] ) )
+        {
+            return false;
+        }
+        out += (char)stoi( s.substr( i + 2, 2 ), NULL, 16 );
+        i += 3;
+    }
+    return true;
+}
+
+// +1, -2 or 0 from the cursor, ^0 from the start, $ or $-1 from the last
+static bool parse_pos( const string& s, int& b, int& offset )
+{
+    string number = s;
+    b = base_cursor;
+    if ( !s.empty() && ( s[0] == '^' || s[0] == '$' ) )
+    {
+        b = s[0] == '^' ? base_start : base_last;
+        number = s.substr( 1 );
+        if ( b == base_last && number.empty() )
+        {
+            number = "0";
+        }
+    }
+
+    size_t used = 0;
+    try
+    {
+        offset = stoi( number, &used );
+    }
+    catch ( ... )
+    {
+        return false;
+    }
+    return used == number.size() && -64 < offset && offset < 64;
+}
+
+static bool parse_test( const string& token, test& t )
+{
+    string s = token;
+    t = test{ kind_never, base_start, 0, false, "", {} };
+
+    if ( !s.empty() && s[0] == '!' )
+    {
+        t.negated = true;
+        s = s.substr( 1 );
+    }
+
+    if ( s == "slavo" )
+    {
+        t.kind = kind_slavo;
+        return true;
+    }
+
+    if ( s.compare( 0, 2, "c=" ) == 0 || s.compare( 0, 2, "c>" ) == 0 )
+    {
+        t.kind = s[1] == '=' ? kind_cursor_at : kind_cursor_after;
+        if ( !parse_pos( s.substr( 2 ), t.base, t.offset ) ||
+             t.base == base_cursor )
+        {
+            // c=0 is from the start, like c=^0
+            t.base = base_start;
+            return parse_pos( "^" + s.substr( 2 ), t.base, t.offset );
+        }
+        return true;
+    }
+
+    if ( s.compare( 0, 2, "$=" ) == 0 )
+    {
+        t.kind = kind_last_at;
+        return parse_pos( "^" + s.substr( 2 ), t.base, t.offset );
+    }
+
+    bool is_char = s.compare( 0, 5, "char(" ) == 0;
+    if ( ( !is_char && s.compare( 0, 5, "text(" ) != 0 ) || s.back() != ')' )
+    {
+        return false;
+    }
+
+    vector<string> args = split( s.substr( 5, s.size() - 6 ), ',' );
+    if ( args.size() < 2 || ( is_char && args.size() != 2 ) ||
+         !parse_pos( args[0], t.base, t.offset ) )
+    {
+        return false;
+    }
+
+    t.kind = is_char ? kind_char : kind_text;
+    for ( size_t i = 1; i < args.size(); i++ )
+    {
+        const string& a( args[i] );
+        string chars;
+        if ( a.size() < 3 || a.front() != '"' || a.back() != '"' ||
+             !unescape( a.substr( 1, a.size() - 2 ), chars ) )
+        {
+            return false;
+        }
+
+        if ( is_char )
+        {
+            t.set = chars;
+            for ( char c : chars )
+            {
+                if ( c < ' ' || c > '_' )
+                {
+                    return false;
+                }
+            }
+        }
+        else
+        {
+            if ( chars.size() > (size_t)max_pattern ||
+                 ( !t.patterns.empty() &&
+                   chars.size() != t.patterns[0].size() ) )
+            {
+                return false;
+            }
+            t.patterns.push_back( chars );
+        }
+    }
+
+    return true;
+}
+
+static bool parse_codes( const string& s, rule& r )
+{
+    size_t bar = s.find( '|' );
+    r.alternates = bar != string::npos;
+    r.primary = s == "-" ? "" : s.substr( 0, bar );
+    r.alternate = !r.alternates ? r.primary : s.substr( bar + 1 );
+
+    for ( const string* codes : { &r.primary, &r.alternate } )
+    {
+        if ( codes->size() > (size_t)max_codes ||
+             codes->find_first_not_of( "0AFHJKLMNPRSTX" ) != string::npos )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse( const char* filename, vector<letter_block>& blocks )
+{
+    ifstream istrm( filename );
+    if ( !istrm )
+    {
+        error << "can't read " << filename << endl;
+        return false;
+    }
+
+    string s;
+    for ( int n = 1; getline( istrm, s ); n++ )
+    {
+        vector<string> tokens = split( s.substr( 0, s.find( '#' ) ), ' ' );
+        if ( tokens.empty() )
+        {
+            continue;
+        }
+
+        if ( tokens[0] == "letter" )
+        {
+            blocks.push_back( letter_block{ {}, { group() } } );
+            for ( size_t i = 1; i < tokens.size(); i++ )
+            {
+                string letter;
+                if ( tokens[i] == "other" )
+                {
+                    blocks.back().letters.push_back( -1 );
+                }
+                else if ( unescape( tokens[i], letter ) && letter.size() == 1 )
+                {
+                    blocks.back().letters.push_back( (unsigned char)letter[0] );
+                }
+                else
+                {
+                    error << filename << ':' << n << ": bad letter "
+                          << tokens[i] << endl;
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        if ( blocks.empty() )
+        {
+            error << filename << ':' << n << ": no letter yet" << endl;
+            return false;
+        }
+
+        if ( tokens[0] == "then" && tokens.size() == 1 )
+        {
+            blocks.back().groups.push_back( group() );
+            continue;
+        }
+
+        vector<string>::iterator arrow = find( tokens.begin(), tokens.end(),
+            "->" );
+        rule r{ n, {}, "", "", false, 0 };
+        size_t after = tokens.end() - arrow;
+        if ( arrow == tokens.end() || after < 2 || after > 3 ||
+             !parse_codes( arrow[1], r ) ||
+             ( after == 3 && ( arrow[2][0] != '+' ||
+                 ( r.advance = atoi( arrow[2].c_str() + 1 ) ) < 1 ) ) )
+        {
+            error << filename << ':' << n << ": needs tests -> codes +advance"
+                  << endl;
+            return false;
+        }
+
+        for ( vector<string>::iterator t = tokens.begin(); t != arrow; t++ )
+        {
+            clause any;
+            for ( const string& piece : split( *t, '|' ) )
+            {
+                test one;
+                if ( !parse_test( piece, one ) )
+                {
+                    error << filename << ':' << n << ": bad test " << piece
+                          << endl;
+                    return false;
+                }
+                any.push_back( one );
+            }
+            r.clauses.push_back( any );
+        }
+
+        blocks.back().groups.back().push_back( r );
+    }
+
+    // Every group has to end in a rule that always applies, and every rule
+    // of the last group has to end the letter
+    for ( const letter_block& b : blocks )
+    {
+        for ( size_t g = 0; g < b.groups.size(); g++ )
+        {
+            const group& rules( b.groups[g] );
+            if ( rules.empty() || !rules.back().clauses.empty() )
+            {
+                error << filename << ": a group of letter " << b.letters[0]
+                      << " doesn't end in a rule without tests" << endl;
+                return false;
+            }
+            for ( const rule& r : rules )
+            {
+                if ( g + 1 == b.groups.size() && r.advance == 0 )
+                {
+                    error << filename << ':' << r.line << ": the last group "
+                          << "has to move the cursor on" << endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// What the character at pos from the cursor is known to be: the letter of
+// the row at 0, the one of the column at +1, and _ before the start. -1 is
+// any character no test mentions.
+static bool known( int pos, bool started, int letter, int next, int& c )
+{
+    if ( pos == 0 )
+    {
+        c = letter;
+    }
+    else if ( pos == 1 )
+    {
+        c = next;
+    }
+    else if ( pos < 0 && !started )
+    {
+        c = '_';
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// 1 or 0 when the test passes or fails whatever the rest of the name is,
+// otherwise -1, with the patterns that can't match taken out of t. Tests
+// from the start of the name are from the cursor when it is at the start.
+static int decide( test& t, bool started, int letter, int next )
+{
+    if ( !started && t.base == base_start &&
+         ( t.kind == kind_char || t.kind == kind_text ) )
+    {
+        t.base = base_cursor;
+    }
+
+    int result = -1;
+    int c;
+    switch ( t.kind )
+    {
+        case kind_char:
+            if ( t.base == base_cursor &&
+                 known( t.offset, started, letter, next, c ) )
+            {
+                result = c >= 0 && t.set.find( (char)c ) != string::npos;
+            }
+            break;
+        case kind_text:
+        {
+            if ( t.base != base_cursor )
+            {
+                break;
+            }
+
+            vector<string> left;
+            for ( const string& p : t.patterns )
+            {
+                bool matches = true, all_known = true;
+                for ( size_t i = 0; i < p.size() && matches; i++ )
+                {
+                    if ( known( t.offset + i, started, letter, next, c ) )
+                    {
+                        matches = c == (unsigned char)p[i];
+                    }
+                    else
+                    {
+                        all_known = false;
+                    }
+                }
+                if ( matches && all_known )
+                {
+                    result = 1;
+                    break;
+                }
+                if ( matches )
+                {
+                    left.push_back( p );
+                }
+            }
+            if ( result < 0 )
+            {
+                t.patterns = left;
+                result = left.empty() ? 0 : -1;
+            }
+            break;
+        }
+        case kind_cursor_at:
+            if ( t.base == base_start )
+            {
+                result = !started ? t.offset == 0 : t.offset < 1 ? 0 : -1;
+            }
+            break;
+        case kind_cursor_after:
+            if ( t.base == base_start )
+            {
+                result = !started ? 0 > t.offset : t.offset < 1 ? 1 : -1;
+            }
+            break;
+        case kind_never:
+            result = 0;
+            break;
+    }
+
+    return result < 0 ? -1 : result != t.negated;
+}
+
+static bool asks_slavo( const vector<test>& tests )
+{
+    for ( const test& t : tests )
+    {
+        if ( t.kind == kind_slavo )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The rule as it stands for one cell, without the tests that can be
+// decided there. Returns false if it can never apply there. Tests are only
+// left out when the rules wouldn't have run them either, and the tests
+// that are left run in the same order, so a rule asks whether a name is
+// Slavo-Germanic exactly when the letter's rule would have: when a test
+// decides the outcome after that question, the question stays, followed
+// by a test that always or never passes.
+static bool specialize( rule& r, bool started, int letter, int next )
+{
+    const test always{ kind_never, base_start, 0, true, "", {} };
+    const test never{ kind_never, base_start, 0, false, "", {} };
+    vector<clause> left;
+
+    for ( clause any : r.clauses )
+    {
+        clause undecided;
+        int outcome = 0;
+
+        for ( test t : any )
+        {
+            int result = decide( t, started, letter, next );
+            if ( result < 0 )
+            {
+                undecided.push_back( t );
+            }
+            else if ( result == 1 )
+            {
+                outcome = 1;
+                break;
+            }
+        }
+
+        if ( outcome == 1 && asks_slavo( undecided ) )
+        {
+            undecided.push_back( always );
+            left.push_back( undecided );
+        }
+        else if ( outcome == 0 && !undecided.empty() )
+        {
+            left.push_back( undecided );
+        }
+        else if ( outcome == 0 )
+        {
+            for ( const clause& earlier : left )
+            {
+                if ( asks_slavo( earlier ) )
+                {
+                    left.push_back( clause( 1, never ) );
+                    r.clauses = left;
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    r.clauses = left;
+    return true;
+}
+
+static string quoted( const string& s )
+{
+    ostringstream out;
+    out << '"';
+    for ( char c : s )
+    {
+        if ( c == '"' || c == '\\' )
+        {
+            out << '\\' << c;
+        }
+        else if ( c < ' ' || c > '~' )
+        {
+            out << "\\x" << hex << (int)(unsigned char)c << dec << "\" \"";
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    return out.str() + '"';
+}
+
+// Packed like a _pat literal, without the length
+static uint64_t packed( const string& pattern )
+{
+    uint64_t p = 0;
+    for ( size_t i = 0; i < pattern.size(); i++ )
+    {
+        p |= (uint64_t)(unsigned char)pattern[i] << ( 8 * i );
+    }
+    return p;
+}
+
+static uint64_t set_bits( const string& set )
+{
+    uint64_t bits = 0;
+    for ( char c : set )
+    {
+        bits |= (uint64_t)1 << ( c - ' ' );
+    }
+    return bits;
+}
+
+// The tables, each run of rules, tests and patterns kept once however many
+// cells or rules it is the same for
+class tables
+{
+public:
+    // Adds the rules of one cell, returning where they start
+    size_t add_cell( const vector<rule>& rules, const vector<size_t>& next )
+    {
+        ostringstream key;
+        vector<string> lines;
+        for ( size_t i = 0; i < rules.size(); i++ )
+        {
+            const rule& r( rules[i] );
+            ostringstream line;
+            size_t tests, tests_end;
+            add_tests( r.clauses, tests, tests_end );
+            line << "    { " << tests << ", " << tests_end << ", "
+                 << quoted( r.primary ) << ", " << quoted( r.alternate )
+                 << ", " << ( r.alternates ? "true" : "false" ) << ", "
+                 << r.advance << ", ";
+            lines.push_back( line.str() );
+            key << line.str() << next[i] << '\n';
+        }
+
+        map<string, size_t>::iterator same = m_cells.find( key.str() );
+        if ( same != m_cells.end() )
+        {
+            return same->second;
+        }
+
+        size_t first = m_rules.size();
+        for ( size_t i = 0; i < rules.size(); i++ )
+        {
+            ostringstream line;
+            line << lines[i] << ( rules[i].advance > 0 ? 0 : first + next[i] )
+                 << " },";
+            m_rules.push_back( line.str() );
+        }
+        m_cells[key.str()] = first;
+        return first;
+    };
+
+    bool write( ostream& ostrm ) const
+    {
+        if ( m_rules.size() > UINT16_MAX || m_tests.size() > UINT16_MAX ||
+             m_patterns.size() > UINT16_MAX )
+        {
+            error << "the tables need more than 16 bit indexes" << endl;
+            return false;
+        }
+
+        ostrm << "inline constexpr uint64_t table_patterns[] =\n{\n";
+        for ( const string& p : m_patterns )
+        {
+            ostrm << "    0x" << hex << packed( p ) << dec << "ULL, // "
+                  << quoted( p ) << '\n';
+        }
+        ostrm << "};\n\n"
+              << "inline constexpr table_test table_tests[] =\n{\n";
+        for ( const string& t : m_tests )
+        {
+            ostrm << t << '\n';
+        }
+        ostrm << "};\n\n"
+              << "inline constexpr table_rule table_rules[] =\n{\n";
+        for ( const string& r : m_rules )
+        {
+            ostrm << r << '\n';
+        }
+        ostrm << "};\n\n";
+
+        return true;
+    };
+
+private:
+    // The tests of a rule, one clause after another, from first up to end
+    void add_tests( const vector<clause>& clauses, size_t& first, size_t& end )
+    {
+        vector<string> lines;
+        string key;
+        for ( const clause& any : clauses )
+        {
+            for ( size_t i = 0; i < any.size(); i++ )
+            {
+                const test& t( any[i] );
+                bool ends = i + 1 == any.size();
+                size_t patterns = t.patterns.empty() ? 0 :
+                    add_patterns( t.patterns );
+                ostringstream line;
+                line << "    { " << kind_names[t.kind] << ", "
+                     << base_names[t.base] << ", " << t.offset << ", "
+                     << ( t.negated && ends ? "table_negated | " :
+                          t.negated ? "table_negated" : "" )
+                     << ( ends ? "table_ends_clause" : t.negated ? "" : "0" )
+                     << ", " << ( t.patterns.empty() ? 0 : t.patterns[0].size() )
+                     << ", " << t.patterns.size() << ", " << patterns << ", 0x"
+                     << hex << set_bits( t.set ) << dec << "ULL },";
+                lines.push_back( line.str() );
+                key += line.str() + '\n';
+            }
+        }
+
+        map<string, size_t>::iterator same = m_test_runs.find( key );
+        if ( same != m_test_runs.end() )
+        {
+            first = same->second;
+        }
+        else
+        {
+            first = m_tests.size();
+            m_tests.insert( m_tests.end(), lines.begin(), lines.end() );
+            m_test_runs[key] = first;
+        }
+        end = first + lines.size();
+    };
+
+    size_t add_patterns( const vector<string>& patterns )
+    {
+        string key;
+        for ( const string& p : patterns )
+        {
+            key += p + '\n';
+        }
+
+        map<string, size_t>::iterator same = m_pattern_runs.find( key );
+        if ( same != m_pattern_runs.end() )
+        {
+            return same->second;
+        }
+
+        size_t first = m_patterns.size();
+        m_patterns.insert( m_patterns.end(), patterns.begin(), patterns.end() );
+        m_pattern_runs[key] = first;
+        return first;
+    };
+
+    vector<string> m_rules;
+    vector<string> m_tests;
+    vector<string> m_patterns;
+    map<string, size_t> m_cells;
+    map<string, size_t> m_test_runs;
+    map<string, size_t> m_pattern_runs;
+};
+
+int main ( int argc, char** argv )
+{
+    if ( argc < 3 )
+    {
+        error << "USAGE: mtfn_gen <rules> <header>" << endl;
+        return 1;
+    }
+
+    vector<letter_block> blocks;
+    if ( !parse( argv[1], blocks ) )
+    {
+        return 1;
+    }
+
+    // Row 0 is for the characters without a block, and column 0 for the
+    // ones no test mentions, which no test can tell apart
+    vector<int> row_letters( 1, -1 );
+    vector<const letter_block*> row_blocks( 1, NULL );
+    for ( const letter_block& b : blocks )
+    {
+        for ( int letter : b.letters )
+        {
+            if ( letter < 0 )
+            {
+                row_blocks[0] = &b;
+                continue;
+            }
+            if ( find( row_letters.begin(), row_letters.end(), letter ) !=
+                 row_letters.end() )
+            {
+                error << argv[1] << ": two blocks for letter " << letter
+                      << endl;
+                return 1;
+            }
+            row_letters.push_back( letter );
+            row_blocks.push_back( &b );
+        }
+    }
+    if ( row_blocks[0] == NULL )
+    {
+        error << argv[1] << ": no block for the other letters" << endl;
+        return 1;
+    }
+
+    vector<int> column_letters( 1, -1 );
+    for ( const letter_block& b : blocks )
+    {
+        for ( const group& rules : b.groups )
+        {
+            for ( const rule& r : rules )
+            {
+                for ( const clause& any : r.clauses )
+                {
+                    for ( const test& t : any )
+                    {
+                        string chars = t.set;
+                        for ( const string& p : t.patterns )
+                        {
+                            chars += p;
+                        }
+                        for ( char c : chars )
+                        {
+                            if ( find( column_letters.begin(),
+                                     column_letters.end(),
+                                     (unsigned char)c ) ==
+                                 column_letters.end() )
+                            {
+                                column_letters.push_back( (unsigned char)c );
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Each cell's rules, group after group, each group only up to its
+    // first rule that always applies there
+    tables out;
+    vector<size_t> cells;
+    for ( int started = 0; started < 2; started++ )
+    {
+        for ( size_t row = 0; row < row_letters.size(); row++ )
+        {
+            for ( size_t col = 0; col < column_letters.size(); col++ )
+            {
+                vector<rule> rules;
+                vector<size_t> group_ends;
+                for ( const group& g : row_blocks[row]->groups )
+                {
+                    for ( rule r : g )
+                    {
+                        if ( specialize( r, started, row_letters[row],
+                                 column_letters[col] ) )
+                        {
+                            rules.push_back( r );
+                            if ( r.clauses.empty() )
+                            {
+                                break;
+                            }
+                        }
+                    }
+                    group_ends.push_back( rules.size() );
+                }
+
+                vector<size_t> next;
+                for ( size_t i = 0, g = 0; i < rules.size(); i++ )
+                {
+                    g += i == group_ends[g];
+                    next.push_back( g < group_ends.size() ? group_ends[g] : 0 );
+                }
+                cells.push_back( out.add_cell( rules, next ) );
+            }
+        }
+    }
+
+    ofstream ostrm( argv[2] );
+    ostrm << "/* Made by mtfn_gen from " << argv[1] << "; change that instead.\n"
+          << " */\n\n"
+          << "#ifndef __MTFN_TABLE_H__\n"
+          << "#define __MTFN_TABLE_H__\n\n"
+          << "namespace mtfn\n{\n\n"
+          << "const int table_rows = " << row_letters.size() << ";\n"
+          << "const int table_columns = " << column_letters.size() << ";\n\n"
+          << "// The row of each character at the cursor\n"
+          << "inline constexpr uint8_t table_row[256] =\n{";
+    for ( int c = 0; c < 256; c++ )
+    {
+        size_t row = find( row_letters.begin(), row_letters.end(), c ) -
+            row_letters.begin();
+        ostrm << ( c % 16 == 0 ? "\n    " : " " )
+              << ( row < row_letters.size() ? row : 0 ) << ',';
+    }
+    ostrm << "\n};\n\n"
+          << "// The column of each character after it\n"
+          << "inline constexpr uint8_t table_column[256] =\n{";
+    for ( int c = 0; c < 256; c++ )
+    {
+        size_t col = find( column_letters.begin(), column_letters.end(), c ) -
+            column_letters.begin();
+        ostrm << ( c % 16 == 0 ? "\n    " : " " )
+              << ( col < column_letters.size() ? col : 0 ) << ',';
+    }
+    ostrm << "\n};\n\n"
+          << "// The first rule for the cursor at the start or after it, by\n"
+          << "// row and column\n"
+          << "inline constexpr uint16_t table_cells[2][table_rows]"
+          << "[table_columns] =\n{\n";
+    vector<size_t>::const_iterator cell = cells.begin();
+    for ( int started = 0; started < 2; started++ )
+    {
+        ostrm << "    {\n";
+        for ( size_t row = 0; row < row_letters.size(); row++ )
+        {
+            ostrm << "        {";
+            for ( size_t col = 0; col < column_letters.size(); col++ )
+            {
+                ostrm << ( col % 16 == 0 && col > 0 ? "\n         " : "" )
+                      << ' ' << *cell++ << ',';
+            }
+            ostrm << " },\n";
+        }
+        ostrm << "    },\n";
+    }
+    ostrm << "};\n\n";
+
+    if ( !out.write( ostrm ) )
+    {
+        return 1;
+    }
+    ostrm << "}; // namespace mtfn\n\n"
+          << "#endif\n";
+
+    if ( !ostrm )
+    {
+        error << "can't write " << argv[2] << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "mtfn_incremental.h"
+#include "mtfn_normalize.h"
+
+using namespace std;
+using namespace mtfn;
+
+incremental_encoder::incremental_encoder( bool limit_length )
+: m_rules( limit_length ),
+  m_settled( 0 ),
+  m_stable( 0 ),
+  m_slavo_germanic( false )
+{
+    clear();
+}
+
+void incremental_encoder::clear( void )
+{
+    m_name.clear();
+    if ( m_primary.size() < (size_t)stop_len )
+    {
+        m_primary.resize( stop_len );
+        m_alternate.resize( stop_len );
+    }
+    m_steps.clear();
+    m_settled = 0;
+    m_stable = 0;
+    m_slavo_germanic = false;
+
+    m_rules.run( m_name.data(), 0, m_primary.data(), m_alternate.data() );
+}
+
+// A step is settled when everything it could have looked at was already
+// in the name, and more of the name can't make it look further
+bool incremental_encoder::is_settled( const rules::checkpoint& step ) const
+{
+    int c = step.cursor;
+
+    return c + lookahead < (int)m_name.size() - 1 &&
+        !( m_name[c] == 'L' && m_name[c + 1] == 'L' );
+}
+
+void incremental_encoder::append( string_view str )
+{
+    size_t old_len = m_name.size();
+
+    m_name.resize( old_len + str.size() );
+    m_name.resize( old_len +
+        normalize_name( str.data(), str.size(), &m_name[old_len] ) );
+    if ( m_name.size() == old_len )
+    {
+        return;
+    }
+
+    // The same test as rules::is_slavo_germanic(), over what is new
+    bool slavo_germanic = m_slavo_germanic;
+    for ( size_t i = old_len > 0 ? old_len - 1 : 0; i < m_name.size(); i++ )
+    {
+        slavo_germanic = slavo_germanic ||
+            ( i >= old_len && ( m_name[i] == 'W' || m_name[i] == 'K' ) ) ||
+            ( m_name[i] == 'C' && i + 1 < m_name.size() && m_name[i + 1] == 'Z' );
+    }
+
+    // Room for the codes as the encoder has, growing ahead of the name so
+    // that typing a character seldom reallocates; vector keeps the codes
+    int len = m_name.size();
+    if ( m_primary.size() < (size_t)( 2 * len + stop_len ) )
+    {
+        m_primary.resize( 4 * len + stop_len );
+        m_alternate.resize( 4 * len + stop_len );
+    }
+
+    if ( m_settled == 0 || slavo_germanic != m_slavo_germanic )
+    {
+        m_steps.clear();
+        m_settled = 0;
+        m_rules.start( m_name.data(), len, m_primary.data(),
+            m_alternate.data() );
+        m_steps.push_back( m_rules.save() );
+    }
+    else
+    {
+        m_steps.resize( m_settled + 1 );
+        m_rules.resume( m_name.data(), len, m_primary.data(),
+            m_alternate.data(), m_steps.back() );
+    }
+    m_slavo_germanic = slavo_germanic;
+
+    while ( !m_rules.is_ready() )
+    {
+        m_rules.step();
+        m_steps.push_back( m_rules.save() );
+    }
+    m_rules.finish();
+
+    while ( m_settled + 1 < m_steps.size() && is_settled( m_steps[m_settled] ) )
+    {
+        m_settled++;
+    }
+
+    // Until the name is Slavo-Germanic, a step that asked whether it is
+    // could still go the other way
+    m_stable = 0;
+    while ( m_stable < m_settled && ( m_slavo_germanic ||
+            !m_steps[m_stable + 1].asked_slavo_germanic ) )
+    {
+        m_stable++;
+    }
+}
+
+string_view incremental_encoder::settled_primary( void ) const
+{
+    size_t len = m_steps.empty() ? 0 : m_steps[m_stable].prim_len;
+    return string_view( m_primary.data(), len );
+}
+
+string_view incremental_encoder::settled_alternate( void ) const
+{
+    size_t len = m_steps.empty() ? 0 : m_steps[m_stable].alt_len;
+    return string_view( m_alternate.data(), len );
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * incremental_encoder - encodes a name as it is typed, without starting
+ * over for every character.
+ */
+
+#ifndef __MTFN_INCREMENTAL_H__
+#define __MTFN_INCREMENTAL_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// Gives the same codes for the name so far as an encoder would, but when
+// characters are appended it only runs the rules again from the first
+// letter whose codes they could change. No rule looks more than lookahead
+// characters past its letter, so the codes of every letter further back
+// than that from the end are settled. The exceptions are names that become
+// Slavo-Germanic, which start over, and Spanish "LL", which depends on how
+// the name ends and so is never settled.
+class incremental_encoder
+{
+public:
+    static const int lookahead = 6;
+
+    incremental_encoder( bool limit_length = true );
+
+    // str coded in ASCII or ISO-8859-15, same as encoder::encode()
+    void append( std::string_view str );
+    void append( char c ) { append( std::string_view( &c, 1 ) ); };
+
+    void clear( void );
+
+    // The name so far, after normalization
+    std::string_view name( void ) const { return m_name; };
+
+    std::string_view primary( void ) const { return m_rules.primary(); };
+    std::string_view alternate( void ) const { return m_rules.alternate(); };
+    bool has_alternate( void ) const { return m_rules.has_alternate(); };
+    uint64_t primary_code( void ) const { return m_rules.primary_code(); };
+    uint64_t alternate_code( void ) const { return m_rules.alternate_code(); };
+    sound_key key( void ) const { return m_rules.key(); };
+
+    // The codes that anything appended can no longer change. Every name
+    // that starts with name() has codes that start with these. The
+    // alternate is the same as the primary until there is one.
+    std::string_view settled_primary( void ) const;
+    std::string_view settled_alternate( void ) const;
+
+private:
+    incremental_encoder( const incremental_encoder& );
+    incremental_encoder& operator=( const incremental_encoder& );
+
+    bool is_settled( const rules::checkpoint& step ) const;
+
+    rules m_rules;
+    std::string m_name;
+    std::vector<char> m_primary;
+    std::vector<char> m_alternate;
+
+    // Where the rules were before each step of the last run, and where
+    // they finished. The first m_settled steps can't change unless the
+    // name becomes Slavo-Germanic, and the first m_stable can't at all.
+    std::vector<rules::checkpoint> m_steps;
+    size_t m_settled;
+    size_t m_stable;
+    bool m_slavo_germanic;
+};
+
+}; // namespace mtfn
+
+#endif
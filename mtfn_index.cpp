@@ -0,0 +1,487 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mtfn_index.h"
+
+using namespace std;
+using namespace mtfn;
+
+typedef sound_index::record_id record_id;
+
+// One entry per possible length limited code, plus one to end the last
+const size_t directory_len = 0x10000 + 1;
+
+const uint32_t byte_order_mark = 0x01020304;
+
+// Where each section of an index file starts, worked out from the header
+struct file_layout
+{
+    size_t directory;
+    size_t postings;
+    size_t keys;
+    size_t offsets;
+    size_t names;
+    size_t end;
+};
+
+static size_t align8( size_t n )
+{
+    return ( n + 7 ) & ~(size_t)7;
+}
+
+// Sets next to the 8 byte boundary after count items of each bytes from
+// start. Returns false if that doesn't fit in a size_t.
+static bool after( size_t start, uint64_t count, size_t each, size_t& next )
+{
+    if ( count > ( SIZE_MAX - 7 - start ) / each )
+    {
+        return false;
+    }
+
+    next = align8( start + count * each );
+    return true;
+}
+
+// Returns false if the header has more than 2^32 records, which can't be
+// posted, or sections too big to address
+static bool layout( const index_file_header& header, file_layout& l )
+{
+    l.directory = align8( sizeof( index_file_header ) );
+    if ( header.records > UINT32_MAX ||
+         !after( l.directory, directory_len, sizeof( uint64_t ), l.postings ) ||
+         !after( l.postings, header.postings, sizeof( uint32_t ), l.keys ) ||
+         !after( l.keys, header.records, sizeof( sound_key ), l.offsets ) ||
+         !after( l.offsets, header.records + 1, sizeof( uint64_t ),
+             l.names ) ||
+         header.names_len > SIZE_MAX - l.names )
+    {
+        return false;
+    }
+
+    l.end = l.names + header.names_len;
+    return true;
+}
+
+// The search shared by sound_index and mapped_index, for short and long
+// keys: everything in the bucket for key.primary, then whatever in the
+// bucket for key.alternate was not already in the first one. Postings that
+// aren't one of the records, which only a damaged file has, are skipped.
+template <typename KEY, typename ITER>
+static void find_in_buckets( const KEY& key,
+        ITER prim_begin, ITER prim_end, ITER alt_begin, ITER alt_end,
+        const KEY* keys, size_t records, vector<record_id>& matches )
+{
+    for ( ITER i = prim_begin; i != prim_end; i++ )
+    {
+        if ( *i < records )
+        {
+            matches.push_back( *i );
+        }
+    }
+
+    if ( key.alternate == key.primary )
+    {
+        return;
+    }
+
+    for ( ITER i = alt_begin; i != alt_end; i++ )
+    {
+        if ( *i >= records )
+        {
+            continue;
+        }
+
+        const KEY& k( keys[*i] );
+        if ( k.primary != key.primary && k.alternate != key.primary )
+        {
+            matches.push_back( *i );
+        }
+    }
+}
+
+// Codes are packed first code highest, so the keys that start with the
+// codes in prefix are prefix itself, then a run of 16 keys one code
+// longer, then a run of 256 two codes longer, and so on up to stop_len.
+// Calls visit( first, last ) for each run, last being one past its end.
+template <typename VISIT>
+static void visit_prefix_runs( string_view codes, VISIT visit )
+{
+    int len = codes.size() < (size_t)stop_len ? codes.size() : stop_len;
+    uint32_t first = rules::pack( codes.data(), len );
+
+    for ( uint32_t span = 1; len <= stop_len; len++, first <<= 4, span <<= 4 )
+    {
+        visit( first, first + span );
+    }
+}
+
+// Records can be posted under both their codes, and for an empty prefix
+// the runs overlap
+static void sort_new_matches( vector<record_id>& matches, size_t found )
+{
+    sort( matches.begin() + found, matches.end() );
+    matches.erase( unique( matches.begin() + found, matches.end() ),
+        matches.end() );
+}
+
+sound_index::sound_index( key_length codes )
+: m_key_len( codes.codes == 0 || codes.codes > stop_len ? codes.codes
+                                                      : stop_len )
+{
+    m_offsets.push_back( 0 );
+}
+
+sound_index::record_id sound_index::insert( string_view name )
+{
+    const key_length codes( m_key_len );
+    encoder enc( codes );
+    enc.encode( name );
+
+    record_id id = m_keys.size();
+    sound_key key = enc.key();
+
+    m_names.append( name );
+    m_offsets.push_back( m_names.size() );
+    m_keys.push_back( key );
+
+    m_buckets[key.primary].push_back( id );
+    if ( key.alternate != key.primary )
+    {
+        m_buckets[key.alternate].push_back( id );
+    }
+
+    if ( long_keys() )
+    {
+        long_key full = enc.full_key();
+
+        m_long_keys.push_back( full );
+        m_long_buckets[full.primary].push_back( id );
+        if ( full.alternate != full.primary )
+        {
+            m_long_buckets[full.alternate].push_back( id );
+        }
+    }
+
+    return id;
+}
+
+void sound_index::find( string_view name, vector<record_id>& matches ) const
+{
+    const key_length codes( m_key_len );
+    encoder enc( codes );
+    enc.encode( name );
+
+    if ( long_keys() )
+    {
+        static const vector<record_id> empty;
+        size_t found = matches.size();
+
+        long_key key = enc.full_key();
+        long_buckets::const_iterator p = m_long_buckets.find( key.primary );
+        long_buckets::const_iterator a = m_long_buckets.find( key.alternate );
+        const vector<record_id>& prim( p == m_long_buckets.end() ? empty
+                                                                 : p->second );
+        const vector<record_id>& alt( a == m_long_buckets.end() ? empty
+                                                                : a->second );
+
+        find_in_buckets( key, prim.begin(), prim.end(), alt.begin(),
+            alt.end(), m_long_keys.data(), m_long_keys.size(), matches );
+
+        // Fingerprints can be the same without the codes being the same,
+        // and sound::operator== compares the codes of those
+        if ( is_fingerprint( key.primary ) || is_fingerprint( key.alternate ) )
+        {
+            const sound snd( string( name ), codes );
+
+            matches.erase( remove_if( matches.begin() + found, matches.end(),
+                [&]( record_id id ) {
+                    return sound( string( this->name( id ) ), codes ) != snd;
+                } ),
+                matches.end() );
+        }
+        return;
+    }
+
+    find( enc.key(), matches );
+}
+
+void sound_index::find( const sound_key& key,
+        vector<record_id>& matches ) const
+{
+    static const vector<record_id> empty;
+
+    buckets::const_iterator p = m_buckets.find( key.primary );
+    buckets::const_iterator a = m_buckets.find( key.alternate );
+    const vector<record_id>& prim( p == m_buckets.end() ? empty : p->second );
+    const vector<record_id>& alt( a == m_buckets.end() ? empty : a->second );
+
+    find_in_buckets( key, prim.begin(), prim.end(), alt.begin(), alt.end(),
+        m_keys.data(), m_keys.size(), matches );
+}
+
+void sound_index::find_prefix( string_view codes,
+        vector<record_id>& matches ) const
+{
+    size_t found = matches.size();
+
+    visit_prefix_runs( codes, [&]( uint32_t first, uint32_t last ) {
+        for ( uint32_t code = first; code < last; code++ )
+        {
+            buckets::const_iterator b = m_buckets.find( (uint16_t)code );
+            if ( b != m_buckets.end() )
+            {
+                matches.insert( matches.end(),
+                    b->second.begin(), b->second.end() );
+            }
+        }
+    } );
+
+    sort_new_matches( matches, found );
+}
+
+static void pad( ofstream& ostrm, size_t offset )
+{
+    static const char zeros[8] = { 0 };
+    ostrm.write( zeros, align8( offset ) - offset );
+}
+
+bool sound_index::save( const char* filename ) const
+{
+    if ( m_keys.size() > UINT32_MAX )
+    {
+        return false;
+    }
+
+    index_file_header header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, "MTFNIDX", sizeof( header.magic ) );
+    header.version = index_file_version;
+    header.byte_order = byte_order_mark;
+    header.records = m_keys.size();
+    header.names_len = m_names.size();
+
+    vector<uint64_t> directory( directory_len, 0 );
+    vector<uint32_t> postings;
+    for ( size_t code = 0; code + 1 < directory_len; code++ )
+    {
+        buckets::const_iterator b = m_buckets.find( (uint16_t)code );
+        if ( b != m_buckets.end() )
+        {
+            postings.insert( postings.end(),
+                b->second.begin(), b->second.end() );
+        }
+        directory[code + 1] = postings.size();
+    }
+    header.postings = postings.size();
+
+    vector<uint64_t> offsets( m_offsets.begin(), m_offsets.end() );
+
+    // Field by field over zeros, so the padding byte at the end of each
+    // key is written as 0 rather than whatever was in memory
+    vector<sound_key> keys( m_keys.size() );
+    memset( keys.data(), 0, keys.size() * sizeof( sound_key ) );
+    for ( size_t i = 0; i < keys.size(); i++ )
+    {
+        keys[i].primary = m_keys[i].primary;
+        keys[i].alternate = m_keys[i].alternate;
+        keys[i].flags = m_keys[i].flags;
+    }
+
+    file_layout l;
+    if ( !layout( header, l ) )
+    {
+        return false;
+    }
+    ofstream ostrm( filename, ios::binary | ios::trunc );
+
+    ostrm.write( (const char*)&header, sizeof( header ) );
+    pad( ostrm, sizeof( header ) );
+    ostrm.write( (const char*)directory.data(),
+        directory.size() * sizeof( uint64_t ) );
+    pad( ostrm, l.directory + directory.size() * sizeof( uint64_t ) );
+    ostrm.write( (const char*)postings.data(),
+        postings.size() * sizeof( uint32_t ) );
+    pad( ostrm, l.postings + postings.size() * sizeof( uint32_t ) );
+    ostrm.write( (const char*)keys.data(), keys.size() * sizeof( sound_key ) );
+    pad( ostrm, l.keys + keys.size() * sizeof( sound_key ) );
+    ostrm.write( (const char*)offsets.data(),
+        offsets.size() * sizeof( uint64_t ) );
+    pad( ostrm, l.offsets + offsets.size() * sizeof( uint64_t ) );
+    ostrm.write( m_names.data(), m_names.size() );
+
+    ostrm.close();
+    return !ostrm.fail();
+}
+
+mapped_index::mapped_index( void )
+: m_base( NULL ),
+  m_len( 0 ),
+  m_records( 0 ),
+  m_postings_len( 0 ),
+  m_names_len( 0 ),
+  m_directory( NULL ),
+  m_postings( NULL ),
+  m_keys( NULL ),
+  m_offsets( NULL ),
+  m_names( NULL )
+{
+}
+
+mapped_index::~mapped_index()
+{
+    close();
+}
+
+bool mapped_index::open( const char* filename )
+{
+    close();
+
+    int fd = ::open( filename, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return false;
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 ||
+         (size_t)st.st_size < sizeof( index_file_header ) )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    void* base = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( base == MAP_FAILED )
+    {
+        return false;
+    }
+
+    m_base = base;
+    m_len = st.st_size;
+
+    // Only the header and where the sections fall are checked here, so
+    // opening doesn't read the whole file. What is in the sections is
+    // checked as find() and name() read it.
+    const index_file_header& header( *(const index_file_header*)base );
+    const char* bytes = (const char*)base;
+    file_layout l;
+    if ( memcmp( header.magic, "MTFNIDX", sizeof( header.magic ) ) != 0 ||
+         header.version != index_file_version ||
+         header.byte_order != byte_order_mark ||
+         !layout( header, l ) || l.end > m_len )
+    {
+        close();
+        return false;
+    }
+
+    m_records = header.records;
+    m_postings_len = header.postings;
+    m_names_len = header.names_len;
+    m_directory = (const uint64_t*)( bytes + l.directory );
+    m_postings = (const uint32_t*)( bytes + l.postings );
+    m_keys = (const sound_key*)( bytes + l.keys );
+    m_offsets = (const uint64_t*)( bytes + l.offsets );
+    m_names = bytes + l.names;
+
+    return true;
+}
+
+void mapped_index::close( void )
+{
+    if ( m_base != NULL )
+    {
+        munmap( m_base, m_len );
+    }
+
+    m_base = NULL;
+    m_len = 0;
+    m_records = 0;
+    m_postings_len = 0;
+    m_names_len = 0;
+}
+
+void mapped_index::find( string_view name, vector<record_id>& matches ) const
+{
+    encoder enc;
+    enc.encode( name );
+
+    find( enc.key(), matches );
+}
+
+void mapped_index::find( const sound_key& key,
+        vector<record_id>& matches ) const
+{
+    if ( m_base == NULL )
+    {
+        return;
+    }
+
+    const uint32_t *prim_begin, *prim_end, *alt_begin, *alt_end;
+    postings( key.primary, key.primary + 1, prim_begin, prim_end );
+    postings( key.alternate, key.alternate + 1, alt_begin, alt_end );
+
+    find_in_buckets( key, prim_begin, prim_end, alt_begin, alt_end, m_keys,
+        m_records, matches );
+}
+
+void mapped_index::find_prefix( string_view codes,
+        vector<record_id>& matches ) const
+{
+    if ( m_base == NULL )
+    {
+        return;
+    }
+
+    size_t found = matches.size();
+
+    // Each run of codes is one run of postings
+    visit_prefix_runs( codes, [&]( uint32_t first, uint32_t last ) {
+        const uint32_t *begin, *end;
+        postings( first, last, begin, end );
+        for ( const uint32_t* i = begin; i != end; i++ )
+        {
+            if ( *i < m_records )
+            {
+                matches.push_back( *i );
+            }
+        }
+    } );
+
+    sort_new_matches( matches, found );
+}
+
+// The directory entries are only checked here, for the codes looked up. In
+// a damaged file they can point anywhere, and then there are no postings.
+void mapped_index::postings( uint32_t first, uint32_t last,
+        const uint32_t*& begin, const uint32_t*& end ) const
+{
+    uint64_t from = m_directory[first];
+    uint64_t to = m_directory[last];
+    if ( from > to || to > m_postings_len )
+    {
+        from = to = 0;
+    }
+
+    begin = m_postings + from;
+    end = m_postings + to;
+}
@@ -0,0 +1,203 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * class sound_index - finds every name that sounds like another one
+ * without encoding the names again for each search.
+ *
+ * class mapped_index - a sound_index saved to a file, searched straight out
+ * of a read only memory mapping of the file.
+ */
+
+#ifndef __MTFN_INDEX_H__
+#define __MTFN_INDEX_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// Each name is encoded once when it is inserted and posted under the bucket
+// of its primary code and the bucket of its alternate code. A search then
+// looks at no more than two buckets, the ones for the primary and alternate
+// codes of the name searched for, which between them hold every record
+// that sound::operator== would match.
+class sound_index
+{
+public:
+    // Records are numbered from 0 in the order they are inserted, so the
+    // caller can keep whatever goes with a name in a vector of its own.
+    typedef size_t record_id;
+
+    // Records are posted under their first stop_len codes, which is all
+    // that save() keeps. Given a longer key length, or 0 for all of them,
+    // they are also posted under that many codes, which find() by name
+    // uses: on a large index, a bucket of the longer codes holds far fewer
+    // names that only share their first few codes with the one searched
+    // for. Codes past max_key_len are posted under their fingerprints, so
+    // find() checks the names found through those against their codes.
+    // Key lengths from 1 to stop_len are the same as stop_len.
+    sound_index( key_length codes = key_length( stop_len ) );
+
+    // str coded in ASCII or ISO-8859-15, same as sound( const std::string& )
+    record_id insert( std::string_view name );
+
+    // Appends the ids of all the records that sound like the name or the
+    // key to matches, each of them once, in the order they were inserted
+    // within each bucket. A name is encoded to the key length of the
+    // index; a sound_key only has the first stop_len codes.
+    void find( std::string_view name, std::vector<record_id>& matches ) const;
+    void find( const sound_key& key, std::vector<record_id>& matches ) const;
+
+    // Appends the ids of all the records with a primary or alternate code
+    // that starts with codes, such as the primary() of an encoder, each of
+    // them once and in the order they were inserted. Only the first
+    // stop_len codes count, as keys don't have any more.
+    void find_prefix( std::string_view codes,
+        std::vector<record_id>& matches ) const;
+
+    // Number of records in the index
+    size_t size( void ) const { return m_keys.size(); };
+
+    // The name as it was inserted
+    std::string_view name( record_id id ) const
+    {
+        return std::string_view( m_names.data() + m_offsets[id],
+            m_offsets[id + 1] - m_offsets[id] );
+    };
+
+    const sound_key& key( record_id id ) const { return m_keys[id]; };
+
+    // The key length find() by name uses, 0 for all the codes
+    int key_len( void ) const { return m_key_len; };
+
+    // Writes the index in the format read by mapped_index. Returns false
+    // if the file could not be written.
+    bool save( const char* filename ) const;
+
+protected:
+    typedef std::unordered_map<uint16_t, std::vector<record_id> > buckets;
+    typedef std::unordered_map<uint64_t, std::vector<record_id> >
+        long_buckets;
+
+    // All the names one after the other; name i runs from m_offsets[i]
+    // up to m_offsets[i+1].
+    std::string m_names;
+    std::vector<size_t> m_offsets;
+
+    std::vector<sound_key> m_keys;
+    buckets m_buckets;
+
+    // Only kept when long_keys()
+    int m_key_len;
+    std::vector<long_key> m_long_keys;
+    long_buckets m_long_buckets;
+
+    bool long_keys( void ) const
+    { return m_key_len == 0 || m_key_len > stop_len; };
+private:
+};
+
+// The file written by sound_index::save(). All numbers are in the byte
+// order of the machine that wrote the file, and every section starts on an
+// 8 byte boundary:
+//
+//   index_file_header
+//   uint64_t  directory[65537]   postings for the code c are the ones from
+//                                directory[c] up to directory[c+1]
+//   uint32_t  postings[postings] record ids, in insertion order per code
+//   sound_key keys[records]
+//   uint64_t  offsets[records+1] name i runs from offsets[i] to offsets[i+1]
+//   char      names[names_len]
+const uint32_t index_file_version = 1;
+
+struct index_file_header
+{
+    char magic[8];          // "MTFNIDX"
+    uint32_t version;       // index_file_version
+    uint32_t byte_order;    // 0x01020304, as written by the saving machine
+    uint64_t records;
+    uint64_t postings;
+    uint64_t names_len;
+};
+
+// Searches an index file without reading it in. The file is mapped read
+// only and shared, so every process searching the same file uses the same
+// copy of it in the page cache. open() only checks the header and that the
+// sections it describes fit in the file, so it takes the same time for any
+// size of index. The directory entries, postings and offsets are checked
+// as find() and name() use them: postings that aren't records are skipped,
+// and a name that runs out of the file is empty.
+class mapped_index
+{
+public:
+    typedef sound_index::record_id record_id;
+
+    mapped_index( void );
+    ~mapped_index();
+
+    // Returns false if the file can't be mapped, or it was not written by
+    // a compatible sound_index::save().
+    bool open( const char* filename );
+    void close( void );
+
+    // Same as sound_index::find()
+    void find( std::string_view name, std::vector<record_id>& matches ) const;
+    void find( const sound_key& key, std::vector<record_id>& matches ) const;
+    void find_prefix( std::string_view codes,
+        std::vector<record_id>& matches ) const;
+
+    size_t size( void ) const { return m_records; };
+
+    std::string_view name( record_id id ) const
+    {
+        if ( id >= m_records || m_offsets[id] > m_offsets[id + 1] ||
+             m_offsets[id + 1] > m_names_len )
+        {
+            return std::string_view();
+        }
+        return std::string_view( m_names + m_offsets[id],
+            m_offsets[id + 1] - m_offsets[id] );
+    };
+
+    const sound_key& key( record_id id ) const { return m_keys[id]; };
+
+private:
+    mapped_index( const mapped_index& );
+    const mapped_index& operator =( const mapped_index& );
+
+    // Sets begin and end to the postings for the codes from first up to
+    // last, or to an empty run if the directory doesn't hold together there
+    void postings( uint32_t first, uint32_t last,
+        const uint32_t*& begin, const uint32_t*& end ) const;
+
+    void* m_base;
+    size_t m_len;
+
+    size_t m_records;
+    size_t m_postings_len;
+    size_t m_names_len;
+    const uint64_t* m_directory;
+    const uint32_t* m_postings;
+    const sound_key* m_keys;
+    const uint64_t* m_offsets;
+    const char* m_names;
+};
+
+}; // namespace mtfn
+
+#endif
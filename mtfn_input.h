@@ -0,0 +1,98 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * input_file - a file of names to read through, mapped read only, or read
+ * in whole if it can't be mapped.
+ */
+
+#ifndef __MTFN_INPUT_H__
+#define __MTFN_INPUT_H__
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mtfn
+{
+
+class input_file
+{
+public:
+    input_file( void ) : m_base( NULL ), m_len( 0 ), m_mapped( false ) {};
+    ~input_file()
+    {
+        if ( m_mapped )
+        {
+            munmap( (void*)m_base, m_len );
+        }
+    };
+
+    bool open( const char* filename )
+    {
+        int fd = ::open( filename, O_RDONLY );
+        if ( fd < 0 )
+        {
+            return false;
+        }
+
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) )
+        {
+            m_len = st.st_size;
+            if ( m_len == 0 )
+            {
+                ::close( fd );
+                return true;
+            }
+
+            void* base = mmap( NULL, m_len, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if ( base != MAP_FAILED )
+            {
+                madvise( base, m_len, MADV_SEQUENTIAL );
+                m_base = (const char*)base;
+                m_mapped = true;
+                ::close( fd );
+                return true;
+            }
+        }
+        ::close( fd );
+
+        // Pipes and the like
+        std::ifstream istrm( filename, std::ios::binary );
+        std::ostringstream ostrm;
+        ostrm << istrm.rdbuf();
+        m_copy = ostrm.str();
+        m_base = m_copy.data();
+        m_len = m_copy.size();
+
+        return !istrm.bad();
+    };
+
+    const char* begin( void ) const { return m_base; };
+    const char* end( void ) const { return m_base + m_len; };
+
+private:
+    const char* m_base;
+    size_t m_len;
+    bool m_mapped;
+    std::string m_copy;
+};
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,459 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+#include "mtfn_join.h"
+#include "mtfn_parallel.h"
+
+using namespace std;
+using namespace mtfn;
+
+// A record of one list under one of its codes
+struct posting
+{
+    size_t id;
+    sound_key key;
+    uint16_t code;
+};
+
+static size_t partition_of( uint16_t code, int bits )
+{
+    return bits == 0 ? 0 : ( code * 0x9E3779B1u ) >> ( 32 - bits );
+}
+
+// Calls fn( posting ) for the one or two codes of each key
+template <typename FN>
+static void post( const sound_key& key, size_t id, FN fn )
+{
+    fn( posting{ id, key, key.primary } );
+    if ( key.alternate != key.primary )
+    {
+        fn( posting{ id, key, key.alternate } );
+    }
+}
+
+// The postings of one partition, sorted by code, found through an open
+// addressed table of the codes in it
+class partition_table
+{
+public:
+    void build( vector<posting>& postings )
+    {
+        m_postings.swap( postings );
+        sort( m_postings.begin(), m_postings.end(),
+            []( const posting& a, const posting& b ) {
+                return a.code < b.code; } );
+
+        size_t codes = 0;
+        for ( size_t i = 0; i < m_postings.size(); i++ )
+        {
+            codes += i == 0 || m_postings[i].code != m_postings[i - 1].code;
+        }
+
+        size_t slots = 2;
+        while ( slots < 2 * codes )
+        {
+            slots *= 2;
+        }
+        m_slots.assign( slots, slot{ 0, 0, 0 } );
+        m_mask = slots - 1;
+
+        for ( size_t begin = 0, end; begin < m_postings.size(); begin = end )
+        {
+            uint16_t code = m_postings[begin].code;
+            for ( end = begin + 1;
+                  end < m_postings.size() && m_postings[end].code == code;
+                  end++ )
+            {
+            }
+
+            size_t s = hash( code );
+            while ( m_slots[s].begin != m_slots[s].end )
+            {
+                s = ( s + 1 ) & m_mask;
+            }
+            m_slots[s] = slot{ begin, end, code };
+        }
+    };
+
+    // The postings for code, empty if there are none
+    pair<const posting*, const posting*> find( uint16_t code ) const
+    {
+        for ( size_t s = hash( code ); m_slots[s].begin != m_slots[s].end;
+              s = ( s + 1 ) & m_mask )
+        {
+            if ( m_slots[s].code == code )
+            {
+                return make_pair( m_postings.data() + m_slots[s].begin,
+                    m_postings.data() + m_slots[s].end );
+            }
+        }
+        return make_pair( (const posting*)NULL, (const posting*)NULL );
+    };
+
+private:
+    // Slots with no postings are empty
+    struct slot
+    {
+        size_t begin;
+        size_t end;
+        uint16_t code;
+    };
+
+    size_t hash( uint16_t code ) const
+    {
+        return ( ( code * 0x85EBCA6Bu ) >> 13 ) & m_mask;
+    };
+
+    vector<posting> m_postings;
+    vector<slot> m_slots;
+    size_t m_mask;
+};
+
+// Probes the tables with one code of a record of the larger list
+static void probe( const partition_table& table, const posting& p,
+    bool swapped, vector<join_pair>& out )
+{
+    pair<const posting*, const posting*> found = table.find( p.code );
+    for ( const posting* b = found.first; b != found.second; b++ )
+    {
+        if ( first_shared( b->key, p.key ) == p.code )
+        {
+            out.push_back( swapped ? join_pair{ p.id, b->id }
+                                   : join_pair{ b->id, p.id } );
+        }
+    }
+}
+
+static void gather( vector<vector<join_pair> >& found,
+    vector<join_pair>& pairs )
+{
+    for ( vector<join_pair>& f : found )
+    {
+        pairs.insert( pairs.end(), f.begin(), f.end() );
+        f.clear();
+    }
+}
+
+// Both lists in memory: every partition's table is built, then the
+// threads each probe their share of the larger list
+static void join_in_memory( const vector<sound_key>& build,
+    const vector<sound_key>& probe_keys, bool swapped, int threads,
+    int bits, vector<join_pair>& pairs )
+{
+    size_t partitions = (size_t)1 << bits;
+    vector<vector<posting> > postings( partitions );
+    for ( size_t i = 0; i < build.size(); i++ )
+    {
+        post( build[i], i, [&]( const posting& p ) {
+            postings[partition_of( p.code, bits )].push_back( p ); } );
+    }
+
+    vector<partition_table> tables( partitions );
+    parallel_for( threads, partitions,
+        [&]( int, size_t begin, size_t end ) {
+            for ( size_t p = begin; p < end; p++ )
+            {
+                tables[p].build( postings[p] );
+            }
+        } );
+
+    vector<vector<join_pair> > found( threads );
+    parallel_for( threads, probe_keys.size(),
+        [&]( int t, size_t begin, size_t end ) {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                post( probe_keys[i], i, [&]( const posting& p ) {
+                    probe( tables[partition_of( p.code, bits )], p, swapped,
+                        found[t] ); } );
+            }
+        } );
+
+    gather( found, pairs );
+}
+
+// Closes the files of a spilled join however it ends
+class spill_files
+{
+public:
+    spill_files( size_t count ) : m_files( count, (FILE*)NULL ) {};
+    ~spill_files()
+    {
+        for ( FILE* f : m_files )
+        {
+            if ( f != NULL )
+            {
+                fclose( f );
+            }
+        }
+    };
+
+    bool open( void )
+    {
+        for ( FILE*& f : m_files )
+        {
+            if ( ( f = tmpfile() ) == NULL )
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    FILE* operator []( size_t i ) const { return m_files[i]; };
+    size_t size( void ) const { return m_files.size(); };
+
+private:
+    vector<FILE*> m_files;
+};
+
+// Writes the postings of the partitions from first on that there are files
+// for, and leaves out the rest
+static bool spill( const vector<sound_key>& keys, int bits, size_t first,
+    const spill_files& files )
+{
+    bool worked = true;
+    for ( size_t i = 0; i < keys.size(); i++ )
+    {
+        post( keys[i], i, [&]( const posting& p ) {
+            size_t part = partition_of( p.code, bits ) - first;
+            worked = worked && ( part >= files.size() ||
+                fwrite( &p, sizeof( p ), 1, files[part] ) == 1 ); } );
+    }
+    return worked;
+}
+
+// How many partitions can be spilled at once, at two files each, leaving
+// some files for whatever else the program has open
+static size_t spill_group( size_t partitions )
+{
+    const rlim_t spare = 64;
+    struct rlimit limit;
+
+    if ( getrlimit( RLIMIT_NOFILE, &limit ) != 0 ||
+         limit.rlim_cur == RLIM_INFINITY )
+    {
+        return partitions;
+    }
+
+    size_t group = limit.rlim_cur > spare + 2 ?
+        ( limit.rlim_cur - spare ) / 2 : 1;
+    return min( group, partitions );
+}
+
+// The most postings of the larger list read back at once
+const size_t probe_chunk_len = (size_t)1 << 14;
+
+static bool read_back( FILE* f, vector<posting>& postings )
+{
+    if ( fflush( f ) != 0 || fseek( f, 0, SEEK_END ) != 0 )
+    {
+        return false;
+    }
+    long len = ftell( f );
+    rewind( f );
+
+    postings.resize( len / sizeof( posting ) );
+    return fread( postings.data(), sizeof( posting ), postings.size(), f ) ==
+        postings.size();
+}
+
+// Reads the postings of f back chunk at a time into postings, calling fn()
+// after each read
+template <typename FN>
+static bool read_chunks( FILE* f, size_t chunk, vector<posting>& postings,
+    FN fn )
+{
+    if ( fflush( f ) != 0 || fseek( f, 0, SEEK_SET ) != 0 )
+    {
+        return false;
+    }
+
+    for ( ;; )
+    {
+        postings.resize( chunk );
+        postings.resize( fread( postings.data(), sizeof( posting ), chunk,
+            f ) );
+        if ( postings.empty() )
+        {
+            return !ferror( f );
+        }
+        fn();
+    }
+}
+
+// More postings than fit: both lists go into a file per partition, and
+// each partition is joined on its own. Its table is read back whole and
+// its probes chunk postings at a time, each chunk split between the
+// threads. When there can't be that many files open at once, the lists
+// are spilled a group of partitions at a time. errno is kept in file_errno,
+// before closing the files can change it.
+static bool join_spilled( const vector<sound_key>& build,
+    const vector<sound_key>& probe_keys, bool swapped, int threads,
+    int bits, size_t chunk, vector<join_pair>& pairs, int& file_errno )
+{
+    size_t partitions = (size_t)1 << bits;
+    size_t group = spill_group( partitions );
+    vector<posting> postings;
+    vector<vector<join_pair> > found( threads );
+
+    for ( size_t first = 0; first < partitions; first += group )
+    {
+        spill_files build_files( min( group, partitions - first ) );
+        spill_files probe_files( build_files.size() );
+        if ( !build_files.open() || !probe_files.open() ||
+             !spill( build, bits, first, build_files ) ||
+             !spill( probe_keys, bits, first, probe_files ) )
+        {
+            file_errno = errno;
+            return false;
+        }
+
+        for ( size_t part = 0; part < build_files.size(); part++ )
+        {
+            partition_table table;
+            if ( !read_back( build_files[part], postings ) )
+            {
+                file_errno = errno;
+                return false;
+            }
+            table.build( postings );
+
+            if ( !read_chunks( probe_files[part], chunk, postings, [&] {
+                     parallel_for( threads, postings.size(),
+                         [&]( int t, size_t begin, size_t end ) {
+                             for ( size_t i = begin; i < end; i++ )
+                             {
+                                 probe( table, postings[i], swapped,
+                                     found[t] );
+                             }
+                         } );
+                     gather( found, pairs );
+                 } ) )
+            {
+                file_errno = errno;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool mtfn::join_keys( const vector<sound_key>& lhs,
+    const vector<sound_key>& rhs, int threads, vector<join_pair>& pairs,
+    join_stats& stats, size_t memory_limit )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    threads = thread_count( threads );
+    bool swapped = rhs.size() < lhs.size();
+    const vector<sound_key>& build( swapped ? rhs : lhs );
+    const vector<sound_key>& probe_keys( swapped ? lhs : rhs );
+
+    size_t build_postings = 0, probe_postings = 0;
+    for ( const sound_key& key : build )
+    {
+        build_postings += 1 + ( key.alternate != key.primary );
+    }
+    for ( const sound_key& key : probe_keys )
+    {
+        probe_postings += 1 + ( key.alternate != key.primary );
+    }
+    size_t bytes = build_postings * sizeof( posting );
+
+    // Spilled, the probes are read back a chunk at a time, as much as a
+    // quarter of the memory holds up to probe_chunk_len
+    size_t chunk = min( max( memory_limit / 4 / sizeof( posting ),
+        (size_t)1 ), probe_chunk_len );
+
+    // In memory, enough partitions for the threads to build; spilled,
+    // enough that each partition's table and chunk of probes fit with room
+    // to spare. There are only 65536 codes to go round.
+    int bits = 0;
+    while ( ( (size_t)1 << bits ) < (size_t)threads * 4 && bits < 16 )
+    {
+        bits++;
+    }
+    stats.spilled = bytes > memory_limit;
+    while ( stats.spilled && bits < 16 &&
+            ( bytes >> bits ) + min( probe_postings >> bits, chunk ) *
+                sizeof( posting ) > memory_limit / 2 )
+    {
+        bits++;
+    }
+
+    size_t first = pairs.size();
+    bool worked = true;
+    stats.file_errno = 0;
+    if ( stats.spilled )
+    {
+        worked = join_spilled( build, probe_keys, swapped, threads, bits,
+            chunk, pairs, stats.file_errno );
+    }
+    else
+    {
+        join_in_memory( build, probe_keys, swapped, threads, bits, pairs );
+    }
+
+    stats.build = build.size();
+    stats.probe = probe_keys.size();
+    stats.pairs = pairs.size() - first;
+    stats.partitions = (size_t)1 << bits;
+    stats.threads = threads;
+    stats.seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start ).count();
+
+    return worked;
+}
+
+bool mtfn::join_names( const vector<string_view>& lhs,
+    const vector<string_view>& rhs, int threads, vector<join_pair>& pairs,
+    join_stats& stats, size_t memory_limit )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    threads = thread_count( threads );
+    vector<sound_key> lhs_keys( lhs.size() ), rhs_keys( rhs.size() );
+    parallel_for( threads, lhs.size() + rhs.size(),
+        [&]( int, size_t begin, size_t end ) {
+            encoder enc;
+            for ( size_t i = begin; i < end; i++ )
+            {
+                if ( i < lhs.size() )
+                {
+                    enc.encode( lhs[i] );
+                    lhs_keys[i] = enc.key();
+                }
+                else
+                {
+                    enc.encode( rhs[i - lhs.size()] );
+                    rhs_keys[i - lhs.size()] = enc.key();
+                }
+            }
+        } );
+
+    bool worked = join_keys( lhs_keys, rhs_keys, threads, pairs, stats,
+        memory_limit );
+
+    stats.seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start ).count();
+
+    return worked;
+}
@@ -0,0 +1,96 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * join_keys() - every pair of records from two lists that sound alike,
+ * without comparing every record of one with every record of the other.
+ */
+
+#ifndef __MTFN_JOIN_H__
+#define __MTFN_JOIN_H__
+
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// Indexes into the two lists joined
+struct join_pair
+{
+    size_t lhs;
+    size_t rhs;
+
+    bool operator ==( const join_pair& other ) const
+    { return lhs == other.lhs && rhs == other.rhs; };
+
+    bool operator <( const join_pair& other ) const
+    { return lhs < other.lhs || ( lhs == other.lhs && rhs < other.rhs ); };
+};
+
+// The least code two keys share, or 0x10000 if they share none. A pair
+// found under more than one code is only taken under this one.
+inline uint32_t first_shared( const sound_key& a, const sound_key& b )
+{
+    uint32_t first = 0x10000;
+    if ( a.primary == b.primary || a.primary == b.alternate )
+    {
+        first = a.primary;
+    }
+    if ( ( a.alternate == b.primary || a.alternate == b.alternate ) &&
+         a.alternate < first )
+    {
+        first = a.alternate;
+    }
+    return first;
+}
+
+struct join_stats
+{
+    size_t build;           // records in the smaller list
+    size_t probe;           // records in the larger list
+    size_t pairs;
+    size_t partitions;
+    bool spilled;           // true if the partitions went through files
+    int file_errno;         // errno when a temporary file failed, or 0
+    double seconds;
+    int threads;
+};
+
+// Appends a join_pair to pairs for every lhs[i] == rhs[j], once each, in
+// no particular order. The smaller list is posted by its primary and
+// alternate codes into hash tables, partitioned by code, and the larger
+// list is probed against them by threads threads (one per core if 0). A
+// pair that shares more than one code is only taken under the least of
+// them. If the tables would take more than memory_limit bytes, both lists
+// are partitioned into temporary files instead and joined a partition at
+// a time, as many partitions to a pass over the lists as there are files
+// left to open. Each partition's table is read back whole and its probes
+// a chunk at a time, and there are enough partitions for both to fit in
+// memory_limit together. Returns false, with the errno in stats.file_errno, if the
+// temporary files can't be made, written or read.
+bool join_keys( const std::vector<sound_key>& lhs,
+    const std::vector<sound_key>& rhs, int threads,
+    std::vector<join_pair>& pairs, join_stats& stats,
+    size_t memory_limit = (size_t)1 << 30 );
+
+// The same for names, str coded as for encoder, encoded on the threads
+bool join_names( const std::vector<std::string_view>& lhs,
+    const std::vector<std::string_view>& rhs, int threads,
+    std::vector<join_pair>& pairs, join_stats& stats,
+    size_t memory_limit = (size_t)1 << 30 );
+
+}; // namespace mtfn
+
+#endif
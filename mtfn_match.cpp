@@ -0,0 +1,72 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "mtfn_match.h"
+#include "mtfn_normalize.h"
+
+using namespace std;
+using namespace mtfn;
+
+// As sound::same(), for codes that aren't in a sound
+static bool same( uint64_t lhs, string_view lhs_codes,
+    uint64_t rhs, string_view rhs_codes )
+{
+    return lhs == rhs && ( !is_fingerprint( lhs ) || lhs_codes == rhs_codes );
+}
+
+matcher::matcher( const sound& needle )
+: m_needle( needle ),
+  m_target( m_needle.primary() ),
+  m_target_alt( m_needle.has_alternate() ? m_needle.alternate()
+                                         : m_needle.primary() ),
+  m_rules( key_length( needle.key_len() ) )
+{
+}
+
+bool matcher::matches( string_view candidate )
+{
+    // Room for the name and its codes, as in encoder::reserve()
+    size_t len = candidate.size();
+    if ( m_buf.size() < 5 * len + 2 * stop_len )
+    {
+        m_buf.resize( 5 * len + 2 * stop_len );
+    }
+
+    char* name = m_buf.data();
+    char* primary = name + len;
+    char* alternate = primary + 2 * len + stop_len;
+
+    if ( !m_rules.run_while( name,
+            normalize_name( candidate.data(), len, name ),
+            primary, alternate, m_target, m_target_alt ) )
+    {
+        return false;
+    }
+
+    const sound& n( m_needle );
+    const rules& r( m_rules );
+
+    return same( n.primary_code(), n.primary(),
+                 r.primary_code(), r.primary() ) ||
+           ( r.has_alternate() &&
+             same( n.primary_code(), n.primary(),
+                   r.alternate_code(), r.alternate() ) ) ||
+           ( n.has_alternate() && r.has_alternate() &&
+             same( n.alternate_code(), n.alternate(),
+                   r.alternate_code(), r.alternate() ) ) ||
+           ( n.has_alternate() &&
+             same( n.alternate_code(), n.alternate(),
+                   r.primary_code(), r.primary() ) );
+}
@@ -0,0 +1,57 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * matcher - compares one sound against many names, giving up on each name
+ * as soon as its first codes rule it out.
+ */
+
+#ifndef __MTFN_MATCH_H__
+#define __MTFN_MATCH_H__
+
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// Gives the same answer as needle == sound( candidate ), but only runs the
+// rules over the candidate while the codes they have made so far are the
+// start of one of the needle's codes. Most candidates in a scan don't match
+// and are ruled out after a code or two. Like an encoder, a matcher keeps
+// its buffers between names, so give each thread its own.
+class matcher
+{
+public:
+    matcher( const sound& needle );
+
+    // candidate coded in ASCII or ISO-8859-15, same as the sound constructors
+    bool matches( std::string_view candidate );
+
+    const sound& needle( void ) const { return m_needle; };
+
+private:
+    matcher( const matcher& );
+    matcher& operator=( const matcher& );
+
+    sound m_needle;
+    std::string_view m_target;
+    std::string_view m_target_alt;
+    rules m_rules;
+    std::vector<char> m_buf;
+};
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,264 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include "mtfn_metrics.h"
+
+using namespace std;
+using namespace mtfn;
+
+std::atomic<bool> mtfn::metrics_on( false );
+thread_local bool mtfn::metrics_nested = false;
+
+void histogram::add_bucket( int bucket, uint64_t count, uint64_t largest )
+{
+    if ( count > 0 )
+    {
+        m_counts[bucket] += count;
+        m_total += count;
+        m_max = std::max( m_max, std::min( largest, bucket_top( bucket ) ) );
+    }
+}
+
+void histogram::add( const histogram& other )
+{
+    for ( int b = 0; b < buckets; b++ )
+    {
+        m_counts[b] += other.m_counts[b];
+    }
+    m_total += other.m_total;
+    m_max = std::max( m_max, other.m_max );
+}
+
+void histogram::clear( void )
+{
+    fill( m_counts.begin(), m_counts.end(), 0 );
+    m_total = 0;
+    m_max = 0;
+}
+
+uint64_t histogram::percentile( double p ) const
+{
+    uint64_t rank = (uint64_t)( p * m_total ), seen = 0;
+    for ( int b = 0; b < buckets && m_total > 0; b++ )
+    {
+        seen += m_counts[b];
+        if ( seen > rank || seen == m_total )
+        {
+            return std::min( m_max, bucket_top( b ) );
+        }
+    }
+    return 0;
+}
+
+uint64_t histogram::bucket_top( int bucket )
+{
+    if ( bucket < 16 )
+    {
+        return bucket;
+    }
+    int top = ( bucket - 16 ) / 8 + 4;
+    uint64_t sub = ( bucket - 16 ) % 8;
+    return ( ( 9 + sub ) << ( top - 3 ) ) - 1;
+}
+
+// One thread's counts. Only the thread itself adds to them, so a load and
+// a store are enough, but they are atomic so they can be read while it
+// runs.
+struct thread_call
+{
+    atomic<uint64_t> calls;
+    atomic<uint64_t> flagged;
+    atomic<uint64_t> longest;
+    atomic<uint64_t> slowest;
+    atomic<uint64_t> lengths[histogram::buckets];
+    atomic<uint64_t> latency[histogram::buckets];
+};
+
+struct thread_metrics
+{
+    thread_call calls[metric_calls];
+};
+
+static void bump( atomic<uint64_t>& count, uint64_t by = 1 )
+{
+    count.store( count.load( memory_order_relaxed ) + by,
+        memory_order_relaxed );
+}
+
+static void raise( atomic<uint64_t>& count, uint64_t to )
+{
+    if ( count.load( memory_order_relaxed ) < to )
+    {
+        count.store( to, memory_order_relaxed );
+    }
+}
+
+// Every running thread's counts, and the totals of the threads that have
+// finished. Never freed, so that threads can still finish while the
+// program exits.
+struct metrics_registry
+{
+    mutex lock;
+    vector<thread_metrics*> running;
+    metrics_snapshot finished;
+};
+
+static metrics_registry& all_metrics( void )
+{
+    static metrics_registry* r = new metrics_registry();
+    return *r;
+}
+
+static void add( metrics_snapshot& to, const thread_metrics& from )
+{
+    for ( int c = 0; c < metric_calls; c++ )
+    {
+        const thread_call& f( from.calls[c] );
+        call_metrics& t( to.calls[c] );
+
+        t.calls += f.calls.load( memory_order_relaxed );
+        t.flagged += f.flagged.load( memory_order_relaxed );
+        for ( int b = 0; b < histogram::buckets; b++ )
+        {
+            t.lengths.add_bucket( b, f.lengths[b].load( memory_order_relaxed ),
+                f.longest.load( memory_order_relaxed ) );
+            t.latency.add_bucket( b, f.latency[b].load( memory_order_relaxed ),
+                f.slowest.load( memory_order_relaxed ) );
+        }
+    }
+}
+
+static void clear( metrics_snapshot& snapshot )
+{
+    for ( call_metrics& c : snapshot.calls )
+    {
+        c.calls = 0;
+        c.flagged = 0;
+        c.lengths.clear();
+        c.latency.clear();
+    }
+}
+
+class thread_calls
+{
+public:
+    thread_calls( void ) : m_metrics( new thread_metrics() )
+    {
+        metrics_registry& r( all_metrics() );
+        lock_guard<mutex> hold( r.lock );
+        r.running.push_back( m_metrics );
+    };
+
+    ~thread_calls()
+    {
+        metrics_registry& r( all_metrics() );
+        lock_guard<mutex> hold( r.lock );
+        add( r.finished, *m_metrics );
+        r.running.erase( find( r.running.begin(), r.running.end(),
+            m_metrics ) );
+        delete m_metrics;
+    };
+
+    thread_metrics& get( void ) { return *m_metrics; };
+
+private:
+    thread_metrics* m_metrics;
+};
+
+uint64_t mtfn::metrics_now( void )
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void mtfn::count_call( metric_call call, uint64_t start, size_t len,
+    bool flagged )
+{
+    uint64_t ns = metrics_now() - start;
+    static thread_local thread_calls mine;
+    thread_call& c( mine.get().calls[call] );
+
+    bump( c.calls );
+    bump( c.flagged, flagged );
+    bump( c.latency[histogram::bucket( ns )] );
+    raise( c.slowest, ns );
+    if ( call == metric_encode )
+    {
+        bump( c.lengths[histogram::bucket( len )] );
+        raise( c.longest, len );
+    }
+}
+
+void mtfn::enable_metrics( bool on )
+{
+    metrics_on.store( on );
+}
+
+bool mtfn::metrics_enabled( void )
+{
+    return metrics_on.load();
+}
+
+void mtfn::snapshot_metrics( metrics_snapshot& snapshot )
+{
+    metrics_registry& r( all_metrics() );
+    lock_guard<mutex> hold( r.lock );
+
+    clear( snapshot );
+    for ( int c = 0; c < metric_calls; c++ )
+    {
+        snapshot.calls[c].calls = r.finished.calls[c].calls;
+        snapshot.calls[c].flagged = r.finished.calls[c].flagged;
+        snapshot.calls[c].lengths.add( r.finished.calls[c].lengths );
+        snapshot.calls[c].latency.add( r.finished.calls[c].latency );
+    }
+    for ( thread_metrics* m : r.running )
+    {
+        add( snapshot, *m );
+    }
+}
+
+void mtfn::reset_metrics( void )
+{
+    metrics_registry& r( all_metrics() );
+    lock_guard<mutex> hold( r.lock );
+
+    clear( r.finished );
+    for ( thread_metrics* m : r.running )
+    {
+        for ( thread_call& c : m->calls )
+        {
+            c.calls.store( 0, memory_order_relaxed );
+            c.flagged.store( 0, memory_order_relaxed );
+            c.longest.store( 0, memory_order_relaxed );
+            c.slowest.store( 0, memory_order_relaxed );
+            for ( int b = 0; b < histogram::buckets; b++ )
+            {
+                c.lengths[b].store( 0, memory_order_relaxed );
+                c.latency[b].store( 0, memory_order_relaxed );
+            }
+        }
+    }
+}
+
+const char* mtfn::metric_name( metric_call call )
+{
+    static const char* names[metric_calls] =
+        { "encode", "compare", "sounds_like" };
+    return names[call];
+}
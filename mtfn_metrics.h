@@ -0,0 +1,109 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * snapshot_metrics() - how many sounds have been made and compared, how
+ * long the names were and how long it took, once enable_metrics() is on.
+ *
+ * class histogram - counts of values to within an eighth, for latencies
+ * and lengths.
+ */
+
+#ifndef __MTFN_METRICS_H__
+#define __MTFN_METRICS_H__
+
+#include <cstdint>
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// Small values are counted exactly, and larger ones in 8 buckets for every
+// power of 2, so percentiles are within 12.5% of the true value whatever
+// the range, in a few KB.
+class histogram
+{
+public:
+    static const int buckets = 496;
+
+    histogram( void ) : m_counts( buckets, 0 ), m_total( 0 ), m_max( 0 ) {};
+
+    void add( uint64_t value )
+    {
+        m_counts[bucket( value )]++;
+        m_total++;
+        m_max = value > m_max ? value : m_max;
+    };
+
+    // Adds count values from one bucket, the largest of them largest
+    void add_bucket( int bucket, uint64_t count, uint64_t largest );
+    void add( const histogram& other );
+    void clear( void );
+
+    uint64_t count( void ) const { return m_total; };
+    uint64_t max( void ) const { return m_max; };
+    uint64_t bucket_count( int bucket ) const { return m_counts[bucket]; };
+
+    // The largest value in the bucket the fraction p of the values are
+    // below, or 0 if there are none
+    uint64_t percentile( double p ) const;
+
+    static int bucket( uint64_t value )
+    {
+        if ( value < 16 )
+        {
+            return value;
+        }
+        int top = 63 - __builtin_clzll( value );
+        return 16 + ( top - 4 ) * 8 + ( ( value >> ( top - 3 ) ) & 7 );
+    };
+
+    // The largest value that goes in a bucket
+    static uint64_t bucket_top( int bucket );
+
+private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_max;
+};
+
+struct call_metrics
+{
+    uint64_t calls;
+    uint64_t flagged;       // encodes with an alternate, compares that matched
+    histogram lengths;      // of the names encoded
+    histogram latency;      // ns
+};
+
+struct metrics_snapshot
+{
+    call_metrics calls[metric_calls];
+};
+
+// Metrics are off to start with, when each call only checks that they are.
+// On, each call reads the clock twice and adds to counts of its thread's.
+void enable_metrics( bool on = true );
+bool metrics_enabled( void );
+
+// The counts of every thread since the last reset. Calls still going on
+// in other threads may or may not be in them, or survive a reset.
+void snapshot_metrics( metrics_snapshot& snapshot );
+void reset_metrics( void );
+
+// "encode", "compare" or "sounds_like"
+const char* metric_name( metric_call call );
+
+}; // namespace mtfn
+
+#endif
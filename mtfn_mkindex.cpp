@@ -0,0 +1,42 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include "mtfn.h"
+#include "mtfn_index.h"
+
+using namespace std;
+using namespace mtfn;
+
+#define error cerr << __FILE__ << ':' << __LINE__ << ' '
+
+// Builds an index file for mapped_index from a file with one name per line
+int main ( int argc, char** argv )
+{
+    if ( argc < 3 )
+    {
+        error << "USAGE: mtfn_mkindex <names> <index>" << endl;
+        return 1;
+    }
+
+    ifstream istrm( argv[1] );
+    if ( !istrm )
+    {
+        error << "can't read " << argv[1] << endl;
+        return 1;
+    }
+
+    sound_index index;
+    string s;
+    while ( getline( istrm, s ) )
+    {
+        index.insert( s );
+    }
+
+    if ( !index.save( argv[2] ) )
+    {
+        error << "can't write " << argv[2] << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,209 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <algorithm>
+#include "mtfn_name.h"
+#include "mtfn_normalize.h"
+
+using namespace std;
+using namespace mtfn;
+
+// As sound::same(), for codes that aren't in a sound
+static bool same( uint64_t lhs, string_view lhs_codes,
+    uint64_t rhs, string_view rhs_codes )
+{
+    return lhs == rhs && ( !is_fingerprint( lhs ) || lhs_codes == rhs_codes );
+}
+
+name_sound::name_sound( string_view str, bool limit_length )
+: m_composite( 0 ),
+  m_composite_len( 0 ),
+  m_composite_code( 0 ),
+  m_length_limited( limit_length )
+{
+    split( str, false );
+    encode( str.size() );
+}
+
+name_sound::name_sound( string_view str, utf8_t, bool limit_length )
+: m_composite( 0 ),
+  m_composite_len( 0 ),
+  m_composite_code( 0 ),
+  m_length_limited( limit_length )
+{
+    split( str, true );
+    encode( str.size() );
+}
+
+// Normalizes each token into the start of m_buf, one after the other, and
+// sizes m_buf for the codes that encode() puts after them. No token gets
+// longer, so the tokens never need more room than str.
+void name_sound::split( string_view str, bool is_utf8 )
+{
+    size_t tokens = 1;
+    for ( char c : str )
+    {
+        tokens += ( c == ' ' || c == '-' );
+    }
+    m_tokens.reserve( tokens );
+    m_keys.reserve( tokens );
+
+    // The codes of a token take up no more than twice its length, or
+    // stop_len, and the composite as much as the primaries and the spaces
+    size_t room = 2 * str.size() + stop_len * tokens;
+    m_buf.resize( str.size() + 3 * room + tokens );
+
+    size_t n = 0;
+    for ( size_t begin = 0; begin <= str.size(); )
+    {
+        size_t end = str.find_first_of( separators, begin );
+        if ( end == string_view::npos )
+        {
+            end = str.size();
+        }
+
+        const char* piece = str.data() + begin;
+        size_t len = is_utf8
+            ? rules::normalize_utf8( piece, end - begin, &m_buf[n] )
+            : normalize_name( piece, end - begin, &m_buf[n] );
+        if ( len > 0 )
+        {
+            m_tokens.push_back( token_codes{ (uint32_t)n, (uint32_t)len } );
+            n += len;
+        }
+
+        begin = end + 1;
+    }
+}
+
+// Packs the composite 4 bits a character like rules::pack(), but with the
+// spaces as 0xF, which no code packs to, so a token without codes still
+// counts: "H Smith" is " SM0", which packs apart from "SM0". Up to
+// packed_len - 1 characters that is exact and leaves the top nibble 0, so
+// only longer composites need to be fingerprints.
+static uint64_t pack_composite( const char* composite, size_t len )
+{
+    if ( len >= (size_t)packed_len )
+    {
+        return rules::fingerprint( composite, len );
+    }
+
+    uint64_t packed = 0;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        packed <<= 4;
+        packed += composite[i] == ' ' ? 0xF : rules::pack( &composite[i], 1 );
+    }
+
+    return packed;
+}
+
+// Runs the rules over each token, keeping the codes of all of them back
+// to back, so the primaries together are the composite
+void name_sound::encode( size_t len )
+{
+    size_t room = ( m_buf.size() - len ) / 3;
+    size_t prim = len, alt = len + room;
+    char* composite = &m_buf[len + 2 * room];
+    char* out = composite;
+
+    rules r( m_length_limited );
+    for ( token_codes& t : m_tokens )
+    {
+        r.run( &m_buf[t.name], t.name_len, &m_buf[prim], &m_buf[alt] );
+
+        t.prim = prim;
+        t.prim_len = r.primary().size();
+        t.alt = alt;
+        t.alt_len = r.alternate().size();
+        t.prim_code = r.primary_code();
+        t.alt_code = r.alternate_code();
+        t.has_alternate = r.has_alternate();
+        m_keys.push_back( r.key() );
+
+        prim += t.prim_len;
+        alt += t.alt_len;
+
+        if ( &t != m_tokens.data() )
+        {
+            *out++ = ' ';
+        }
+        out = copy( r.primary().begin(), r.primary().end(), out );
+    }
+
+    m_composite = composite - m_buf.data();
+    m_composite_len = out - composite;
+    m_composite_code = pack_composite( composite, m_composite_len );
+}
+
+bool name_sound::token_matches( size_t i, uint64_t prim_code,
+    string_view primary, uint64_t alt_code, string_view alternate,
+    bool has_alternate ) const
+{
+    const token_codes& t( m_tokens[i] );
+
+    return same( t.prim_code, this->primary( i ), prim_code, primary ) ||
+           ( has_alternate &&
+             same( t.prim_code, this->primary( i ), alt_code, alternate ) ) ||
+           ( t.has_alternate && has_alternate &&
+             same( t.alt_code, this->alternate( i ), alt_code, alternate ) ) ||
+           ( t.has_alternate &&
+             same( t.alt_code, this->alternate( i ), prim_code, primary ) );
+}
+
+bool name_sound::any_token_matches( const name_sound& rhs ) const
+{
+    for ( size_t i = 0; i < size(); i++ )
+    {
+        for ( size_t j = 0; j < rhs.size(); j++ )
+        {
+            if ( token_matches( i, rhs.primary_code( j ), rhs.primary( j ),
+                    rhs.alternate_code( j ), rhs.alternate( j ),
+                    rhs.has_alternate( j ) ) )
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool name_sound::any_token_matches( const sound& rhs ) const
+{
+    for ( size_t i = 0; i < size(); i++ )
+    {
+        if ( token_matches( i, rhs.primary_code(), rhs.primary(),
+                rhs.alternate_code(), rhs.alternate(), rhs.has_alternate() ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool name_sound::any_token_matches( const sound_key& rhs ) const
+{
+    for ( const sound_key& key : m_keys )
+    {
+        if ( key == rhs )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
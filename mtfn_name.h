@@ -0,0 +1,134 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * class name_sound - the sounds of each word of a full name.
+ */
+
+#ifndef __MTFN_NAME_H__
+#define __MTFN_NAME_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// A sound encodes a string as one word, so "Maria del Carmen Lopez-Garcia"
+// comes out as the first few codes of "MARIADELCARMENLOPEZGARCIA". A
+// name_sound splits the name into tokens at spaces and hyphens and encodes
+// each token on its own, as sound would, with one normalization of the
+// whole name and one set of buffers for all the codes. Tokens with nothing
+// the rules know about in them are left out.
+class name_sound
+{
+public:
+    // Characters that separate the tokens of a name
+    static constexpr const char* separators = " -";
+
+    // str coded in ASCII or ISO-8859-15, same as sound( const std::string& )
+    name_sound( std::string_view str, bool limit_length = true );
+
+    // str coded in UTF-8, same as sound( str, utf8 )
+    name_sound( std::string_view str, utf8_t, bool limit_length = true );
+
+    // Number of tokens
+    size_t size( void ) const { return m_tokens.size(); };
+    bool empty( void ) const { return m_tokens.empty(); };
+
+    // Token i after normalization, and its codes as sound has them
+    std::string_view token( size_t i ) const
+    { return std::string_view( m_buf.data() + m_tokens[i].name,
+        m_tokens[i].name_len ); };
+
+    std::string_view primary( size_t i ) const
+    { return std::string_view( m_buf.data() + m_tokens[i].prim,
+        m_tokens[i].prim_len ); };
+
+    std::string_view alternate( size_t i ) const
+    { return std::string_view( m_buf.data() + m_tokens[i].alt,
+        m_tokens[i].alt_len ); };
+
+    bool has_alternate( size_t i ) const
+    { return m_tokens[i].has_alternate; };
+
+    uint64_t primary_code( size_t i ) const
+    { return m_tokens[i].prim_code; };
+
+    uint64_t alternate_code( size_t i ) const
+    { return m_tokens[i].alt_code; };
+
+    // The key of each token, in order, only meaningful for length limited
+    // name_sounds. These are what to insert into or look up in an index.
+    sound_key key( size_t i ) const { return m_keys[i]; };
+    const std::vector<sound_key>& keys( void ) const { return m_keys; };
+
+    // The primary codes of all the tokens separated by spaces, such as
+    // "MR TL KRMN LPS KRS", and those codes packed into one number the way
+    // rules::pack() packs them, spaces and all, so "MR TL" and "MRT L"
+    // differ. A token without codes keeps its spaces, so "H Smith" is
+    // " SM0", not "SM0". Names have the same composite_code() when they have
+    // the same composite(), and otherwise only by chance when it is longer
+    // than packed_len - 1, so it is what to hash or bucket full names by.
+    std::string_view composite( void ) const
+    { return std::string_view( m_buf.data() + m_composite, m_composite_len ); };
+    uint64_t composite_code( void ) const { return m_composite_code; };
+
+    bool length_limited( void ) const { return m_length_limited; };
+
+    // True when any token of this name sounds like any token of rhs, as
+    // sound::operator== compares them. The sound_key overload is for keys
+    // found in an index, and only works for length limited name_sounds.
+    bool any_token_matches( const name_sound& rhs ) const;
+    bool any_token_matches( const sound& rhs ) const;
+    bool any_token_matches( const sound_key& rhs ) const;
+
+private:
+    struct token_codes
+    {
+        uint32_t name;
+        uint32_t name_len;
+        uint32_t prim;
+        uint32_t prim_len;
+        uint32_t alt;
+        uint32_t alt_len;
+        uint64_t prim_code;
+        uint64_t alt_code;
+        bool has_alternate;
+    };
+
+    void split( std::string_view str, bool is_utf8 );
+    void encode( size_t len );
+
+    bool token_matches( size_t i, uint64_t prim_code,
+        std::string_view primary, uint64_t alt_code,
+        std::string_view alternate, bool has_alternate ) const;
+
+    // The normalized tokens, then all the primary codes, all the alternate
+    // codes and the composite, in one allocation
+    std::string m_buf;
+    std::vector<token_codes> m_tokens;
+    std::vector<sound_key> m_keys;
+
+    uint32_t m_composite;
+    uint32_t m_composite_len;
+    uint64_t m_composite_code;
+
+    bool m_length_limited;
+};
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,275 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstdint>
+#include "mtfn.h"
+#include "mtfn_normalize.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define MTFN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace mtfn;
+
+// Every kernel does whole blocks and leaves the rest to the scalar code,
+// returning how much of str it did and how many bytes it wrote.
+typedef size_t (*kernel_fn)( const char* str, size_t len, char* name,
+    int& n );
+
+static size_t squeeze_none( const char*, size_t, char*, int& n )
+{
+    n = 0;
+    return 0;
+}
+
+#ifdef MTFN_X86
+
+// For each 8 bit mask, the pshufb control that moves the bytes whose bits
+// are set to the front, in order
+struct compact_shuffles
+{
+    uint64_t control[256];
+};
+
+static constexpr compact_shuffles make_shuffles( void )
+{
+    compact_shuffles s = {};
+    for ( int mask = 0; mask < 256; mask++ )
+    {
+        int n = 0;
+        for ( int bit = 0; bit < 8; bit++ )
+        {
+            if ( mask & ( 1 << bit ) )
+            {
+                s.control[mask] |= (uint64_t)bit << ( 8 * n++ );
+            }
+        }
+        // The rest pick up byte 0 again; nothing reads them
+    }
+    return s;
+}
+
+static constexpr compact_shuffles shuffles = make_shuffles();
+
+// The bytes rules::normalize() keeps, and the ones it upper cases, as
+// masks of 0xFF bytes. A byte is in a range when adding 0x80 - first makes
+// it a signed byte below 0x80 - first + size.
+#define MTFN_CLASSIFY( W, v, keep, lower )                                   \
+    __m##W##i up = _mm##W##_cmpgt_epi8(                                       \
+        _mm##W##_set1_epi8( (char)( 0x80 + 26 ) ),                            \
+        _mm##W##_add_epi8( v, _mm##W##_set1_epi8( (char)( 0x80 - 'A' ) ) ) ); \
+    __m##W##i lower = _mm##W##_or_si##W(                                      \
+        _mm##W##_cmpgt_epi8( _mm##W##_set1_epi8( (char)( 0x80 + 26 ) ),       \
+            _mm##W##_add_epi8( v, _mm##W##_set1_epi8( (char)( 0x80 - 'a' ) ) ) ), \
+        _mm##W##_or_si##W(                                                    \
+            _mm##W##_cmpeq_epi8( v, _mm##W##_set1_epi8( rules::sm_c_cedilla ) ), \
+            _mm##W##_cmpeq_epi8( v, _mm##W##_set1_epi8( rules::sm_n_tilde ) ) ) ); \
+    __m##W##i keep = _mm##W##_or_si##W( _mm##W##_or_si##W( up, lower ),       \
+        _mm##W##_or_si##W(                                                    \
+            _mm##W##_cmpeq_epi8( v, _mm##W##_set1_epi8( ' ' ) ),              \
+            _mm##W##_or_si##W(                                                \
+                _mm##W##_cmpeq_epi8( v, _mm##W##_set1_epi8( rules::cap_c_cedilla ) ), \
+                _mm##W##_cmpeq_epi8( v, _mm##W##_set1_epi8( rules::cap_n_tilde ) ) ) ) )
+
+// _mm_ and _mm256_ both have to fit the macro
+#define _mm128_set1_epi8 _mm_set1_epi8
+#define _mm128_add_epi8 _mm_add_epi8
+#define _mm128_cmpgt_epi8 _mm_cmpgt_epi8
+#define _mm128_cmpeq_epi8 _mm_cmpeq_epi8
+#define _mm128_or_si128 _mm_or_si128
+
+// Eight bytes of v from the lowest, with the ones not in mask squeezed out
+__attribute__(( target( "ssse3" ) ))
+static inline char* compact8( __m128i v, unsigned int mask, char* out )
+{
+    __m128i control = _mm_cvtsi64_si128( (long long)shuffles.control[mask] );
+    _mm_storel_epi64( (__m128i*)out, _mm_shuffle_epi8( v, control ) );
+    return out + __builtin_popcount( mask );
+}
+
+__attribute__(( target( "sse2" ) ))
+static size_t squeeze_sse2( const char* str, size_t len, char* name,
+    int& n )
+{
+    size_t i = 0;
+    char* out = name;
+
+    for ( ; i + 16 <= len; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)( str + i ) );
+        MTFN_CLASSIFY( 128, v, keep, lower );
+        v = _mm_sub_epi8( v, _mm_and_si128( lower, _mm_set1_epi8( 0x20 ) ) );
+
+        unsigned int mask = _mm_movemask_epi8( keep );
+        if ( mask == 0xFFFF )
+        {
+            _mm_storeu_si128( (__m128i*)out, v );
+            out += 16;
+            continue;
+        }
+
+        // No byte shuffles before SSSE3, so squeeze them out one by one
+        char bytes[16];
+        _mm_storeu_si128( (__m128i*)bytes, v );
+        for ( ; mask != 0; mask &= mask - 1 )
+        {
+            *out++ = bytes[__builtin_ctz( mask )];
+        }
+    }
+
+    n = out - name;
+    return i;
+}
+
+__attribute__(( target( "ssse3" ) ))
+static size_t squeeze_ssse3( const char* str, size_t len, char* name,
+    int& n )
+{
+    size_t i = 0;
+    char* out = name;
+
+    for ( ; i + 16 <= len; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)( str + i ) );
+        MTFN_CLASSIFY( 128, v, keep, lower );
+        v = _mm_sub_epi8( v, _mm_and_si128( lower, _mm_set1_epi8( 0x20 ) ) );
+
+        unsigned int mask = _mm_movemask_epi8( keep );
+        if ( mask == 0xFFFF )
+        {
+            _mm_storeu_si128( (__m128i*)out, v );
+            out += 16;
+            continue;
+        }
+
+        // Each 8 byte store ends inside the block just read, since out
+        // never gets ahead of the input
+        out = compact8( v, mask & 0xFF, out );
+        out = compact8( _mm_srli_si128( v, 8 ), mask >> 8, out );
+    }
+
+    n = out - name;
+    return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+static size_t squeeze_avx2( const char* str, size_t len, char* name,
+    int& n )
+{
+    size_t i = 0;
+    char* out = name;
+
+    for ( ; i + 32 <= len; i += 32 )
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)( str + i ) );
+        MTFN_CLASSIFY( 256, v, keep, lower );
+        v = _mm256_sub_epi8( v,
+            _mm256_and_si256( lower, _mm256_set1_epi8( 0x20 ) ) );
+
+        uint32_t mask = _mm256_movemask_epi8( keep );
+        if ( mask == 0xFFFFFFFF )
+        {
+            _mm256_storeu_si256( (__m256i*)out, v );
+            out += 32;
+            continue;
+        }
+
+        __m128i lo = _mm256_castsi256_si128( v );
+        __m128i hi = _mm256_extracti128_si256( v, 1 );
+        out = compact8( lo, mask & 0xFF, out );
+        out = compact8( _mm_srli_si128( lo, 8 ), ( mask >> 8 ) & 0xFF, out );
+        out = compact8( hi, ( mask >> 16 ) & 0xFF, out );
+        out = compact8( _mm_srli_si128( hi, 8 ), mask >> 24, out );
+    }
+
+    n = out - name;
+    return i;
+}
+
+#endif
+
+static kernel_fn kernel_for( normalize_kernel kernel )
+{
+#ifdef MTFN_X86
+    switch ( kernel )
+    {
+        case normalize_avx2:
+            return squeeze_avx2;
+        case normalize_ssse3:
+            return squeeze_ssse3;
+        case normalize_sse2:
+            return squeeze_sse2;
+        default:
+            break;
+    }
+#endif
+    return squeeze_none;
+}
+
+normalize_kernel mtfn::best_normalize_kernel( void )
+{
+#ifdef MTFN_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        return normalize_avx2;
+    }
+    if ( __builtin_cpu_supports( "ssse3" ) )
+    {
+        return normalize_ssse3;
+    }
+    if ( __builtin_cpu_supports( "sse2" ) )
+    {
+        return normalize_sse2;
+    }
+#endif
+    return normalize_scalar;
+}
+
+const char* mtfn::normalize_kernel_name( normalize_kernel kernel )
+{
+    switch ( kernel )
+    {
+        case normalize_avx2:
+            return "avx2";
+        case normalize_ssse3:
+            return "ssse3";
+        case normalize_sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+int mtfn::normalize_name( const char* str, size_t len, char* name,
+    normalize_kernel kernel )
+{
+    int n;
+    size_t done = kernel_for( kernel )( str, len, name, n );
+
+    return n + rules::normalize( str + done, len - done, name + n );
+}
+
+int mtfn::normalize_blocks( const char* str, size_t len, char* name )
+{
+    static const kernel_fn best = kernel_for( best_normalize_kernel() );
+
+    int n;
+    size_t done = best( str, len, name, n );
+
+    return n + rules::normalize( str + done, len - done, name + n );
+}
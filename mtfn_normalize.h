@@ -0,0 +1,59 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * normalize_name() - rules::normalize() 16 or 32 bytes at a time, for
+ * names being encoded at run time.
+ */
+
+#ifndef __MTFN_NORMALIZE_H__
+#define __MTFN_NORMALIZE_H__
+
+#include <cstddef>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// The ways normalize_name() can upper case and compact a name, best first.
+// By default it uses the best one the CPU it runs on supports.
+enum normalize_kernel
+{
+    normalize_avx2,
+    normalize_ssse3,
+    normalize_sse2,
+    normalize_scalar
+};
+
+normalize_kernel best_normalize_kernel( void );
+const char* normalize_kernel_name( normalize_kernel kernel );
+
+// Same as rules::normalize(), which stays as it is for constant
+// expressions: Ç and Ñ are kept, ç and ñ upper cased along with a-z, and
+// anything else but A-Z and space is left out.
+int normalize_name( const char* str, size_t len, char* name,
+    normalize_kernel kernel );
+
+// The best kernel, once the name is long enough for one block
+int normalize_blocks( const char* str, size_t len, char* name );
+
+inline int normalize_name( const char* str, size_t len, char* name )
+{
+    // Most names are shorter than a block
+    return len < 16 ? rules::normalize( str, len, name )
+                    : normalize_blocks( str, len, name );
+}
+
+}; // namespace mtfn
+
+#endif
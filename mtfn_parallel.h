@@ -0,0 +1,59 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * parallel_for() - splits work between threads.
+ */
+
+#ifndef __MTFN_PARALLEL_H__
+#define __MTFN_PARALLEL_H__
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace mtfn
+{
+
+// Runs fn( t, begin, end ) on threads threads, each over its own
+// contiguous share of count items, in order of t
+template <typename FN>
+inline void parallel_for( int threads, size_t count, FN fn )
+{
+    std::vector<std::thread> pool;
+    for ( int t = 0; t < threads; t++ )
+    {
+        size_t begin = count * t / threads;
+        size_t end = count * ( t + 1 ) / threads;
+        pool.push_back( std::thread( [=, &fn] { fn( t, begin, end ); } ) );
+    }
+
+    for ( std::thread& t : pool )
+    {
+        t.join();
+    }
+}
+
+// threads, or one per core if threads is 0
+inline int thread_count( int threads )
+{
+    if ( threads <= 0 )
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    return threads > 0 ? threads : 1;
+}
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,181 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include "mtfn_profile.h"
+
+using namespace std;
+using namespace mtfn;
+
+const int events = 3;
+const int places = 0x10000;
+
+// One thread's counts. Only the thread itself adds to them, so a load and
+// a store are enough, but they are atomic so the totals can be read while
+// it runs.
+struct counts
+{
+    atomic<uint64_t> hits[events][places];
+    atomic<const char*> functions[events][places];
+};
+
+// Every running thread's counts, and the totals of the threads that have
+// finished. Never freed, so that threads can still finish while the
+// program exits.
+struct registry
+{
+    mutex lock;
+    vector<counts*> running;
+    counts finished;
+};
+
+static registry& all_counts( void )
+{
+    static registry* r = new registry();
+    return *r;
+}
+
+static void add( counts& to, const counts& from )
+{
+    for ( int e = 0; e < events; e++ )
+    {
+        for ( int w = 0; w < places; w++ )
+        {
+            uint64_t hits = from.hits[e][w].load( memory_order_relaxed );
+            if ( hits != 0 )
+            {
+                to.hits[e][w].store( to.hits[e][w].load(
+                    memory_order_relaxed ) + hits, memory_order_relaxed );
+                to.functions[e][w].store( from.functions[e][w].load(
+                    memory_order_relaxed ), memory_order_relaxed );
+            }
+        }
+    }
+}
+
+class thread_counts
+{
+public:
+    thread_counts( void ) : m_counts( new counts() )
+    {
+        registry& r( all_counts() );
+        lock_guard<mutex> hold( r.lock );
+        r.running.push_back( m_counts );
+    };
+
+    ~thread_counts()
+    {
+        registry& r( all_counts() );
+        lock_guard<mutex> hold( r.lock );
+        add( r.finished, *m_counts );
+        r.running.erase( find( r.running.begin(), r.running.end(),
+            m_counts ) );
+        delete m_counts;
+    };
+
+    counts& get( void ) { return *m_counts; };
+
+private:
+    counts* m_counts;
+};
+
+bool mtfn::rules_profiled( void )
+{
+#ifdef MTFN_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void mtfn::count_rule( rule_event event, int where, const char* function )
+{
+    static thread_local thread_counts mine;
+    counts& c( mine.get() );
+
+    where &= places - 1;
+    atomic<uint64_t>& hits( c.hits[event][where] );
+    hits.store( hits.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+    if ( c.functions[event][where].load( memory_order_relaxed ) == NULL )
+    {
+        c.functions[event][where].store( function, memory_order_relaxed );
+    }
+}
+
+void mtfn::rule_counts( vector<rule_count>& found )
+{
+    registry& r( all_counts() );
+    counts* total = new counts();
+    {
+        lock_guard<mutex> hold( r.lock );
+        add( *total, r.finished );
+        for ( counts* c : r.running )
+        {
+            add( *total, *c );
+        }
+    }
+
+    size_t first = found.size();
+    for ( int e = 0; e < events; e++ )
+    {
+        for ( int w = 0; w < places; w++ )
+        {
+            uint64_t hits = total->hits[e][w].load( memory_order_relaxed );
+            if ( hits == 0 )
+            {
+                continue;
+            }
+
+            string where;
+            if ( e == rule_advance )
+            {
+                where = string( 1, (char)( w >> 8 ) ) + '+' +
+                    to_string( w & 0xFF );
+            }
+            else
+            {
+                where = string( total->functions[e][w].load(
+                    memory_order_relaxed ) ) + ':' + to_string( w );
+            }
+            found.push_back( rule_count{ (rule_event)e, where, hits } );
+        }
+    }
+    delete total;
+
+    stable_sort( found.begin() + first, found.end(),
+        []( const rule_count& a, const rule_count& b ) {
+            return a.hits > b.hits; } );
+}
+
+void mtfn::reset_rule_counts( void )
+{
+    registry& r( all_counts() );
+    lock_guard<mutex> hold( r.lock );
+
+    vector<counts*> all( r.running );
+    all.push_back( &r.finished );
+    for ( counts* c : all )
+    {
+        for ( int e = 0; e < events; e++ )
+        {
+            for ( int w = 0; w < places; w++ )
+            {
+                c->hits[e][w].store( 0, memory_order_relaxed );
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * rule_counts() - how often each of the rules' branches, character tests
+ * and cursor steps ran, in a build with MTFN_PROFILE defined.
+ */
+
+#ifndef __MTFN_PROFILE_H__
+#define __MTFN_PROFILE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mtfn
+{
+
+enum rule_event
+{
+    rule_branch,            // a branch of a letter's rule was taken
+    rule_probe,             // is_one_of() or is_at() tested the name
+    rule_advance            // a letter's rule moved the cursor on
+};
+
+struct rule_count
+{
+    rule_event event;
+    std::string where;      // "letter_c:612" or, for advances, "C+2"
+    uint64_t hits;
+};
+
+// True if the rules were built with MTFN_PROFILE defined. Otherwise they
+// count nothing, and cost nothing to count.
+bool rules_profiled( void );
+
+// Appends the counts of every thread since the last reset, most hits
+// first. Threads still encoding may or may not have their latest hits in.
+void rule_counts( std::vector<rule_count>& counts );
+void reset_rule_counts( void );
+
+// Called by the rules: where is the line of mtfn_rules.h for branches and
+// probes, and the letter times 256 plus the characters moved for advances
+void count_rule( rule_event event, int where, const char* function );
+
+}; // namespace mtfn
+
+#endif
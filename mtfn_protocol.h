@@ -0,0 +1,108 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * The messages lookup_client and lookup_server (mtfnd) send each other over
+ * a Unix domain socket.
+ */
+
+#ifndef __MTFN_PROTOCOL_H__
+#define __MTFN_PROTOCOL_H__
+
+#include <cstdint>
+#include <cstring>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+// Every message is a header followed by len bytes of body. Both ends are on
+// the same machine, so numbers are in its byte order. A client can send any
+// number of requests without waiting for the responses, which carry the id
+// of their request and can come back in a different order.
+enum lookup_op
+{
+    lookup_encode = 1,      // body: a name; response: its key, see put_key()
+    lookup_find = 2,        // body: a name; response: uint32_t record ids
+    lookup_name = 3,        // body: a uint32_t record id; response: the name
+    lookup_stats = 4        // no body; response: a server_stats
+};
+
+enum lookup_flags
+{
+    lookup_utf8 = 0x01      // the name is in UTF-8 rather than ISO-8859-15
+};
+
+enum lookup_status
+{
+    lookup_ok = 0,
+    lookup_bad_request = 1,
+    lookup_not_found = 2
+};
+
+struct lookup_request
+{
+    uint32_t len;
+    uint32_t id;
+    uint8_t op;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct lookup_response
+{
+    uint32_t len;
+    uint32_t id;
+    uint8_t status;
+    uint8_t reserved[3];
+};
+
+// A request with a longer body closes the connection
+const uint32_t lookup_max_len = 1 << 16;
+
+// The body of the response to lookup_encode: the sound_key's primary,
+// alternate and flags, in that order, then zeros up to lookup_key_len. The
+// fields go one at a time so that the struct's padding never does.
+const uint32_t lookup_key_len = 8;
+
+inline void put_key( const sound_key& key, char* body )
+{
+    memset( body, 0, lookup_key_len );
+    memcpy( body, &key.primary, sizeof( key.primary ) );
+    memcpy( body + 2, &key.alternate, sizeof( key.alternate ) );
+    memcpy( body + 4, &key.flags, sizeof( key.flags ) );
+}
+
+inline sound_key get_key( const char* body )
+{
+    sound_key key;
+    memcpy( &key.primary, body, sizeof( key.primary ) );
+    memcpy( &key.alternate, body + 2, sizeof( key.alternate ) );
+    memcpy( &key.flags, body + 4, sizeof( key.flags ) );
+    return key;
+}
+
+struct server_stats
+{
+    uint64_t records;       // in the index served
+    uint64_t connections;   // accepted so far
+    uint64_t requests;
+    uint64_t batches;       // requests are handed to the workers in these
+    uint64_t p50_ns;        // from reading a request to queueing its answer
+    uint64_t p99_ns;
+    uint64_t max_ns;
+};
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,1750 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * The double metaphone rules of class rules, and encode(). They are in a
+ * header so that they can be run in constant expressions; include mtfn.h
+ * rather than this file.
+ */
+
+#ifndef __MTFN_RULES_H__
+#define __MTFN_RULES_H__
+
+#include "mtfn_table.h"
+
+namespace mtfn
+{
+
+// The rules' patterns are packed into integers at compile time. A _pat
+// literal holds up to 7 characters, the first one in the lowest byte, with
+// the length in the top byte. A _set literal has one bit for each of the
+// characters from ' ' to '_', which covers all the rules look for.
+constexpr uint64_t operator "" _pat( const char* str, size_t len )
+{
+    uint64_t packed = 0;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        packed |= (uint64_t)(unsigned char)str[i] << ( 8 * i );
+    }
+
+    return len < 8 ? packed | (uint64_t)len << 56
+                   : throw "a pattern has at most 7 characters";
+}
+
+constexpr uint64_t operator "" _set( const char* str, size_t len )
+{
+    uint64_t set = 0;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        unsigned char c = str[i];
+        set |= ( ' ' <= c && c <= '_' ) ? (uint64_t)1 << ( c - ' ' )
+               : throw "a set only has characters from ' ' to '_'";
+    }
+
+    return set;
+}
+
+template <uint64_t SET>
+constexpr bool rules::is_one_of( char needle MTFN_SITE_PARAMS )
+{
+    MTFN_PROBE();
+    unsigned int bit = (unsigned char)needle - ' ';
+    return bit < 64 && ( ( SET >> bit ) & 1 );
+}
+
+// The N characters of the name from pos, packed like a _pat literal. When
+// they are all inside the name the loop is a plain load once optimized.
+template <int N>
+constexpr uint64_t rules::window( int pos ) const
+{
+    uint64_t packed = 0;
+
+    if ( 0 <= pos && pos + N <= m_len )
+    {
+        const char* p = m_name + pos;
+        for ( int i = 0; i < N; i++ )
+        {
+            packed |= (uint64_t)(unsigned char)p[i] << ( 8 * i );
+        }
+        return packed;
+    }
+
+    for ( int i = 0; i < N; i++ )
+    {
+        packed |= (uint64_t)(unsigned char)at( pos + i ) << ( 8 * i );
+    }
+
+    return packed;
+}
+
+// window() for the table's tests, whose lengths are only known at run time
+constexpr uint64_t rules::window( int pos, int len ) const
+{
+    uint64_t packed = 0;
+
+    if ( 0 <= pos && pos + len <= m_len )
+    {
+        const char* p = m_name + pos;
+        for ( int i = 0; i < len; i++ )
+        {
+            packed |= (uint64_t)(unsigned char)p[i] << ( 8 * i );
+        }
+        return packed;
+    }
+
+    for ( int i = 0; i < len; i++ )
+    {
+        packed |= (uint64_t)(unsigned char)at( pos + i ) << ( 8 * i );
+    }
+
+    return packed;
+}
+
+template <uint64_t FIRST, uint64_t... REST>
+constexpr bool rules::is_one_of( int pos MTFN_SITE_PARAMS ) const
+{
+    MTFN_PROBE();
+    constexpr int len = FIRST >> 56;
+    constexpr uint64_t chars = ( (uint64_t)1 << ( 8 * len ) ) - 1;
+    static_assert( ( ( REST >> 56 == len ) && ... ),
+                   "all the patterns in a set have the same length" );
+
+    uint64_t w = window<len>( pos );
+    return w == ( FIRST & chars ) || ( ( w == ( REST & chars ) ) || ... );
+}
+
+constexpr bool rules::is_vowel( char c )
+{
+    return is_one_of<"AEIOUY"_set>( c );
+}
+
+constexpr int rules::char_value( char c )
+{
+    switch ( c )
+    {
+        case '0':
+            return 0x01;
+        case 'A':
+            return 0x02;
+        case 'F':
+            return 0x03;
+        case 'H':
+            return 0x04;
+        case 'J':
+            return 0x05;
+        case 'K':
+            return 0x06;
+        case 'L':
+            return 0x07;
+        case 'M':
+            return 0x08;
+        case 'N':
+            return 0x09;
+        case 'P':
+            return 0x0A;
+        case 'R':
+            return 0x0B;
+        case 'S':
+            return 0x0C;
+        case 'T':
+            return 0x0D;
+        case 'X':
+            return 0x0E;
+        default:
+            return 0x00;
+    }
+}
+
+// Packs codes 4 bits each, the first one in the highest nibble used. Every
+// code has a non zero value below 0xF, so up to packed_len codes pack
+// exactly. Longer codes are hashed into 60 bits instead, with 0xF, which no
+// code packs to, in the top nibble to mark the result as a fingerprint.
+constexpr uint64_t rules::pack( const char* codes, int len )
+{
+    uint64_t packed = 0;
+
+    if ( len <= packed_len )
+    {
+        for ( int i = 0; i < len; i++ )
+        {
+            packed <<= 4;
+            packed += char_value( codes[i] );
+        }
+
+        return packed;
+    }
+
+    return fingerprint( codes, len );
+}
+
+// FNV-1a, then a final mix so that the top bits depend on every code
+constexpr uint64_t rules::fingerprint( const char* codes, int len )
+{
+    uint64_t packed = 0xcbf29ce484222325ULL;
+    for ( int i = 0; i < len; i++ )
+    {
+        packed ^= (uint64_t)char_value( codes[i] );
+        packed *= 0x100000001b3ULL;
+    }
+    packed ^= packed >> 29;
+    packed *= 0xbf58476d1ce4e5b9ULL;
+    packed ^= packed >> 32;
+
+    return ( packed >> 4 ) | (uint64_t)0xF << 60;
+}
+
+constexpr rules::rules( key_length codes )
+: m_name( NULL ),
+  m_len( 0 ),
+  m_last( -1 ),
+  m_cursor( 0 ),
+  m_slavo_germanic( -1 ),
+  m_has_alternate( false ),
+  m_primary( NULL ),
+  m_alternate( NULL ),
+  m_prim_len( 0 ),
+  m_alt_len( 0 ),
+  m_code_cap( 0 ),
+  m_prim_code( 0 ),
+  m_alt_code( 0 ),
+  m_key_len( codes.codes )
+{
+}
+
+// Convert to upper case, remove any unexpected characters
+constexpr int rules::normalize( const char* str, size_t len, char* name )
+{
+    int n = 0;
+
+    for ( size_t i = 0; i < len; i++ )
+    {
+        char c = str[i];
+
+        if ( ( 'A' <= c && c <= 'Z' ) || c == ' ' ||
+             c == cap_c_cedilla || c == cap_n_tilde )
+        {
+            name[n++] = c;
+        }
+        else if ( ( 'a' <= c && c <= 'z' ) ||
+                    c == sm_c_cedilla || c == sm_n_tilde )
+        {
+            name[n++] = c - 0x20;
+        }
+    }
+
+    return n;
+}
+
+// The letters the accented ones fold to, starting from U+00C0 and U+0100.
+// Digits stand for more than one letter, '_' for none, and 'c' and 'n'
+// for Ç and Ñ, which the rules know.
+constexpr int rules::fold( uint32_t code_point, char* name )
+{
+    constexpr const char* latin_1 =
+        "AAAAAA1cEEEEIIIIDnOOOOO_OUUUUY45"
+        "AAAAAA1cEEEEIIIIDnOOOOO_OUUUUY4Y";
+    constexpr const char* latin_ext_a =
+        "AAAAAACCCCCCCCDDDDEEEEEEEEEEGGGGGGGGHHHHIIIIIIIIII22JJKKK"
+        "LLLLLLLLLLNNNNNNNNNOOOOOO33RRRRRRSSSSSSSSTTTTTTUUUUUUUUUUUU"
+        "WWYYYZZZZZZS";
+    constexpr const char* ligatures[] = { "AE", "IJ", "OE", "TH", "SS" };
+
+    char c = '_';
+    if ( 0xC0 <= code_point && code_point < 0x100 )
+    {
+        c = latin_1[code_point - 0xC0];
+    }
+    else if ( 0x100 <= code_point && code_point < 0x180 )
+    {
+        c = latin_ext_a[code_point - 0x100];
+    }
+
+    switch ( c )
+    {
+        case '_':
+            return 0;
+        case 'c':
+            name[0] = cap_c_cedilla;
+            return 1;
+        case 'n':
+            name[0] = cap_n_tilde;
+            return 1;
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+            name[0] = ligatures[c - '1'][0];
+            name[1] = ligatures[c - '1'][1];
+            return 2;
+        default:
+            name[0] = c;
+            return 1;
+    }
+}
+
+// Runs of ASCII go straight through normalize(). Anything else is decoded
+// and folded; bytes that don't start a whole sequence are skipped on their
+// own.
+constexpr int rules::normalize_utf8( const char* str, size_t len, char* name )
+{
+    int n = 0;
+    size_t i = 0;
+
+    while ( i < len )
+    {
+        size_t ascii = i;
+        while ( ascii < len && (unsigned char)str[ascii] < 0x80 )
+        {
+            ascii++;
+        }
+        n += normalize( str + i, ascii - i, name + n );
+        i = ascii;
+        if ( i == len )
+        {
+            break;
+        }
+
+        unsigned char lead = str[i];
+        size_t extra = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+        uint32_t code_point = lead & ( 0x3F >> extra );
+        size_t k = 1;
+        for ( ; k <= extra && i + k < len &&
+                ( (unsigned char)str[i + k] & 0xC0 ) == 0x80; k++ )
+        {
+            code_point = code_point << 6 | ( (unsigned char)str[i + k] & 0x3F );
+        }
+
+        if ( extra == 0 || k <= extra )
+        {
+            i++;
+            continue;
+        }
+
+        n += fold( code_point, name + n );
+        i += k;
+    }
+
+    return n;
+}
+
+constexpr void rules::run( const char* name, int len,
+    char* primary, char* alternate )
+{
+    start( name, len, primary, alternate );
+    while ( !is_ready() )
+    {
+        step();
+    }
+    finish();
+}
+
+constexpr bool rules::run_while( const char* name, int len,
+    char* primary, char* alternate, std::string_view target,
+    std::string_view target_alt )
+{
+    start( name, len, primary, alternate );
+    while ( !is_ready() )
+    {
+        int prim_len = m_prim_len, alt_len = m_alt_len;
+
+        step();
+
+        // Only new codes can rule the targets out
+        if ( ( m_prim_len != prim_len || m_alt_len != alt_len ) &&
+             !begins( m_primary, m_prim_len, target, target_alt ) &&
+             !begins( m_alternate, m_alt_len, target, target_alt ) )
+        {
+            return false;
+        }
+    }
+    finish();
+
+    return true;
+}
+
+constexpr bool rules::begins( const char* codes, int len,
+    std::string_view target, std::string_view target_alt )
+{
+    std::string_view prefix( codes, len );
+
+    return target.substr( 0, len ) == prefix ||
+           target_alt.substr( 0, len ) == prefix;
+}
+
+constexpr void rules::start( const char* name, int len,
+    char* primary, char* alternate )
+{
+    m_name = name;
+    m_len = len;
+    m_last = len - 1;
+    m_cursor = 0;
+    m_slavo_germanic = -1;
+    m_has_alternate = false;
+    m_primary = primary;
+    m_alternate = alternate;
+    m_prim_len = 0;
+    m_alt_len = 0;
+    m_code_cap = m_key_len > 0 ? m_key_len : 2 * len;
+
+    // Skip silent letters at the start of a word.
+    if ( is_one_of<"GN"_pat, "KN"_pat, "PN"_pat, "WR"_pat, "PS"_pat>( m_cursor ) )
+    {
+        m_cursor += 1;
+        MTFN_ADVANCE( 0 );
+    }
+}
+
+constexpr void rules::resume( const char* name, int len,
+    char* primary, char* alternate, const checkpoint& from )
+{
+    m_name = name;
+    m_len = len;
+    m_last = len - 1;
+    m_cursor = from.cursor;
+    m_slavo_germanic = -1;
+    m_has_alternate = from.has_alternate;
+    m_primary = primary;
+    m_alternate = alternate;
+    m_prim_len = from.prim_len;
+    m_alt_len = from.alt_len;
+    m_code_cap = m_key_len > 0 ? m_key_len : 2 * len;
+}
+
+// Runs the rule for the letter at the cursor, which moves the cursor on
+constexpr void rules::step( void )
+{
+    const int from = m_cursor;
+
+#ifdef MTFN_RULE_TABLE
+    walk_table();
+#else
+    dispatch();
+#endif
+
+    MTFN_ADVANCE( from );
+}
+
+constexpr void rules::dispatch( void )
+{
+    switch ( m_name[m_cursor] )
+    {
+        case 'A':
+        case 'E':
+        case 'I':
+        case 'O':
+        case 'U':
+        case 'Y':
+            vowel();
+            break;
+        case 'B':
+            letter_b();
+            break;
+        case cap_c_cedilla:
+            letter_c_cedilla();
+            break;
+        case 'C':
+            letter_c();
+            break;
+        case 'D':
+            letter_d();
+            break;
+        case 'F':
+            letter_f();
+            break;
+        case 'G':
+            letter_g();
+            break;
+        case 'H':
+            letter_h();
+            break;
+        case 'J':
+            letter_j();
+            break;
+        case 'K':
+            letter_k();
+            break;
+        case 'L':
+            letter_l();
+            break;
+        case 'M':
+            letter_m();
+            break;
+        case 'N':
+            letter_n();
+            break;
+        case cap_n_tilde:
+            letter_n_tilde();
+            break;
+        case 'P':
+            letter_p();
+            break;
+        case 'Q':
+            letter_q();
+            break;
+        case 'R':
+            letter_r();
+            break;
+        case 'S':
+            letter_s();
+            break;
+        case 'T':
+            letter_t();
+            break;
+        case 'V':
+            letter_v();
+            break;
+        case 'W':
+            letter_w();
+            break;
+        case 'X':
+            letter_x();
+            break;
+        case 'Z':
+            letter_z();
+            break;
+        default:
+            m_cursor++;
+            break;
+    }
+}
+
+// The rules for the letter at the cursor start at the cell for it and the
+// letter after it. A rule that fails goes on to the next one, and one that
+// passes either ends the letter or goes on to the rules of its next group.
+constexpr void rules::walk_table( void )
+{
+    const int c = m_cursor;
+    int r = table_cells[c > 0][table_row[(unsigned char)m_name[c]]]
+        [table_column[(unsigned char)at( c+1 )]];
+
+    for ( ;; )
+    {
+        const table_rule& rule = table_rules[r];
+        if ( !passes( rule ) )
+        {
+            r++;
+            continue;
+        }
+
+        for ( const char* p = rule.primary; *p; p++ )
+        {
+            push( m_primary, m_prim_len, *p );
+        }
+        for ( const char* a = rule.alternate; *a; a++ )
+        {
+            push( m_alternate, m_alt_len, *a );
+        }
+        m_has_alternate |= rule.alternates;
+
+        if ( rule.advance > 0 )
+        {
+            m_cursor += rule.advance;
+            return;
+        }
+        r = rule.next;
+    }
+}
+
+constexpr bool rules::passes( const table_rule& rule )
+{
+    bool clause = false;
+
+    for ( int i = rule.tests; i < rule.tests_end; i++ )
+    {
+        const table_test& test = table_tests[i];
+        if ( !clause )
+        {
+            clause = passes( test ) != ( ( test.flags & table_negated ) != 0 );
+        }
+        if ( test.flags & table_ends_clause )
+        {
+            if ( !clause )
+            {
+                return false;
+            }
+            clause = false;
+        }
+    }
+
+    return true;
+}
+
+constexpr bool rules::passes( const table_test& test )
+{
+    const int pos = test.offset + ( test.base == table_cursor ? m_cursor :
+        test.base == table_last ? m_last : 0 );
+
+    switch ( test.kind )
+    {
+        case table_char:
+        {
+            unsigned int bit = (unsigned char)at( pos ) - ' ';
+            return bit < 64 && ( ( test.set >> bit ) & 1 );
+        }
+        case table_text:
+        {
+            uint64_t w = window( pos, test.len );
+            for ( int i = 0; i < test.count; i++ )
+            {
+                if ( w == table_patterns[test.patterns + i] )
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        case table_cursor_at:
+            return m_cursor == pos;
+        case table_cursor_after:
+            return m_cursor > pos;
+        case table_last_at:
+            return m_last == pos;
+        case table_slavo:
+            return is_slavo_germanic();
+    }
+
+    return false;
+}
+
+constexpr void rules::finish( void )
+{
+    if ( !m_has_alternate )
+    {
+        m_alt_len = 0;
+    }
+
+    m_prim_code = pack( m_primary, m_prim_len );
+    m_alt_code = pack( m_alternate, m_alt_len );
+}
+
+constexpr bool rules::is_slavo_germanic( void )
+{
+    if ( m_slavo_germanic < 0 )
+    {
+        m_slavo_germanic = 0;
+        for ( int i = 0; i < m_len; i++ )
+        {
+            if ( m_name[i] == 'W' || m_name[i] == 'K' || is_at<"CZ"_pat>( i ) )
+            {
+                m_slavo_germanic = 1;
+                break;
+            }
+        }
+    }
+
+    return m_slavo_germanic == 1;
+}
+
+constexpr bool rules::is_spanish_ll( void ) const
+{
+    const int& c( m_cursor );
+
+    if ( c == m_last - 2 && is_one_of<"ILLO"_pat, "ILLA"_pat, "ALLE"_pat>( c-1 ) )
+    {
+        return true;
+    }
+    else if ( ( is_one_of<"AS"_pat, "OS"_pat>( m_last - 1 ) ||
+              is_one_of<"AO"_set>( at( m_last ) ) )
+              && is_at<"ALLE"_pat>( c-1 ) )
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+constexpr bool rules::starts_german( void ) const
+{
+    return is_one_of<"VAN "_pat, "VON "_pat>( 0 ) ||
+           is_at<"SCH"_pat>( 0 );
+}
+
+constexpr bool rules::is_germanic_c( void ) const
+{
+    const int& c( m_cursor );
+
+    return ( c > 1 &&
+         !is_vowel( at( c-2 ) ) &&
+         is_at<"ACH"_pat>( c-1 ) &&
+         !is_one_of<"IE"_set>( at( c+2 ) ) ) ||
+         is_one_of<"BACHER"_pat, "MACHER"_pat>( c-2 );
+}
+
+constexpr void rules::vowel( void )
+{
+    int& c( m_cursor );
+
+    if ( c == 0 )
+    {
+        MTFN_BRANCH();
+        add( 'A' );
+    }
+
+    c++;
+}
+
+constexpr void rules::letter_b( void )
+{
+    int& c( m_cursor );
+
+    // "-mb", e.g., "dumb" already skipped over...
+    add( 'P' );
+
+    // 'BB' sounds the same as 'B'
+    if ( at( c+1 ) == 'B' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+}
+
+constexpr void rules::letter_c_cedilla( void )
+{
+    int& c( m_cursor );
+
+    // Ç sounds like 'S'
+    add( "", "S" );
+    c++;
+}
+
+constexpr void rules::letter_c( void )
+{
+    int& c( m_cursor );
+
+    if ( is_germanic_c() )
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c += 2;
+    }
+    else if ( c == 0 && is_at<"CAESAR"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( 'S' );
+        c += 2;
+    }
+    else if ( is_at<"CHIA"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c += 2;
+    }
+    else if ( is_at<"CH"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        letter_combo_ch();
+    }
+    else if ( is_at<"CZ"_pat>( c ) &&
+              !is_at<"WICZ"_pat>( c-2 ) )
+    {
+        MTFN_BRANCH();
+        // 'czar'
+        add( 'S', 'X' );
+        c += 2;
+    }
+    else if ( is_at<"CIA"_pat>( c+1 ) )
+    {
+        MTFN_BRANCH();
+        // italian like 'focaccia'
+        add( 'X' );
+        c += 3;
+    }
+    else if ( is_at<"CC"_pat>( c ) && !is_at<"MCC"_pat>( c-1 ) )
+    {
+        MTFN_BRANCH();
+        // double "cc" but not "McClelland"
+        return letter_combo_cc();
+    }
+    else if ( is_one_of<"CK"_pat, "CG"_pat, "CQ"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c += 2;
+    }
+    else if ( is_one_of<"CI"_pat, "CE"_pat, "CY"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        //-- Italian vs. English --//
+        if ( is_one_of<"CIO"_pat, "CIE"_pat, "CIA"_pat>( c ) )
+        {
+            MTFN_BRANCH();
+            add('S', 'X');
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add('S');
+        }
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        if ( is_one_of<" C"_pat, " Q"_pat, " G"_pat>( c+1 ))
+        {
+            MTFN_BRANCH();
+            //-- Mac Caffrey, Mac Gregor --//
+            c += 3;
+        }
+        else if ( is_one_of<"CKQ"_set>( at( c+1 ) ) &&
+                  !is_one_of<"CE"_pat, "CI"_pat>( c+1 ) )
+        {
+            MTFN_BRANCH();
+            c += 2;
+        }
+        else
+        {
+            MTFN_BRANCH();
+            c += 1;
+        }
+    }
+}
+
+constexpr void rules::letter_combo_ch( void )
+{
+    int& c( m_cursor );
+
+    if ( c > 0 && is_at<"CHAE"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        // michael
+        add( 'K', 'X' );
+        c += 2;
+    }
+    else if ( c == 0 && !is_at<"CHORE"_pat>( c ) &&
+            ( is_one_of<"HARAC"_pat, "HARIS"_pat>( c+1 ) ||
+              is_one_of<"HOR"_pat, "HYM"_pat, "HIA"_pat, "HEM"_pat>( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+        // words with greek roots, e.g. 'chemistry', 'chorus'
+        add( 'K' );
+        c += 2;
+    }
+    else if ( starts_german() ||
+                is_one_of<"ORCHES"_pat, "ARCHIT"_pat, "ORCHID"_pat>( c-2 ) ||
+                is_one_of<"TS"_set>( at( c+2 ) ) ||
+                ( is_one_of<"AOUE_"_set>( at( c-1 ) ) &&
+                  is_one_of<"LRNMBHFVW _"_set>( at( c+2 ) ) ) )
+    {
+        MTFN_BRANCH();
+        // germanic, greek, or otherwise 'ch' for 'kh'
+        add( 'K' );
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        if ( c > 0 )
+        {
+            MTFN_BRANCH();
+            if ( is_at<"MC"_pat>( 0 ) )
+            {
+                MTFN_BRANCH();
+                // 'mchugh'
+                add('K');
+            }
+            else
+            {
+                MTFN_BRANCH();
+                add('X', 'K');
+            }
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add ( 'X' );
+        }
+        c += 2;
+    }
+}
+
+constexpr void rules::letter_combo_cc( void )
+{
+    int& c( m_cursor );
+
+    // 'bellocchio' but not 'bacchus'
+    if ( is_one_of<"IEH"_set>( at( c+2 ) ) && !is_at<"HU"_pat>( c+2 ) )
+    {
+        MTFN_BRANCH();
+        //'accident', 'accede' 'succeed'
+        if ( ( c == 1 && at( c-1 ) == 'A' ) ||
+             is_one_of<"UCCEE"_pat, "UCCES"_pat>( c-1 ) )
+        {
+            MTFN_BRANCH();
+            add( "KS" );
+        }
+        //'bacci', 'bertucci', other italian
+        else
+        {
+            MTFN_BRANCH();
+            add( 'X' );
+        }
+        c += 3;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c+= 2;
+    }
+}
+
+constexpr void rules::letter_d( void )
+{
+    int& c( m_cursor );
+
+    if ( is_at<"DG"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        if ( is_one_of<"IEY"_set>( at( c+2 ) ) )
+        {
+            MTFN_BRANCH();
+            //e.g. 'edge'
+            add( 'J' );
+            c += 3;
+        }
+        else
+        {
+            MTFN_BRANCH();
+            //e.g. 'edgar'
+            add( "TK" );
+            c += 2;
+        }
+    }
+    else
+    {
+        MTFN_BRANCH();
+        // 'DT' and 'DD' sound the same as 'D'
+        if ( is_one_of<"DT"_pat, "DD"_pat>( c ) )
+        {
+            MTFN_BRANCH();
+            c += 2;
+        }
+        else
+        {
+            MTFN_BRANCH();
+            c += 1;
+        }
+        add( 'T' );
+    }
+}
+
+constexpr void rules::letter_f( void )
+{
+    int& c( m_cursor );
+
+    // 'FF' sounds the same as 'F'
+    if ( at( c+1 ) == 'F' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+
+    add( 'F' );
+}
+
+constexpr void rules::letter_g( void )
+{
+    int& c( m_cursor );
+
+    if ( at( c+1 ) == 'H' )
+    {
+        MTFN_BRANCH();
+        letter_combo_gh();
+    }
+    else if ( at( c+1 ) == 'N' )
+    {
+        MTFN_BRANCH();
+        if ( c == 1 && is_vowel( at( 0 ) ) && !is_slavo_germanic() )
+        {
+            MTFN_BRANCH();
+            add( "KN", "N" );
+        }
+        else if ( !is_at<"EY"_pat>( c+2 ) && at( c+1 ) != 'Y' &&
+                 !is_slavo_germanic() )
+        {
+            MTFN_BRANCH();
+            //not e.g. 'cagney'
+            add( "N", "KN" );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( "KN" );
+        }
+
+        c+= 2;
+    }
+    else if ( is_at<"LI"_pat>( c+1 ) && !is_slavo_germanic() )
+    {
+        MTFN_BRANCH();
+        //'tagliaro'
+        add( "KL", "L" );
+        c += 2;
+    }
+    else if ( c == 0 &&
+         ( at( c+1 ) == 'Y' ||
+         is_one_of<"ES"_pat, "EP"_pat, "EB"_pat, "EL"_pat, "EY"_pat, "IB"_pat,
+                   "IL"_pat, "IN"_pat, "IE"_pat, "EI"_pat, "ER"_pat>( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+        // -ges-,-gep-,-gel-, -gie- at beginning
+        add( 'K', 'J' );
+        c += 2;
+    }
+    else if ( ( is_at<"ER"_pat>( c+1 ) || at( c+1 ) == 'Y' ) &&
+         !is_one_of<"DANGER"_pat, "RANGER"_pat, "MANGER"_pat>( 0 ) &&
+         !is_one_of<"EI"_set>( at( c-1 ) ) &&
+         !is_one_of<"RGY"_pat, "OGY"_pat>( c-1 ) )
+    {
+        MTFN_BRANCH();
+        // -ger-,  -gy-
+        add( 'K', 'J' );
+        c += 2;
+        return;
+    }
+    else if ( is_one_of<"EIY"_set>( at( c+1 ) ) ||
+         is_one_of<"AGGI"_pat, "OGGI"_pat>( c-1 ) )
+    {
+        MTFN_BRANCH();
+        // italian e.g, 'biaggi'
+        //obvious germanic
+        if ( starts_german() || is_at<"ET"_pat>( c+1 ) )
+        {
+            MTFN_BRANCH();
+            add( 'K' );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            //always soft if french ending
+            if ( is_at<"IER_"_pat>( c+1 ) )
+            {
+                MTFN_BRANCH();
+                add( 'J' );
+            }
+            else
+            {
+                MTFN_BRANCH();
+                add( 'J', 'K' );
+            }
+        }
+
+        c += 2;
+    }
+    else if ( at( c+1 ) == 'G')
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c += 1;
+    }
+}
+
+constexpr void rules::letter_combo_gh( void )
+{
+    int& c( m_cursor );
+
+    if ( c > 0 && !is_vowel( at( c-1 ) ) )
+    {
+        MTFN_BRANCH();
+        add( 'K' );
+        c += 2;
+    }
+    else if ( c == 0 )
+    {
+        MTFN_BRANCH();
+        if ( at( c+2 ) == 'I' )
+        {
+            MTFN_BRANCH();
+            add( 'J' );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( 'K' );
+        }
+        c += 2;
+    }
+    else if ( is_one_of<"BHD"_set>( at( c-2 ) ) || is_one_of<"BHD"_set>( at( c-3 ) ) ||
+         is_one_of<"BH"_set>( at( c-4 ) ) )
+    {
+        MTFN_BRANCH();
+        // Parker's rule (with some further refinements) - e.g., 'hugh'
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        //e.g., 'laugh', 'McLaughlin', 'cough', 'gough', 'rough', 'tough'
+        if ( c > 2  &&
+             at( c-1 ) == 'U' &&
+             is_one_of<"CGLRT"_set>( at( c-3 ) ) )
+        {
+            MTFN_BRANCH();
+            add( 'F' );
+        }
+        else if ( c > 0 && at( c-1 ) != 'I' )
+        {
+            MTFN_BRANCH();
+            add( 'K' );
+        }
+
+        c += 2;
+    }
+}
+
+constexpr void rules::letter_h( void )
+{
+    int& c( m_cursor );
+
+    if ( ( c == 0 || is_vowel( at( c-1 ) ) ) && is_vowel( at( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+	// keep any h that looks like '^h[aeiouy]' or '[aeiouy]h[aeiouy]'
+        add( 'H' );
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+}
+
+constexpr void rules::letter_j( void )
+{
+    int& c( m_cursor );
+
+    if ( is_at<"JOSE"_pat>( c ) || is_at<"SAN "_pat>( 0 ) )
+    {
+        MTFN_BRANCH();
+	// obvious spanish, 'jose', 'san jacinto'
+        if ( ( ( c == 0 && at( c+4 ) == ' ' ) ||
+	     m_last == 3 ) ||
+             is_at<"SAN "_pat>( 0 ) )
+        {
+            MTFN_BRANCH();
+            add( 'H' );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( 'J', 'H' );
+        }
+
+        c += 1;
+    }
+    else if ( c == 0 && !is_at<"JOSE"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( 'J', 'A' );
+    }
+    else if ( is_vowel( at( c-1 ) ) && !is_slavo_germanic() &&
+             is_one_of<"AO"_set>( at( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+        // spanish pron. of e.g. 'bajador'
+        add( 'J', 'H' );
+    }
+    else if ( c == m_last )
+    {
+        MTFN_BRANCH();
+        add( "J", "" );
+    }
+    else if ( !is_one_of<"LTKSNMBZ"_set>( at( c+1 ) ) &&
+              !is_one_of<"SKL"_set>( at( c-1 ) ) )
+    {
+        MTFN_BRANCH();
+        add( 'J' );
+    }
+
+    if ( at( c+1 ) == 'J' ) //it could happen!
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+}
+
+constexpr void rules::letter_k( void )
+{
+    int& c( m_cursor );
+
+    if ( at( c+1 ) == 'K' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+
+    add( 'K' );
+}
+
+constexpr void rules::letter_l( void )
+{
+    int& c( m_cursor );
+
+    if ( at( c+1 ) == 'L' )
+    {
+        MTFN_BRANCH();
+        //spanish e.g. 'cabrillo', 'gallegos'
+        if ( is_spanish_ll() )
+        {
+            MTFN_BRANCH();
+            add( "L", "" );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( 'L' );
+        }
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+        add( 'L' );
+    }
+}
+
+constexpr void rules::letter_m( void )
+{
+    int& c( m_cursor );
+
+    // 'dumb', 'thumb', 'dumber', 'dummy', but not 'thumbelina"
+    if ( ( is_at<"UMB"_pat>( c-1 ) &&
+         ( c+1 == m_last || is_at<"ER"_pat>( c+2 ) ) ) ||
+         at( c+1 ) == 'M' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+
+    add( 'M' );
+}
+
+constexpr void rules::letter_n( void )
+{
+    int& c( m_cursor );
+
+    // Double 'n' sounds like 'n'
+    if ( at( c+1 ) == 'N' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+
+    add( 'N' );
+}
+
+constexpr void rules::letter_n_tilde( void )
+{
+    int& c( m_cursor );
+
+    c+= 1;
+    add( 'N' );
+}
+
+constexpr void rules::letter_p( void )
+{
+    int& c( m_cursor );
+
+    // 'phyllis'
+    if ( at( c+1 ) == 'H' )
+    {
+        MTFN_BRANCH();
+        add( 'F' );
+        c += 2;
+        return;
+    }
+
+    if ( is_one_of<"PB"_set>( at( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+        // 'campbell', 'steppenwolf'
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        // 'peter'
+        c += 1;
+    }
+
+    add( 'P' );
+}
+
+constexpr void rules::letter_q( void )
+{
+    int& c( m_cursor );
+
+    if ( at( c+1 ) == 'Q' )
+    {
+        MTFN_BRANCH();
+        // 'sadiqqi'
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        // 'qadaffi'
+        c += 1;
+    }
+
+    add( 'K' );
+}
+
+constexpr void rules::letter_r( void )
+{
+    int& c( m_cursor );
+
+    if ( c == m_last &&
+         !is_slavo_germanic() &&
+         is_at<"IE"_pat>( c-2 ) &&
+         !is_one_of<"ME"_pat, "MA"_pat>( c-4 ) )
+    {
+        MTFN_BRANCH();
+        // french 'rogier' but not germanic or 'hochmeier'
+        add( "", "R" );
+    }
+    else
+    {
+        MTFN_BRANCH();
+        add( 'R' );
+    }
+
+    if ( at( c+1 ) == 'R' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+}
+
+constexpr void rules::letter_s( void )
+{
+    int& c( m_cursor );
+
+    if ( is_one_of<"ISL"_pat, "YSL"_pat>( c-1 ) )
+    {
+        MTFN_BRANCH();
+        // special cases 'island', 'isle', 'carlisle', 'carlysle'
+        c += 1;
+    }
+    else if ( c == 0 && is_at<"SUGAR"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        // special case 'sugar-'
+        add( 'X', 'S' );
+        c += 1;
+    }
+    else if ( is_at<"SH"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        if ( is_one_of<"HEIM"_pat, "HOEK"_pat, "HOLM"_pat, "HOLZ"_pat>( c+1 ) )
+        {
+            MTFN_BRANCH();
+            // 'rudesheim'
+            add( 'S' );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( 'X' );
+        }
+
+        c += 2;
+    }
+    else if ( is_one_of<"SIO"_pat, "SIA"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        // italian & armenian
+        if ( is_slavo_germanic() )
+        {
+            MTFN_BRANCH();
+            add( 'S' );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( 'S', 'X' );
+        }
+
+        c += 3;
+    }
+    else if ( ( c == 0 && is_one_of<"MNLW"_set>( at( c+1 ) ) ) || at( c+1 ) == 'Z' )
+    {
+        MTFN_BRANCH();
+        // german & anglicisations, e.g. 'smith' match 'schmidt',
+        // 'snider' match 'schneider'
+        // also, -sz- in slavic language altho in hungarian it is pronounced 's'
+        add( 'S', 'X' );
+        if ( at( c+1 ) == 'Z' )
+        {
+            MTFN_BRANCH();
+            c += 2;
+        }
+        else
+        {
+            MTFN_BRANCH();
+            c += 1;
+        }
+    }
+    else if ( is_at<"SC"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        if ( at( c+2 ) == 'H' )
+        {
+            MTFN_BRANCH();
+            // Schlesinger's rule
+            if ( is_one_of<"OO"_pat, "ER"_pat, "EN"_pat, "UY"_pat, "ED"_pat, "EM"_pat>( c+3 ) )
+            {
+                MTFN_BRANCH();
+                // dutch origin, e.g. 'school', 'schooner'
+                if ( is_one_of<"ER"_pat, "EN"_pat>( c+3 ) )
+                {
+                    MTFN_BRANCH();
+                    // 'schermerhorn', 'schenker'
+                    add( "X", "SK" );
+                }
+                else
+                {
+                    MTFN_BRANCH();
+                    add( "SK" );
+                }
+            }
+            else
+            {
+                MTFN_BRANCH();
+                if ( c == 0 && !is_vowel( at( c+3 ) ) && at( c+3 ) != 'W' )
+                {
+                    MTFN_BRANCH();
+                    add( 'X', 'S' );
+                }
+                else
+                {
+                    MTFN_BRANCH();
+                    add( 'X' );
+                }
+            }
+
+            c += 3;
+
+        }
+        else if ( is_one_of<"IEY"_set>( at( c+2 ) ) )
+        {
+            MTFN_BRANCH();
+            add( 'S' );
+            c += 3;
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( "SK" );
+            c += 3;
+        }
+    }
+    else if ( c == m_last && is_one_of<"AI"_pat, "OI"_pat>( c-2 ) )
+    {
+        MTFN_BRANCH();
+        // french e.g. 'resnais', 'artois'
+        add( "", "S" );
+        c += 1;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        add( 'S' );
+
+        if ( is_one_of<"SZ"_set>( at( c+1 ) ) )
+        {
+            MTFN_BRANCH();
+            c += 2;
+        }
+        else
+        {
+            MTFN_BRANCH();
+            c += 1;
+        }
+    }
+}
+
+constexpr void rules::letter_t( void )
+{
+    int& c( m_cursor );
+
+    if ( is_at<"TION"_pat>( c ) || is_one_of<"TIA"_pat, "TCH"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( 'X' );
+        c += 3;
+        return;
+    }
+
+    if ( is_at<"TH"_pat>( c ) || is_at<"TTH"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        if ( is_one_of<"OM"_pat, "AM"_pat>( c+2 ) || starts_german() )
+        {
+            MTFN_BRANCH();
+            // special case 'thomas', 'thames' or germanic
+            add( 'T' );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            add( '0', 'T' );
+        }
+
+        c += 2;
+        return;
+    }
+
+    if ( is_one_of<"TD"_set>( at( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+
+    add( 'T' );
+    return;
+}
+
+constexpr void rules::letter_v( void )
+{
+    int& c( m_cursor );
+
+    if ( at( c+1 ) == 'V' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+
+    add( 'F' );
+
+    return;
+}
+
+constexpr void rules::letter_w( void )
+{
+    int& c( m_cursor );
+
+    // can also be in middle of word
+    if ( is_at<"WR"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( 'R' );
+        c += 2;
+        return;
+    }
+
+    if ( c == 0 && ( is_vowel( at( c+1 ) ) || is_at<"WH"_pat>( c ) ) )
+    {
+        MTFN_BRANCH();
+        // 'wasserman' should match 'vasserman'
+        if ( is_vowel( at( c+1 ) ) )
+        {
+            MTFN_BRANCH();
+            add( "A", "F" );
+        }
+        else
+        {
+            MTFN_BRANCH();
+            // need Uomo to match Womo
+            add( 'A' );
+        }
+    }
+
+    // 'arnow' should match 'arnoff'
+    if ( ( c == m_last && is_vowel( at( c-1 ) ) ) ||
+         is_one_of<"EWSKI"_pat, "EWSKY"_pat, "OWSKI"_pat, "OWSKY"_pat>( c-1 ) ||
+         is_at<"SCH"_pat>( 0 ) )
+    {
+        MTFN_BRANCH();
+        add( "", "F" );
+        c += 1;
+        return;
+    }
+
+    // polish e.g. 'filipowicz'
+    if ( is_one_of<"WICZ"_pat, "WITZ"_pat>( c ) )
+    {
+        MTFN_BRANCH();
+        add( "TS", "FX" );
+        c += 4;
+        return;
+    }
+
+    // else skip it
+    c += 1;
+}
+
+constexpr void rules::letter_x( void )
+{
+    int& c( m_cursor );
+
+    if ( c == 0 )
+    {
+        MTFN_BRANCH();
+        // Initial 'X' is pronounced 'Z'
+        add( 'S' );
+    }
+    else if ( c != m_last || !( is_one_of<"IAU"_pat, "EAU"_pat>( c-3 ) ||
+         is_one_of<"AU"_pat, "OU"_pat>( c-2 ) ) )
+    {
+        MTFN_BRANCH();
+        // exclude french trailing 'x' e.g. 'breaux'
+        add( "KS" );
+    }
+
+    if ( is_one_of<"CX"_set>( at( c+1 ) ) )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+}
+
+constexpr void rules::letter_z( void )
+{
+    int& c( m_cursor );
+
+    if ( at( c+1 ) == 'H' )
+    {
+        MTFN_BRANCH();
+        // chinese pinyin e.g. 'zhao'
+        add( 'J' );
+        c += 2;
+        return;
+    }
+
+    if ( is_one_of<"ZO"_pat, "ZI"_pat, "ZA"_pat>( c+1 ) ||
+              ( is_slavo_germanic() && c > 0 && at( c-1 ) != 'T' ) )
+    {
+        MTFN_BRANCH();
+        add( "S", "TS" );
+    }
+    else
+    {
+        MTFN_BRANCH();
+        add( 'S' );
+    }
+
+    if ( at( c+1 ) == 'Z' )
+    {
+        MTFN_BRANCH();
+        c += 2;
+    }
+    else
+    {
+        MTFN_BRANCH();
+        c += 1;
+    }
+}
+
+constexpr sound_key encode( std::string_view name )
+{
+    if ( name.size() > (size_t)encoder::inline_len )
+    {
+        return encode_long( name );
+    }
+
+    char normal[encoder::inline_len] = {};
+    char primary[stop_len] = {};
+    char alternate[stop_len] = {};
+    rules r;
+
+    r.run( normal, rules::normalize( name.data(), name.size(), normal ),
+        primary, alternate );
+
+    return r.key();
+}
+
+constexpr sound_key encode_utf8( std::string_view name )
+{
+    if ( name.size() > (size_t)encoder::inline_len )
+    {
+        return encode_long_utf8( name );
+    }
+
+    char normal[encoder::inline_len] = {};
+    char primary[stop_len] = {};
+    char alternate[stop_len] = {};
+    rules r;
+
+    r.run( normal, rules::normalize_utf8( name.data(), name.size(), normal ),
+        primary, alternate );
+
+    return r.key();
+}
+
+}; // namespace mtfn
+
+#endif
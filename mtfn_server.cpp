@@ -0,0 +1,561 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "mtfn_server.h"
+#include "mtfn_parallel.h"
+
+using namespace std;
+using namespace mtfn;
+
+// What each epoll event is for; connections are numbered after these
+const uint64_t listen_event = 0;
+const uint64_t timer_event = 1;
+const uint64_t wake_event = 2;
+
+// A connection with this many bytes of answers still to send, or this many
+// requests with the workers, isn't read from until they go down again
+const size_t out_high_water = 1 << 20;
+const size_t pending_high_water = 4096;
+
+const uint32_t reading = EPOLLIN | EPOLLRDHUP;
+
+static bool watch( int epoll_fd, int op, int fd, uint32_t events, uint64_t id )
+{
+    epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = id;
+    return epoll_ctl( epoll_fd, op, fd, &ev ) == 0;
+}
+
+static void set_timer( int timer_fd, int us )
+{
+    itimerspec when;
+    memset( &when, 0, sizeof( when ) );
+    when.it_value.tv_sec = us / 1000000;
+    when.it_value.tv_nsec = ( us % 1000000 ) * 1000;
+    timerfd_settime( timer_fd, 0, &when, NULL );
+}
+
+lookup_server::lookup_server( const mapped_index& index, int threads,
+    int window_us, size_t batch_len )
+: m_index( index ),
+  m_threads( thread_count( threads ) ),
+  m_window_us( window_us > 0 ? window_us : 1 ),
+  m_batch_len( batch_len > 0 ? batch_len : 1 ),
+  m_listen_fd( -1 ),
+  m_epoll_fd( -1 ),
+  m_timer_fd( -1 ),
+  m_wake_fd( -1 ),
+  m_stopping( false ),
+  m_next_connection( wake_event + 1 ),
+  m_in_flight( 0 )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.records = index.size();
+}
+
+lookup_server::~lookup_server()
+{
+    for ( auto& c : m_connections )
+    {
+        ::close( c.second.fd );
+    }
+    for ( int fd : { m_listen_fd, m_epoll_fd, m_timer_fd, m_wake_fd } )
+    {
+        if ( fd >= 0 )
+        {
+            ::close( fd );
+        }
+    }
+}
+
+bool lookup_server::listen( const char* path )
+{
+    sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    if ( strlen( path ) >= sizeof( addr.sun_path ) )
+    {
+        return false;
+    }
+    strcpy( addr.sun_path, path );
+
+    m_listen_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        0 );
+    m_epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    m_timer_fd = timerfd_create( CLOCK_MONOTONIC,
+        TFD_NONBLOCK | TFD_CLOEXEC );
+    m_wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( m_listen_fd < 0 || m_epoll_fd < 0 || m_timer_fd < 0 ||
+         m_wake_fd < 0 )
+    {
+        return false;
+    }
+
+    unlink( path );
+    return bind( m_listen_fd, (sockaddr*)&addr, sizeof( addr ) ) == 0 &&
+        ::listen( m_listen_fd, SOMAXCONN ) == 0 &&
+        watch( m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, EPOLLIN,
+            listen_event ) &&
+        watch( m_epoll_fd, EPOLL_CTL_ADD, m_timer_fd, EPOLLIN,
+            timer_event ) &&
+        watch( m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, EPOLLIN, wake_event );
+}
+
+bool lookup_server::run( void )
+{
+    for ( int t = 0; t < m_threads; t++ )
+    {
+        m_workers.push_back( thread( [this] { work(); } ) );
+    }
+
+    bool worked = true;
+    epoll_event events[64];
+    while ( !m_stopping.load() )
+    {
+        int n = epoll_wait( m_epoll_fd, events, 64, -1 );
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            worked = false;
+            break;
+        }
+
+        for ( int e = 0; e < n; e++ )
+        {
+            uint64_t id = events[e].data.u64;
+            uint64_t count;
+            if ( id == listen_event )
+            {
+                accept_all();
+            }
+            else if ( id == timer_event )
+            {
+                if ( read( m_timer_fd, &count, sizeof( count ) ) > 0 )
+                {
+                    flush();
+                }
+            }
+            else if ( id == wake_event )
+            {
+                if ( read( m_wake_fd, &count, sizeof( count ) ) > 0 )
+                {
+                    deliver();
+                }
+            }
+            else
+            {
+                // Answers can't be sent once the client has gone altogether
+                if ( events[e].events & ( EPOLLHUP | EPOLLERR ) )
+                {
+                    close_connection( id );
+                    continue;
+                }
+                if ( events[e].events & EPOLLOUT )
+                {
+                    write_to( id );
+                }
+                if ( events[e].events & reading )
+                {
+                    read_from( id );
+                }
+            }
+        }
+
+        if ( !m_pending.empty() && m_in_flight < m_threads )
+        {
+            flush();
+        }
+    }
+
+    {
+        lock_guard<mutex> hold( m_lock );
+        m_stopping = true;
+    }
+    m_ready.notify_all();
+    for ( thread& t : m_workers )
+    {
+        t.join();
+    }
+    m_workers.clear();
+
+    return worked;
+}
+
+void lookup_server::stop( void )
+{
+    // Only what is safe in a signal handler
+    uint64_t one = 1;
+    m_stopping = true;
+    if ( write( m_wake_fd, &one, sizeof( one ) ) < 0 )
+    {
+        return;
+    }
+}
+
+server_stats lookup_server::stats( void ) const
+{
+    lock_guard<mutex> hold( m_stats_lock );
+    server_stats stats( m_stats );
+    stats.p50_ns = m_latency.percentile( 0.5 );
+    stats.p99_ns = m_latency.percentile( 0.99 );
+    stats.max_ns = m_latency.max();
+    return stats;
+}
+
+void lookup_server::accept_all( void )
+{
+    for ( ;; )
+    {
+        int fd = accept4( m_listen_fd, NULL, NULL,
+            SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( fd < 0 )
+        {
+            return;
+        }
+
+        uint64_t id = m_next_connection++;
+        if ( !watch( m_epoll_fd, EPOLL_CTL_ADD, fd, reading, id ) )
+        {
+            ::close( fd );
+            continue;
+        }
+        m_connections[id] = connection{ fd, string(), string(), 0, reading, 0,
+            false };
+
+        lock_guard<mutex> hold( m_stats_lock );
+        m_stats.connections++;
+    }
+}
+
+void lookup_server::read_from( uint64_t id )
+{
+    auto found = m_connections.find( id );
+    if ( found == m_connections.end() )
+    {
+        return;
+    }
+    connection& c( found->second );
+
+    // A buffer at a time, queueing every whole request in it, until there
+    // is nothing left to read or the answers have piled up
+    char buf[65536];
+    while ( !c.finished && c.out.size() - c.written < out_high_water &&
+            c.pending < pending_high_water )
+    {
+        ssize_t got = read( c.fd, buf, sizeof( buf ) );
+        if ( got < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            break;
+        }
+        if ( got < 0 && errno != EINTR )
+        {
+            close_connection( id );
+            return;
+        }
+        c.finished = got == 0;
+        c.in.append( buf, got > 0 ? got : 0 );
+
+        size_t at = 0;
+        while ( c.in.size() - at >= sizeof( lookup_request ) )
+        {
+            lookup_request request;
+            memcpy( &request, c.in.data() + at, sizeof( request ) );
+            if ( request.len > lookup_max_len )
+            {
+                close_connection( id );
+                return;
+            }
+            if ( c.in.size() - at < sizeof( request ) + request.len )
+            {
+                break;
+            }
+
+            queue( id, request, c.in.data() + at + sizeof( request ) );
+            at += sizeof( request ) + request.len;
+        }
+        c.in.erase( 0, at );
+    }
+
+    write_to( id );
+}
+
+void lookup_server::write_to( uint64_t id )
+{
+    auto found = m_connections.find( id );
+    if ( found == m_connections.end() )
+    {
+        return;
+    }
+    connection& c( found->second );
+
+    while ( c.written < c.out.size() )
+    {
+        ssize_t sent = send( c.fd, c.out.data() + c.written,
+            c.out.size() - c.written, MSG_NOSIGNAL );
+        if ( sent < 0 )
+        {
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+            {
+                close_connection( id );
+                return;
+            }
+            break;
+        }
+        c.written += sent;
+    }
+
+    if ( c.written == c.out.size() )
+    {
+        c.out.clear();
+        c.written = 0;
+    }
+    settle( id, c );
+}
+
+// Closes a connection once the client has sent all it will and had all its
+// answers, and otherwise waits for whatever it can do next: reading while
+// the answers aren't piling up, and writing while some are left to send
+void lookup_server::settle( uint64_t id, connection& c )
+{
+    size_t unsent = c.out.size() - c.written;
+    if ( c.finished && c.pending == 0 && unsent == 0 )
+    {
+        close_connection( id );
+        return;
+    }
+
+    bool paused = c.finished || unsent >= out_high_water ||
+        c.pending >= pending_high_water;
+    uint32_t events = ( paused ? 0 : reading ) | ( unsent > 0 ? EPOLLOUT : 0 );
+    if ( events != c.events )
+    {
+        c.events = events;
+        watch( m_epoll_fd, EPOLL_CTL_MOD, c.fd, events, id );
+    }
+}
+
+void lookup_server::close_connection( uint64_t id )
+{
+    auto found = m_connections.find( id );
+    if ( found != m_connections.end() )
+    {
+        ::close( found->second.fd );
+        m_connections.erase( found );
+    }
+}
+
+// Stats are answered straight away, everything else goes in the batch
+void lookup_server::queue( uint64_t id, const lookup_request& request,
+    const char* body )
+{
+    if ( request.op == lookup_stats )
+    {
+        server_stats stats( this->stats() );
+        lookup_response response{ sizeof( stats ), request.id, lookup_ok,
+            { 0, 0, 0 } };
+
+        connection& c( m_connections[id] );
+        c.out.append( (const char*)&response, sizeof( response ) );
+        c.out.append( (const char*)&stats, sizeof( stats ) );
+        return;
+    }
+
+    if ( m_pending.empty() )
+    {
+        set_timer( m_timer_fd, m_window_us );
+    }
+    m_pending.push_back( job{ id, request, string( body, request.len ),
+        string(), clock::now() } );
+    m_connections[id].pending++;
+
+    if ( m_pending.size() >= m_batch_len )
+    {
+        flush();
+    }
+}
+
+void lookup_server::flush( void )
+{
+    set_timer( m_timer_fd, 0 );
+    if ( m_pending.empty() )
+    {
+        return;
+    }
+
+    {
+        lock_guard<mutex> hold( m_lock );
+        m_todo.push_back( batch() );
+        m_todo.back().swap( m_pending );
+    }
+    m_ready.notify_one();
+    m_in_flight++;
+
+    lock_guard<mutex> hold( m_stats_lock );
+    m_stats.batches++;
+}
+
+// Writes out the answers of every batch the workers have finished
+void lookup_server::deliver( void )
+{
+    vector<batch> done;
+    {
+        lock_guard<mutex> hold( m_lock );
+        done.swap( m_done );
+    }
+    m_in_flight -= done.size();
+
+    clock::time_point now = clock::now();
+    vector<uint64_t> touched;
+    {
+        lock_guard<mutex> hold( m_stats_lock );
+        for ( batch& b : done )
+        {
+            for ( job& j : b )
+            {
+                m_stats.requests++;
+                m_latency.add( chrono::duration_cast<chrono::nanoseconds>(
+                    now - j.arrived ).count() );
+
+                auto found = m_connections.find( j.connection );
+                if ( found != m_connections.end() )
+                {
+                    found->second.out.append( j.response );
+                    found->second.pending--;
+                    touched.push_back( j.connection );
+                }
+            }
+        }
+    }
+
+    sort( touched.begin(), touched.end() );
+    touched.erase( unique( touched.begin(), touched.end() ), touched.end() );
+    for ( uint64_t id : touched )
+    {
+        write_to( id );
+    }
+}
+
+void lookup_server::work( void )
+{
+    encoder enc;
+    for ( ;; )
+    {
+        batch b;
+        {
+            unique_lock<mutex> hold( m_lock );
+            m_ready.wait( hold,
+                [this] { return m_stopping.load() || !m_todo.empty(); } );
+            if ( m_stopping.load() )
+            {
+                return;
+            }
+            b.swap( m_todo.front() );
+            m_todo.pop_front();
+        }
+
+        for ( job& j : b )
+        {
+            answer( enc, j );
+        }
+
+        {
+            lock_guard<mutex> hold( m_lock );
+            m_done.push_back( batch() );
+            m_done.back().swap( b );
+        }
+        uint64_t one = 1;
+        if ( write( m_wake_fd, &one, sizeof( one ) ) < 0 )
+        {
+            return;
+        }
+    }
+}
+
+void lookup_server::answer( encoder& enc, job& j ) const
+{
+    lookup_response response{ 0, j.request.id, lookup_ok, { 0, 0, 0 } };
+    string body;
+
+    if ( j.request.op == lookup_encode || j.request.op == lookup_find )
+    {
+        if ( j.request.flags & lookup_utf8 )
+        {
+            enc.encode_utf8( j.body );
+        }
+        else
+        {
+            enc.encode( j.body );
+        }
+        sound_key key( enc.key() );
+
+        if ( j.request.op == lookup_encode )
+        {
+            char wire[lookup_key_len];
+            put_key( key, wire );
+            body.assign( wire, sizeof( wire ) );
+        }
+        else
+        {
+            vector<mapped_index::record_id> matches;
+            m_index.find( key, matches );
+            for ( mapped_index::record_id match : matches )
+            {
+                uint32_t record = match;
+                body.append( (const char*)&record, sizeof( record ) );
+            }
+        }
+    }
+    else if ( j.request.op == lookup_name )
+    {
+        uint32_t record;
+        if ( j.body.size() != sizeof( record ) )
+        {
+            response.status = lookup_bad_request;
+        }
+        else
+        {
+            memcpy( &record, j.body.data(), sizeof( record ) );
+            if ( record < m_index.size() )
+            {
+                body = m_index.name( record );
+            }
+            else
+            {
+                response.status = lookup_not_found;
+            }
+        }
+    }
+    else
+    {
+        response.status = lookup_bad_request;
+    }
+
+    response.len = body.size();
+    j.response.assign( (const char*)&response, sizeof( response ) );
+    j.response.append( body );
+}
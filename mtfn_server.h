@@ -0,0 +1,140 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * lookup_server - serves encodes and searches of one mapped_index to any
+ * number of processes over a Unix domain socket, which is what mtfnd runs.
+ */
+
+#ifndef __MTFN_SERVER_H__
+#define __MTFN_SERVER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "mtfn.h"
+#include "mtfn_index.h"
+#include "mtfn_protocol.h"
+#include "mtfn_metrics.h"
+
+namespace mtfn
+{
+
+// One thread waits on every connection with epoll and reads whole
+// requests off them. The requests read in one pass over the connections
+// go to a worker thread straight away if one is free. Otherwise requests
+// from all the connections are collected into a batch until batch_len of
+// them have come in, or window_us microseconds have passed since the
+// first, and the batch goes to the next free worker. Each worker runs a
+// whole batch through one encoder, and the answers go back to the epoll
+// thread to be written out. A client that stops reading its answers stops
+// having its requests read until they have gone out, and one that shuts
+// down its end of the socket still gets the answers to what it sent.
+class lookup_server
+{
+public:
+    // threads workers, one per core if 0. The index has to stay open for
+    // as long as the server runs.
+    lookup_server( const mapped_index& index, int threads = 0,
+        int window_us = 100, size_t batch_len = 256 );
+    ~lookup_server();
+
+    // Listens on a socket at path, replacing any socket already there.
+    // Returns false if it can't.
+    bool listen( const char* path );
+
+    // Serves requests until stop() is called. Returns false if waiting on
+    // the connections fails.
+    bool run( void );
+
+    // Makes run() return. It can be called from any thread, or from a
+    // signal handler.
+    void stop( void );
+
+    server_stats stats( void ) const;
+
+private:
+    lookup_server( const lookup_server& );
+    const lookup_server& operator =( const lookup_server& );
+
+    typedef std::chrono::steady_clock clock;
+
+    struct job
+    {
+        uint64_t connection;
+        lookup_request request;
+        std::string body;
+        std::string response;   // header and body
+        clock::time_point arrived;
+    };
+
+    typedef std::vector<job> batch;
+
+    struct connection
+    {
+        int fd;
+        std::string in;
+        std::string out;
+        size_t written;
+        uint32_t events;        // being waited for
+        size_t pending;         // requests with the workers
+        bool finished;          // the client has sent all it will
+    };
+
+    void accept_all( void );
+    void read_from( uint64_t id );
+    void write_to( uint64_t id );
+    void close_connection( uint64_t id );
+    void settle( uint64_t id, connection& c );
+    void queue( uint64_t id, const lookup_request& request, const char* body );
+    void flush( void );
+    void deliver( void );
+    void work( void );
+    void answer( encoder& enc, job& j ) const;
+
+    const mapped_index& m_index;
+    int m_threads;
+    int m_window_us;
+    size_t m_batch_len;
+
+    int m_listen_fd;
+    int m_epoll_fd;
+    int m_timer_fd;
+    int m_wake_fd;              // workers finishing a batch, or stop()
+    std::atomic<bool> m_stopping;
+
+    std::unordered_map<uint64_t, connection> m_connections;
+    uint64_t m_next_connection;
+    batch m_pending;
+    int m_in_flight;            // batches handed to the workers
+
+    std::mutex m_lock;
+    std::condition_variable m_ready;
+    std::deque<batch> m_todo;
+    std::vector<batch> m_done;
+    std::vector<std::thread> m_workers;
+
+    mutable std::mutex m_stats_lock;
+    server_stats m_stats;
+    histogram m_latency;          // ns
+};
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,212 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <algorithm>
+#include "mtfn_sort.h"
+#include "mtfn_parallel.h"
+
+using namespace std;
+using namespace mtfn;
+
+typedef sorted_keys::entry entry;
+
+sorted_keys::sorted_keys( const vector<string_view>& names, int threads )
+: m_rows( names.size() ),
+  m_threads( thread_count( threads ) )
+{
+    vector<sound_key> keys( names.size() );
+    parallel_for( m_threads, names.size(),
+        [&]( int, size_t begin, size_t end ) {
+            encoder enc;
+            for ( size_t i = begin; i < end; i++ )
+            {
+                enc.encode( names[i] );
+                keys[i] = enc.key();
+            }
+        } );
+
+    sort( keys );
+}
+
+sorted_keys::sorted_keys( const vector<sound_key>& keys, int threads )
+: m_rows( keys.size() ),
+  m_threads( thread_count( threads ) )
+{
+    sort( keys );
+}
+
+void sorted_keys::sort( const vector<sound_key>& keys )
+{
+    // Each thread's share of the rows starts where the entries of the
+    // shares before it end
+    vector<size_t> starts( m_threads + 1, 0 );
+    parallel_for( m_threads, keys.size(),
+        [&]( int t, size_t begin, size_t end ) {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                starts[t + 1] += 1 + ( keys[i].alternate != keys[i].primary );
+            }
+        } );
+    for ( int t = 0; t < m_threads; t++ )
+    {
+        starts[t + 1] += starts[t];
+    }
+
+    m_entries.resize( starts[m_threads] );
+    parallel_for( m_threads, keys.size(),
+        [&]( int t, size_t begin, size_t end ) {
+            entry* e = m_entries.data() + starts[t];
+            for ( size_t i = begin; i < end; i++ )
+            {
+                *e++ = entry{ i, keys[i], keys[i].primary };
+                if ( keys[i].alternate != keys[i].primary )
+                {
+                    *e++ = entry{ i, keys[i], keys[i].alternate };
+                }
+            }
+        } );
+
+    // Each pass counts the bytes in every thread's share, so that each
+    // thread knows where its entries for every byte go, and then moves them
+    // there in order
+    vector<entry> moved( m_entries.size() );
+    vector<size_t> counts( m_threads * 256 );
+    for ( int shift = 0; shift < 16; shift += 8 )
+    {
+        fill( counts.begin(), counts.end(), 0 );
+        parallel_for( m_threads, m_entries.size(),
+            [&]( int t, size_t begin, size_t end ) {
+                size_t* count = counts.data() + t * 256;
+                for ( size_t i = begin; i < end; i++ )
+                {
+                    count[( m_entries[i].code >> shift ) & 0xFF]++;
+                }
+            } );
+
+        // Nothing to do when every entry has the same byte
+        size_t at = 0, same = 0;
+        for ( int b = 0; b < 256; b++ )
+        {
+            size_t before = at;
+            for ( int t = 0; t < m_threads; t++ )
+            {
+                size_t n = counts[t * 256 + b];
+                counts[t * 256 + b] = at;
+                at += n;
+            }
+            same = max( same, at - before );
+        }
+        if ( same == m_entries.size() )
+        {
+            continue;
+        }
+
+        parallel_for( m_threads, m_entries.size(),
+            [&]( int t, size_t begin, size_t end ) {
+                size_t* next = counts.data() + t * 256;
+                for ( size_t i = begin; i < end; i++ )
+                {
+                    moved[next[( m_entries[i].code >> shift ) & 0xFF]++] =
+                        m_entries[i];
+                }
+            } );
+        m_entries.swap( moved );
+    }
+}
+
+void sorted_keys::group_by( vector<group>& groups ) const
+{
+    for ( size_t begin = 0, end; begin < m_entries.size(); begin = end )
+    {
+        uint16_t code = m_entries[begin].code;
+        for ( end = begin + 1;
+              end < m_entries.size() && m_entries[end].code == code;
+              end++ )
+        {
+        }
+        groups.push_back( group{ code, begin, end } );
+    }
+}
+
+static bool code_less( const entry& e, uint32_t code )
+{
+    return e.code < code;
+}
+
+void mtfn::merge_join( const sorted_keys& lhs, const sorted_keys& rhs,
+    vector<join_pair>& pairs )
+{
+    // Each thread merges the codes from the one its share of lhs starts
+    // with up to the one the next share starts with
+    int threads = lhs.threads();
+    const vector<entry>& l( lhs.entries() );
+    const vector<entry>& r( rhs.entries() );
+
+    vector<uint32_t> first_code( threads + 1, 0x10000 );
+    for ( int t = 0; t < threads; t++ )
+    {
+        size_t i = l.size() * t / threads;
+        first_code[t] = t == 0 ? 0 : i < l.size() ? l[i].code : 0x10000;
+    }
+
+    vector<vector<join_pair> > found( threads );
+    parallel_for( threads, threads, [&]( int, size_t t, size_t ) {
+        auto li = lower_bound( l.begin(), l.end(), first_code[t], code_less );
+        auto l_end = lower_bound( li, l.end(), first_code[t + 1], code_less );
+        auto ri = lower_bound( r.begin(), r.end(), first_code[t], code_less );
+
+        while ( li != l_end && ri != r.end() )
+        {
+            if ( li->code < ri->code )
+            {
+                li++;
+                continue;
+            }
+            if ( ri->code < li->code )
+            {
+                ri++;
+                continue;
+            }
+
+            uint16_t code = li->code;
+            auto l_next = li, r_next = ri;
+            while ( l_next != l_end && l_next->code == code )
+            {
+                l_next++;
+            }
+            while ( r_next != r.end() && r_next->code == code )
+            {
+                r_next++;
+            }
+
+            for ( ; li != l_next; li++ )
+            {
+                for ( auto e = ri; e != r_next; e++ )
+                {
+                    if ( first_shared( li->key, e->key ) == code )
+                    {
+                        found[t].push_back( join_pair{ li->row, e->row } );
+                    }
+                }
+            }
+            ri = r_next;
+        }
+    } );
+
+    for ( const vector<join_pair>& f : found )
+    {
+        pairs.insert( pairs.end(), f.begin(), f.end() );
+    }
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * class sorted_keys - a column of names as keys sorted by code, for
+ * grouping and for joining two columns by merging them.
+ */
+
+#ifndef __MTFN_SORT_H__
+#define __MTFN_SORT_H__
+
+#include <string_view>
+#include <vector>
+#include "mtfn.h"
+#include "mtfn_join.h"
+
+namespace mtfn
+{
+
+// Each row is entered under its primary code, and under its alternate
+// code if it has a different one, and the entries are sorted by code with
+// a radix sort of the 16 bit codes, a byte at a time from the lowest, on
+// several threads. The sort is stable, so the entries for each code are
+// in order of row and the same column always sorts the same way.
+class sorted_keys
+{
+public:
+    struct entry
+    {
+        size_t row;
+        sound_key key;
+        uint16_t code;
+    };
+
+    // A run of entries with the same code, [begin, end)
+    struct group
+    {
+        uint16_t code;
+        size_t begin;
+        size_t end;
+    };
+
+    // names coded as for encoder, encoded on threads threads (one per core
+    // if threads is 0), which also sort them
+    sorted_keys( const std::vector<std::string_view>& names, int threads = 0 );
+    sorted_keys( const std::vector<sound_key>& keys, int threads = 0 );
+
+    // Number of rows, and of entries
+    size_t rows( void ) const { return m_rows; };
+    size_t size( void ) const { return m_entries.size(); };
+
+    const entry& operator []( size_t i ) const { return m_entries[i]; };
+    const std::vector<entry>& entries( void ) const { return m_entries; };
+
+    // Appends the runs of entries that share a code, in order of code. A
+    // row with an alternate code is in the groups of both its codes.
+    void group_by( std::vector<group>& groups ) const;
+
+    int threads( void ) const { return m_threads; };
+
+private:
+    void sort( const std::vector<sound_key>& keys );
+
+    std::vector<entry> m_entries;
+    size_t m_rows;
+    int m_threads;
+};
+
+// Appends a join_pair of rows for every lhs row that sounds like an rhs
+// row, the same pairs as join_keys() but always in the same order: by the
+// least code they share, then lhs row, then rhs row. The codes are split
+// between the threads of lhs.
+void merge_join( const sorted_keys& lhs, const sorted_keys& rhs,
+    std::vector<join_pair>& pairs );
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,216 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "mtfn_stream.h"
+#include "mtfn_input.h"
+
+using namespace std;
+using namespace mtfn;
+
+struct block
+{
+    const char* begin;
+    const char* end;
+    string out;
+    size_t names;
+    bool done;
+};
+
+// Shared by the threads encoding blocks and the one writing them out. At
+// most slots blocks are in flight, so memory use doesn't grow with the
+// size of the input.
+class block_queue
+{
+public:
+    block_queue( const char* begin, const char* end, size_t block_len,
+        int slots )
+    : m_next( begin ), m_end( end ), m_block_len( block_len ),
+      m_blocks( slots ), m_assigned( 0 ), m_written( 0 )
+    {};
+
+    // Hands out the next block to encode, or NULL when there are none left
+    block* take( void )
+    {
+        unique_lock<mutex> lock( m_mutex );
+        m_room.wait( lock, [this] {
+            return m_next == m_end ||
+                m_assigned < m_written + m_blocks.size(); } );
+
+        if ( m_next == m_end )
+        {
+            return NULL;
+        }
+
+        block& b( m_blocks[m_assigned % m_blocks.size()] );
+        b.begin = m_next;
+        b.end = m_end;
+        if ( (size_t)( m_end - m_next ) > m_block_len )
+        {
+            const char* nl = (const char*)memchr( m_next + m_block_len, '\n',
+                m_end - m_next - m_block_len );
+            if ( nl != NULL )
+            {
+                b.end = nl + 1;
+            }
+        }
+        b.out.clear();
+        b.names = 0;
+        b.done = false;
+
+        m_next = b.end;
+        m_assigned++;
+        return &b;
+    };
+
+    void finish( block* b )
+    {
+        lock_guard<mutex> lock( m_mutex );
+        b->done = true;
+        m_ready.notify_all();
+    };
+
+    // The next block in input order once it is encoded, or NULL at the end
+    block* next_done( void )
+    {
+        unique_lock<mutex> lock( m_mutex );
+        m_ready.wait( lock, [this] {
+            return m_written < m_assigned ?
+                m_blocks[m_written % m_blocks.size()].done : m_next == m_end;
+        } );
+
+        if ( m_written == m_assigned )
+        {
+            return NULL;
+        }
+
+        return &m_blocks[m_written % m_blocks.size()];
+    };
+
+    void written( void )
+    {
+        lock_guard<mutex> lock( m_mutex );
+        m_written++;
+        m_room.notify_all();
+    };
+
+private:
+    mutex m_mutex;
+    condition_variable m_room;
+    condition_variable m_ready;
+
+    const char* m_next;
+    const char* m_end;
+    size_t m_block_len;
+
+    vector<block> m_blocks;
+    size_t m_assigned;
+    size_t m_written;
+};
+
+static void encode_block( encoder& enc, block& b )
+{
+    const char* line = b.begin;
+
+    b.out.reserve( 2 * ( b.end - b.begin ) );
+    while ( line < b.end )
+    {
+        const char* nl = (const char*)memchr( line, '\n', b.end - line );
+        const char* eol = nl == NULL ? b.end : nl;
+
+        enc.encode( line, eol - line );
+
+        b.out.append( line, eol - line );
+        b.out += ',';
+        b.out.append( enc.primary() );
+        if ( enc.has_alternate() )
+        {
+            b.out += '/';
+            b.out.append( enc.alternate() );
+        }
+        b.out += '\n';
+        b.names++;
+
+        line = eol + 1;
+    }
+}
+
+static void worker( block_queue* queue )
+{
+    encoder enc;
+    block* b;
+
+    while ( ( b = queue->take() ) != NULL )
+    {
+        encode_block( enc, *b );
+        queue->finish( b );
+    }
+}
+
+bool mtfn::encode_file( const char* filename, FILE* out, int threads,
+    stream_stats& stats, size_t block_len )
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    input_file input;
+    if ( !input.open( filename ) )
+    {
+        return false;
+    }
+
+    if ( threads <= 0 )
+    {
+        threads = thread::hardware_concurrency();
+        threads = threads > 0 ? threads : 1;
+    }
+
+    block_queue queue( input.begin(), input.end(), block_len, 2 * threads );
+    vector<thread> pool;
+    for ( int i = 0; i < threads; i++ )
+    {
+        pool.push_back( thread( worker, &queue ) );
+    }
+
+    bool worked = true;
+    stats.names = 0;
+    block* b;
+    while ( ( b = queue.next_done() ) != NULL )
+    {
+        worked = worked &&
+            fwrite( b->out.data(), 1, b->out.size(), out ) == b->out.size();
+        stats.names += b->names;
+        queue.written();
+    }
+
+    for ( size_t i = 0; i < pool.size(); i++ )
+    {
+        pool[i].join();
+    }
+
+    worked = fflush( out ) == 0 && worked;
+
+    stats.bytes = input.end() - input.begin();
+    stats.threads = threads;
+    stats.seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start ).count();
+
+    return worked;
+}
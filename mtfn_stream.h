@@ -0,0 +1,47 @@
+/* Copyright (c) 2015 Michael Hamilton.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with teh License.
+ * You may obtain a copy of the License at
+ *
+ *          http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ *
+ * encode_file() - encodes a file of names, one per line, on several
+ * threads, for files far too big to go through sound one name at a time.
+ */
+
+#ifndef __MTFN_STREAM_H__
+#define __MTFN_STREAM_H__
+
+#include <cstdio>
+#include "mtfn.h"
+
+namespace mtfn
+{
+
+struct stream_stats
+{
+    size_t names;
+    size_t bytes;
+    double seconds;
+    int threads;
+};
+
+// Writes "name,primary" or "name,primary/alternate" to out for every line
+// of the file, in the order of the file, which is what the mtfn binary
+// writes for it. The file is memory mapped (or read in whole if it can't
+// be), cut into blocks of about block_len bytes at line ends, and the
+// blocks are encoded by threads threads, or one per core if threads is 0.
+// Returns false if the file can't be read or out can't be written.
+bool encode_file( const char* filename, FILE* out, int threads,
+    stream_stats& stats, size_t block_len = 1 << 20 );
+
+}; // namespace mtfn
+
+#endif
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include "mtfn.h"
+#include "mtfn_index.h"
+#include "mtfn_server.h"
+
+using namespace std;
+using namespace mtfn;
+
+#define error cerr << __FILE__ << ':' << __LINE__ << ' '
+
+static lookup_server* running = NULL;
+
+static void stop( int )
+{
+    if ( running != NULL )
+    {
+        running->stop();
+    }
+}
+
+// Serves an index file built by mtfn_mkindex on a Unix domain socket until
+// it is interrupted, then reports how long the requests took
+int main ( int argc, char** argv )
+{
+    int threads = 0;
+    int window_us = 100;
+    int arg = 1;
+
+    for ( ; arg + 1 < argc && argv[arg][0] == '-'; arg += 2 )
+    {
+        if ( string( argv[arg] ) == "-j" )
+        {
+            threads = atoi( argv[arg + 1] );
+        }
+        else if ( string( argv[arg] ) == "-w" )
+        {
+            window_us = atoi( argv[arg + 1] );
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if ( arg + 2 != argc )
+    {
+        error << "USAGE: mtfnd [-j threads] [-w window_us] <index> <socket>"
+              << endl;
+        return 1;
+    }
+
+    mapped_index index;
+    if ( !index.open( argv[arg] ) )
+    {
+        error << "can't map " << argv[arg] << endl;
+        return 1;
+    }
+
+    lookup_server server( index, threads, window_us );
+    if ( !server.listen( argv[arg + 1] ) )
+    {
+        error << "can't listen on " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    running = &server;
+    signal( SIGINT, stop );
+    signal( SIGTERM, stop );
+    signal( SIGPIPE, SIG_IGN );
+
+    bool worked = server.run();
+    unlink( argv[arg + 1] );
+
+    server_stats stats( server.stats() );
+    cerr << stats.requests << " requests in " << stats.batches
+         << " batches from " << stats.connections << " connections: p50 "
+         << stats.p50_ns / 1e3 << "us, p99 " << stats.p99_ns / 1e3
+         << "us, max " << stats.max_ns / 1e3 << "us" << endl;
+
+    if ( !worked )
+    {
+        error << "can't wait on connections" << endl;
+        return 1;
+    }
+    return 0;
+}
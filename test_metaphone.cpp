@@ -1,24 +1,215 @@
 #include <iostream>
+#include <cstdlib>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <iomanip>
+#include <random>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "mtfn.h"
+#include "mtfn_index.h"
+#include "mtfn_bulk.h"
+#include "mtfn_stream.h"
+#include "mtfn_cache.h"
+#include "mtfn_match.h"
+#include "mtfn_incremental.h"
+#include "mtfn_normalize.h"
+#include "mtfn_name.h"
+#include "mtfn_fuzzy.h"
+#include "mtfn_cluster.h"
+#include "mtfn_join.h"
+#include "mtfn_sort.h"
+#include "mtfn_server.h"
+#include "mtfn_client.h"
+#include "mtfn_profile.h"
+#include "mtfn_metrics.h"
 
 using namespace std;
 using namespace mtfn;
 
 #define error cerr << __FILE__ << ':' << __LINE__ << ' '
 
+// Keys of names known when compiling are worked out by the compiler
+static_assert( encode( "Schmidt" ) == encode( "Smith" ),
+               "Schmidt and Smith don't sound the same at compile time" );
+static_assert( encode( "Schmidt" ) != encode( "Jones" ),
+               "Schmidt and Jones sound the same at compile time" );
+
+// M\u00fcller and Dvo\u0159\u00e1k in UTF-8
+static_assert( encode_utf8( "M\xC3\xBCller" ) == encode( "Muller" ),
+               "UTF-8 u umlaut doesn't fold at compile time" );
+static_assert( encode_utf8( "Dvo\xC5\x99\xC3\xA1k" ) == encode( "Dvorak" ),
+               "UTF-8 r caron doesn't fold at compile time" );
+
 static void test_interface( void );
+static void test_encoder( void );
+static void test_keys( const char* filename );
+static void test_index( const char* filename );
+static void test_mapped_index( const char* filename );
+static void test_bulk( const char* filename );
+static void test_unlimited( const char* filename );
+static void test_stream( const char* filename );
+static void test_cache( const char* filename );
+static void test_matcher( const char* filename );
+static void test_incremental( const char* filename );
+static void test_utf8( const char* filename );
+static void test_normalize( const char* filename );
+static void test_name_sound( const char* filename );
+static void test_fuzzy( const char* filename );
+static void test_cluster( const char* filename );
+static void test_join( const char* filename );
+static void test_sort( const char* filename );
+static void test_server( const char* filename );
+static void test_client_errors( void );
+static void test_server_flow( const char* filename );
+static void test_profile( const char* filename );
+static void test_metrics( const char* filename );
+static void test_table( const char* filename );
+static void test_key_length( const char* filename );
 
 int main ( int argc, char** argv )
 {
-    if ( argc < 2 )
+    bool streaming = false;
+    bool clustering = false;
+    bool profiling = false;
+    int threads = 0;
+    int arg = 1;
+
+    for ( ; arg < argc && argv[arg][0] == '-'; arg++ )
+    {
+        if ( string( argv[arg] ) == "-s" )
+        {
+            streaming = true;
+        }
+        else if ( string( argv[arg] ) == "-c" )
+        {
+            clustering = true;
+        }
+        else if ( string( argv[arg] ) == "-p" )
+        {
+            profiling = true;
+        }
+        else if ( string( argv[arg] ) == "-j" && arg + 1 < argc )
+        {
+            threads = atoi( argv[++arg] );
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if ( arg + 1 != argc )
     {
-        error << "USAGE: mtfn <filename>" << endl;
+        error << "USAGE: mtfn [-s | -c | -p] [-j threads] <filename>" << endl;
         return 1;
     }
 
+    // Just the sounds, as fast as the machine can make them
+    if ( streaming )
+    {
+        stream_stats stats;
+        if ( !encode_file( argv[arg], stdout, threads, stats ) )
+        {
+            error << "can't encode " << argv[arg] << endl;
+            return 1;
+        }
+
+        cerr << stats.names << " names, " << stats.bytes << " bytes in "
+             << stats.seconds << "s on " << stats.threads << " threads: "
+             << stats.names / stats.seconds << " names/s, "
+             << stats.bytes / stats.seconds / 1e6 << " MB/s" << endl;
+        return 0;
+    }
+
+    // Each name and the first name in its cluster
+    if ( clustering )
+    {
+        cluster_stats stats;
+        if ( !cluster_file( argv[arg], stdout, threads, stats ) )
+        {
+            error << "can't cluster " << argv[arg] << endl;
+            return 1;
+        }
+
+        cerr << stats.names << " names in " << stats.clusters
+             << " clusters in " << stats.seconds << "s on " << stats.threads
+             << " threads: " << stats.names / stats.seconds << " names/s"
+             << endl;
+        return 0;
+    }
+
+    // How often each rule ran over the names, most often first
+    if ( profiling )
+    {
+        if ( !rules_profiled() )
+        {
+            error << "mtfn was built without MTFN_PROFILE, see make profile"
+                  << endl;
+            return 1;
+        }
+
+        ifstream istrm( argv[arg] );
+        encoder enc;
+        string s;
+        while ( getline( istrm, s ) )
+        {
+            enc.encode( s );
+        }
+
+        vector<rule_count> counts;
+        uint64_t totals[3] = { 0, 0, 0 };
+        const char* events[3] = { "branch", "probe", "advance" };
+        rule_counts( counts );
+        for ( const rule_count& c : counts )
+        {
+            totals[c.event] += c.hits;
+        }
+        for ( const rule_count& c : counts )
+        {
+            cout << setw( 12 ) << c.hits << setw( 8 ) << fixed
+                 << setprecision( 2 ) << 100.0 * c.hits / totals[c.event]
+                 << "% " << setw( 8 ) << events[c.event] << ' ' << c.where
+                 << endl;
+        }
+        return 0;
+    }
+
+    argv += arg - 1;
+
     test_interface();
+    test_encoder();
+    test_keys( argv[1] );
+    test_index( argv[1] );
+    test_mapped_index( argv[1] );
+    test_bulk( argv[1] );
+    test_unlimited( argv[1] );
+    test_stream( argv[1] );
+    test_cache( argv[1] );
+    test_matcher( argv[1] );
+    test_incremental( argv[1] );
+    test_utf8( argv[1] );
+    test_normalize( argv[1] );
+    test_name_sound( argv[1] );
+    test_fuzzy( argv[1] );
+    test_cluster( argv[1] );
+    test_join( argv[1] );
+    test_sort( argv[1] );
+    test_server( argv[1] );
+    test_client_errors();
+    test_server_flow( argv[1] );
+    test_profile( argv[1] );
+    test_metrics( argv[1] );
+    test_table( argv[1] );
+    test_key_length( argv[1] );
 
     ifstream istrm( argv[1] );
     string s;
@@ -121,3 +312,2138 @@ static void test_interface( void )
         exit(1);
     }
 }
+
+static void test_encoder( void )
+{
+    encoder enc, unlimited( false );
+    bool worked = true;
+
+    // Longer than encoder::inline_len, so it goes through the heap buffer
+    string long_name;
+    while ( long_name.size() <= encoder::inline_len )
+    {
+        long_name += "Schwarzenegger-";
+    }
+
+    enc.encode( long_name );
+    unlimited.encode( long_name );
+    if ( sound( enc ) != sound( long_name ) ||
+         unlimited.primary() != sound( long_name, false ).primary() ||
+         unlimited.primary().substr( 0, stop_len ) != enc.primary() )
+    {
+        error << "long names encode differently through the heap buffer"
+              << endl;
+        worked = false;
+    }
+
+    // Nothing from the previous name is left behind in a reused encoder
+    enc.encode( "o'brien" );
+    if ( enc.primary() != "APRN" || enc.has_alternate() ||
+         sound( enc ) != sound( "OBRIEN" ) )
+    {
+        error << "reused encoder gives " << enc.primary() << endl;
+        worked = false;
+    }
+
+    enc.encode( "" );
+    if ( !enc.primary().empty() || enc.primary_int() != 0 )
+    {
+        error << "empty name has a sound" << endl;
+        worked = false;
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// sound_key has to agree with sound about every pair of names
+static void test_keys( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<sound> sounds;
+    vector<sound_key> keys;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        sounds.push_back( sound( s ) );
+        keys.push_back( sounds.back().key() );
+
+        if ( encode( s ) != keys.back() ||
+             encode( s ).flags != keys.back().flags )
+        {
+            error << s << " has a different key from encode()" << endl;
+            worked = false;
+        }
+
+        if ( keys.back().has_alternate() != sounds.back().has_alternate() )
+        {
+            error << s << " has a key with the wrong flags" << endl;
+            worked = false;
+        }
+    }
+
+    constexpr sound_key caesar = encode( "caesar" );
+    switch ( encode( "ceasar" ).primary )
+    {
+        case caesar.primary:
+            break;
+        default:
+            error << "can't switch on a compile time key" << endl;
+            worked = false;
+    }
+
+    for ( size_t i = 0; i < sounds.size(); i++ )
+    {
+        for ( size_t j = 0; j < sounds.size(); j++ )
+        {
+            if ( ( sounds[i] == sounds[j] ) != ( keys[i] == keys[j] ) )
+            {
+                error << "keys " << i << " and " << j
+                      << " don't compare like their sounds" << endl;
+                worked = false;
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// The index has to find the same names as comparing against every one
+static void test_index( const char* filename )
+{
+    ifstream istrm( filename );
+    sound_index index;
+    vector<string> names;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        names.push_back( s );
+        index.insert( s );
+    }
+
+    for ( size_t i = 0; i < names.size(); i++ )
+    {
+        vector<sound_index::record_id> found, expected;
+        sound snd( names[i] );
+
+        index.find( names[i], found );
+        for ( size_t j = 0; j < names.size(); j++ )
+        {
+            if ( snd == names[j] )
+            {
+                expected.push_back( j );
+            }
+        }
+
+        sort( found.begin(), found.end() );
+        if ( found != expected || index.name( i ) != names[i] )
+        {
+            error << "index finds " << found.size() << " names like "
+                  << names[i] << " instead of " << expected.size() << endl;
+            worked = false;
+        }
+    }
+
+    // Every prefix of every code finds the records with a code starting
+    // with it
+    for ( size_t i = 0; i < names.size(); i++ )
+    {
+        string codes( sound( names[i] ).primary() );
+        for ( size_t len = 0; len <= codes.size(); len++ )
+        {
+            string prefix( codes.substr( 0, len ) );
+            vector<sound_index::record_id> found, expected;
+
+            index.find_prefix( prefix, found );
+            for ( size_t j = 0; j < names.size(); j++ )
+            {
+                sound snd( names[j] );
+                if ( snd.primary().compare( 0, len, prefix ) == 0 ||
+                     ( snd.has_alternate() &&
+                       snd.alternate().compare( 0, len, prefix ) == 0 ) )
+                {
+                    expected.push_back( j );
+                }
+            }
+
+            if ( found != expected )
+            {
+                error << "index finds " << found.size() << " codes starting "
+                      << prefix << " instead of " << expected.size() << endl;
+                worked = false;
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// A saved and mapped index has to find the same names as the one it was
+// saved from, and a damaged one mustn't be mapped at all
+static void test_mapped_index( const char* filename )
+{
+    const char* index_file = "test_index.mtfn";
+    ifstream istrm( filename );
+    sound_index index;
+    mapped_index mapped;
+    vector<string> names;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        names.push_back( s );
+        index.insert( s );
+    }
+
+    if ( mapped.open( filename ) )
+    {
+        error << "mapped a file that is not an index" << endl;
+        worked = false;
+    }
+
+    if ( !index.save( index_file ) || !mapped.open( index_file ) ||
+         mapped.size() != index.size() )
+    {
+        error << "can't save and map " << index_file << endl;
+        exit(1);
+    }
+
+    for ( size_t i = 0; i < names.size(); i++ )
+    {
+        vector<sound_index::record_id> found, expected;
+
+        index.find( names[i], expected );
+        mapped.find( names[i], found );
+
+        string prefix( sound( names[i] ).primary().substr( 0, i % 4 ) );
+        index.find_prefix( prefix, expected );
+        mapped.find_prefix( prefix, found );
+
+        if ( found != expected || mapped.name( i ) != names[i] ||
+             mapped.key( i ) != index.key( i ) )
+        {
+            error << "mapped index finds " << found.size() << " names like "
+                  << names[i] << " instead of " << expected.size() << endl;
+            worked = false;
+        }
+    }
+    mapped.close();
+
+    // The padding of the keys is written as zeros. Files too short for
+    // their header are turned down, and damage within the sections never
+    // gets find() or name() past them.
+    ifstream saved( index_file, ios::binary );
+    const string good( ( istreambuf_iterator<char>( saved ) ),
+        istreambuf_iterator<char>() );
+    const index_file_header& header( *(const index_file_header*)good.data() );
+    const size_t directory = ( sizeof( header ) + 7 ) & ~(size_t)7;
+    const size_t postings = directory + 0x10001 * sizeof( uint64_t );
+    const size_t keys = ( postings + header.postings * sizeof( uint32_t ) +
+        7 ) & ~(size_t)7;
+    const size_t offsets = ( keys + header.records * sizeof( sound_key ) +
+        7 ) & ~(size_t)7;
+    const uint32_t records = header.records;
+    const uint64_t past_end = UINT64_MAX;
+
+    for ( size_t i = 0; i < header.records; i++ )
+    {
+        if ( good[keys + i * sizeof( sound_key ) + 5] != 0 )
+        {
+            error << "key " << i << " has padding that isn't 0" << endl;
+            worked = false;
+            break;
+        }
+    }
+
+    vector<string> bad( 3, good );
+    bad[0].resize( good.size() - 1 );
+    ( (index_file_header*)&bad[1][0] )->records = UINT64_MAX / 8;
+    ( (index_file_header*)&bad[2][0] )->postings = UINT64_MAX / 2;
+    for ( size_t i = 0; i < bad.size(); i++ )
+    {
+        ofstream( index_file, ios::binary | ios::trunc ) << bad[i];
+        if ( mapped.open( index_file ) )
+        {
+            error << "mapped bad index " << i << endl;
+            mapped.close();
+            worked = false;
+        }
+    }
+
+    vector<string> damaged( 4, good );
+    memcpy( &damaged[0][postings], &records, sizeof( records ) );
+    memcpy( &damaged[1][directory + 8], &past_end, sizeof( past_end ) );
+    memcpy( &damaged[2][directory + 0x8000 * 8], &past_end,
+        sizeof( past_end ) );
+    memcpy( &damaged[3][offsets + 8], &past_end, sizeof( past_end ) );
+    for ( size_t i = 0; i < damaged.size(); i++ )
+    {
+        ofstream( index_file, ios::binary | ios::trunc ) << damaged[i];
+        if ( !mapped.open( index_file ) )
+        {
+            error << "can't map damaged index " << i << endl;
+            worked = false;
+            continue;
+        }
+
+        vector<sound_index::record_id> found;
+        mapped.find_prefix( "", found );
+        for ( size_t j = 0; j < names.size(); j++ )
+        {
+            mapped.find( names[j], found );
+        }
+        for ( sound_index::record_id id : found )
+        {
+            if ( id >= records ||
+                 mapped.name( id ).size() > header.names_len )
+            {
+                error << "damaged index " << i << " finds record " << id
+                      << endl;
+                worked = false;
+                break;
+            }
+        }
+        if ( mapped.name( records ) != "" ||
+             ( i == 3 && ( mapped.name( 0 ) != "" || mapped.name( 1 ) != "" ||
+                           mapped.name( 2 ) != names[2] ) ) )
+        {
+            error << "damaged index " << i << " has names past its end"
+                  << endl;
+            worked = false;
+        }
+        mapped.close();
+    }
+    remove( index_file );
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Every kernel the CPU has has to agree with sound_key::operator==
+static void test_bulk( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<sound_key> keys;
+    key_columns columns;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        keys.push_back( sound( s ).key() );
+    }
+
+    // Enough rows for whole words and a few left over
+    for ( size_t i = 0; i < 5 * keys.size() + 7; i++ )
+    {
+        columns.push_back( keys[i % keys.size()] );
+    }
+
+    vector<uint64_t> bits( ( columns.size() + 63 ) / 64 );
+    for ( int k = best_bulk_kernel(); k <= kernel_scalar; k++ )
+    {
+        for ( size_t n = 0; n < keys.size(); n++ )
+        {
+            match_keys( keys[n], columns.primary.data(),
+                columns.alternate.data(), columns.size(), bits.data(),
+                (bulk_kernel)k );
+
+            for ( size_t i = 0; i < columns.size(); i++ )
+            {
+                bool bit = ( bits[i / 64] >> ( i % 64 ) ) & 1;
+                if ( bit != ( keys[n] == keys[i % keys.size()] ) )
+                {
+                    error << bulk_kernel_name( (bulk_kernel)k )
+                          << " gets row " << i << " wrong for key " << n
+                          << endl;
+                    worked = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    for ( size_t n = 0; n < keys.size(); n++ )
+    {
+        vector<size_t> found, expected;
+
+        find_keys( keys[n], columns, found );
+        for ( size_t i = 0; i < columns.size(); i++ )
+        {
+            if ( keys[n] == keys[i % keys.size()] )
+            {
+                expected.push_back( i );
+            }
+        }
+
+        if ( found != expected )
+        {
+            error << "find_keys finds " << found.size() << " rows for key "
+                  << n << " instead of " << expected.size() << endl;
+            worked = false;
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// How unlimited sounds were compared before they had packed codes
+static bool same_codes( const sound& lhs, const sound& rhs )
+{
+    return lhs.primary() == rhs.primary() ||
+       ( rhs.has_alternate() && lhs.primary() == rhs.alternate() ) ||
+       ( lhs.has_alternate() && rhs.has_alternate() &&
+         lhs.alternate() == rhs.alternate() ) ||
+       ( lhs.has_alternate() && lhs.alternate() == rhs.primary() );
+}
+
+// Unlimited sounds compare by packed codes, and by fingerprints that are
+// checked against the codes when the codes are longer than packed_len
+static void test_unlimited( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<sound> sounds;
+    string s, previous( "wolfeschlegelsteinhausenbergerdorff" );
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        sounds.push_back( sound( s, false ) );
+
+        // Long enough for the codes to be fingerprints
+        sounds.push_back( sound( s + previous + s, false ) );
+        sounds.push_back( sound( s + previous + s + "x", false ) );
+        previous = s;
+    }
+
+    for ( size_t i = 0; i < sounds.size(); i++ )
+    {
+        if ( is_fingerprint( sounds[i].primary_code() ) !=
+             ( sounds[i].primary().size() > (size_t)packed_len ) )
+        {
+            error << sounds[i].primary() << " is packed wrongly" << endl;
+            worked = false;
+        }
+
+        for ( size_t j = 0; j < sounds.size(); j++ )
+        {
+            if ( ( sounds[i] == sounds[j] ) != same_codes( sounds[i], sounds[j] ) )
+            {
+                error << sounds[i].primary() << " and " << sounds[j].primary()
+                      << " don't compare like their codes" << endl;
+                worked = false;
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Streaming has to write what the loop in main() writes, however the file
+// is cut into blocks and however many threads encode them
+static void test_stream( const char* filename )
+{
+    ifstream istrm( filename );
+    string s, expected;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        sound snd( s );
+
+        expected += s + ',' + snd.primary();
+        if ( snd.has_alternate() )
+        {
+            expected += '/' + snd.alternate();
+        }
+        expected += '\n';
+    }
+
+    const size_t block_lens[] = { 1, 64, 1 << 20 };
+    for ( size_t b = 0; b < sizeof( block_lens ) / sizeof( block_lens[0] ); b++ )
+    {
+        for ( int threads = 1; threads <= 4; threads += 3 )
+        {
+            FILE* out = tmpfile();
+            stream_stats stats;
+
+            if ( out == NULL ||
+                 !encode_file( filename, out, threads, stats, block_lens[b] ) )
+            {
+                error << "can't stream " << filename << endl;
+                exit(1);
+            }
+
+            string streamed( ftell( out ), '\0' );
+            rewind( out );
+            if ( fread( &streamed[0], 1, streamed.size(), out ) != streamed.size() ||
+                 streamed != expected )
+            {
+                error << "streaming " << threads << " threads in blocks of "
+                      << block_lens[b] << " gives different sounds" << endl;
+                worked = false;
+            }
+            fclose( out );
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// A cache too small for the names has to evict, and still give the keys
+// encode() gives, from any number of threads
+static void test_cache( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> names;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        names.push_back( s );
+    }
+
+    encode_cache cache( 64, 4 );
+    vector<int> wrong( 4, 0 );
+    vector<thread> threads;
+    for ( size_t t = 0; t < wrong.size(); t++ )
+    {
+        threads.push_back( thread( [&, t] {
+            for ( int round = 0; round < 10; round++ )
+            {
+                for ( size_t i = 0; i < names.size(); i++ )
+                {
+                    // Hot names come round far more often than the rest
+                    const string& name( names[i % 3 == 0 ? i % 12 : i] );
+                    wrong[t] += cache.encode( name ) != encode( name ) ||
+                        cache.encode( name ).flags != encode( name ).flags;
+                }
+            }
+        } ) );
+    }
+    for ( size_t t = 0; t < threads.size(); t++ )
+    {
+        threads[t].join();
+    }
+
+    cache_stats stats = cache.stats();
+    if ( count( wrong.begin(), wrong.end(), 0 ) != (int)wrong.size() ||
+         stats.hits + stats.misses != 2 * 10 * wrong.size() * names.size() ||
+         stats.entries > cache.capacity() || stats.evictions == 0 ||
+         stats.hits < stats.misses )
+    {
+        error << "cache gives " << stats.hits << " hits, " << stats.misses
+              << " misses, " << stats.evictions << " evictions" << endl;
+        worked = false;
+    }
+
+    cache.clear();
+    cache.encode( "Smith" );
+    if ( !cache.sounds_like( "SMITH", "smith" ) ||
+         cache.stats().hits != 2 || cache.stats().misses != 1 )
+    {
+        error << "names that normalize the same don't share an entry" << endl;
+        worked = false;
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// A matcher has to agree with operator== about every pair of names, with
+// and without the length limit, even when it gives up early
+static void test_matcher( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> names;
+    string s, previous( "wolfeschlegelsteinhausenbergerdorff" );
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        names.push_back( s );
+
+        // Long enough for unlimited codes to be fingerprints
+        names.push_back( s + previous + s );
+        previous = s;
+    }
+
+    for ( int limited = 0; limited < 2; limited++ )
+    {
+        for ( size_t i = 0; i < names.size(); i++ )
+        {
+            sound needle( names[i], limited );
+            matcher m( needle );
+
+            for ( size_t j = 0; j < names.size(); j++ )
+            {
+                if ( m.matches( names[j] ) !=
+                     ( needle == sound( names[j], limited ) ) )
+                {
+                    error << "matcher for " << names[i] << " gets "
+                          << names[j] << " wrong" << endl;
+                    worked = false;
+                }
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Typing a name a character or a few at a time has to give the codes of
+// encoding everything typed so far, and the settled codes have to be the
+// start of the codes of the whole name
+static void test_incremental( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> names;
+    string s, previous( "wolfeschlegelsteinhausenbergerdorff" );
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        names.push_back( s );
+        names.push_back( s + previous + s );
+        previous = s;
+    }
+
+    for ( int limited = 0; limited < 2; limited++ )
+    {
+        encoder enc( limited );
+        incremental_encoder typed( limited );
+
+        for ( size_t i = 0; i < names.size(); i++ )
+        {
+            const string& name( names[i] );
+            sound whole( name, limited );
+
+            typed.clear();
+            for ( size_t len = 0; len < name.size(); )
+            {
+                size_t n = 1 + ( i + len ) % 3;
+                typed.append( string_view( name ).substr( len, n ) );
+                len += n;
+
+                enc.encode( name.substr( 0, len ) );
+                if ( typed.primary() != enc.primary() ||
+                     typed.alternate() != enc.alternate() ||
+                     typed.has_alternate() != enc.has_alternate() ||
+                     typed.primary_code() != enc.primary_code() )
+                {
+                    error << "typing " << name.substr( 0, len ) << " gives "
+                          << typed.primary() << " not " << enc.primary()
+                          << endl;
+                    worked = false;
+                    break;
+                }
+
+                if ( whole.primary().compare( 0, typed.settled_primary().size(),
+                         typed.settled_primary() ) != 0 ||
+                     ( whole.has_alternate() ? whole.alternate() : whole.primary() )
+                         .compare( 0, typed.settled_alternate().size(),
+                             typed.settled_alternate() ) != 0 )
+                {
+                    error << "typing " << name.substr( 0, len ) << " settles "
+                          << typed.settled_primary() << " but " << name
+                          << " is " << whole.primary() << endl;
+                    worked = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// UTF-8 has to encode ASCII and Latin-1 letters the same as the string
+// constructor, fold accents away, and skip everything else
+static void test_utf8( const char* filename )
+{
+    ifstream istrm( filename );
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        // The Latin-1 names aren't UTF-8
+        if ( find_if( s.begin(), s.end(), []( char c ) { return c & 0x80; } )
+             != s.end() )
+        {
+            continue;
+        }
+
+        sound latin_1( s ), unicode( s, utf8 );
+        if ( latin_1.primary() != unicode.primary() ||
+             latin_1.alternate() != unicode.alternate() ||
+             encode_utf8( s ) != latin_1.key() )
+        {
+            error << s << " encodes differently as UTF-8" << endl;
+            worked = false;
+        }
+    }
+
+    // UTF-8 on the left, what it has to sound the same as on the right
+    const char* same[][2] = {
+        { "Fran\xC3\xA7ois", "Fran\xE7ois" },         // c cedilla
+        { "Pe\xC3\xB1" "a", "Pe\xF1" "a" },           // n tilde
+        { "M\xC3\xBCller", "Muller" },                 // u umlaut
+        { "S\xC3\xB8ren", "Soren" },                   // o slash
+        { "\xC3\x89lise", "Elise" },                   // E acute
+        { "\xC5\x81ukasz", "Lukasz" },                 // L stroke
+        { "Stra\xC3\x9F" "e", "Strasse" },            // sharp s
+        { "\xC3\x86thelred", "Aethelred" },            // AE ligature
+        { "Smith\xF0\x9F\x98\x80", "Smith" },           // emoji
+        { "Sm\xE4\xB8\x80ith", "Smith" },              // CJK
+        { "Sm\xFFith\xC3", "Smith" },                  // broken sequences
+    };
+
+    encoder enc;
+    for ( size_t i = 0; i < sizeof( same ) / sizeof( same[0] ); i++ )
+    {
+        enc.encode_utf8( same[i][0] );
+        if ( sound( same[i][0], utf8 ).primary() != sound( same[i][1] ).primary() ||
+             enc.primary() != sound( same[i][1] ).primary() ||
+             encode_utf8( same[i][0] ) != encode( same[i][1] ) )
+        {
+            error << same[i][1] << " encodes differently in UTF-8" << endl;
+            worked = false;
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Every kernel has to normalize what rules::normalize() does, however the
+// blocks fall: names with punctuation and lower case mixed in, run
+// together to cross block boundaries, at every alignment
+static void test_normalize( const char* filename )
+{
+    ifstream istrm( filename );
+    string s, text;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        for ( size_t i = 0; i < s.size(); i++ )
+        {
+            text += ( i % 3 == 1 ) ? (char)tolower( s[i] ) : s[i];
+            text += ".-' ,\t0\x80\xff"[( i + text.size() ) % 10];
+        }
+    }
+
+    // And every byte there is
+    for ( int c = 0; c < 256; c++ )
+    {
+        text += (char)c;
+    }
+
+    vector<char> expected( 80 ), found( 80 );
+    for ( int k = best_normalize_kernel(); k <= normalize_scalar; k++ )
+    {
+        for ( size_t start = 0; start < text.size(); start += 7 )
+        {
+            size_t len = min( text.size() - start, (size_t)( start % 80 ) );
+            int n = rules::normalize( text.data() + start, len,
+                expected.data() );
+            int m = normalize_name( text.data() + start, len, found.data(),
+                (normalize_kernel)k );
+
+            if ( n != m || !equal( expected.begin(), expected.begin() + n,
+                                   found.begin() ) )
+            {
+                error << normalize_kernel_name( (normalize_kernel)k )
+                      << " normalizes " << len << " bytes at " << start
+                      << " wrong" << endl;
+                worked = false;
+                break;
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Each token of a name_sound has the codes sound gives it on its own
+static void test_name_sound( const char* filename )
+{
+    ifstream istrm( filename );
+    string s, full;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        full += ( full.size() % 3 ) ? " " : " - ";
+        full += s;
+    }
+
+    for ( int limit = 0; limit < 2; limit++ )
+    {
+        name_sound names( full, limit );
+        istrm.clear();
+        istrm.seekg( 0 );
+
+        size_t i = 0;
+        while ( getline( istrm, s ) )
+        {
+            for ( size_t begin = 0; begin <= s.size(); )
+            {
+                size_t end = min( s.find_first_of( name_sound::separators,
+                    begin ), s.size() );
+                sound token( s.substr( begin, end - begin ), limit );
+                begin = end + 1;
+                if ( token.primary().empty() )
+                {
+                    continue;
+                }
+
+                if ( i >= names.size() ||
+                     names.primary( i ) != token.primary() ||
+                     names.alternate( i ) != token.alternate() ||
+                     names.has_alternate( i ) != token.has_alternate() ||
+                     names.primary_code( i ) != token.primary_code() ||
+                     ( limit && names.key( i ) != token.key() ) ||
+                     !names.any_token_matches( token ) )
+                {
+                    error << "token " << i << " of the names isn't "
+                          << s << endl;
+                    exit(1);
+                }
+                i++;
+            }
+        }
+
+        if ( i != names.size() )
+        {
+            error << "the names have " << names.size() << " tokens, not "
+                  << i << endl;
+            worked = false;
+        }
+    }
+
+    name_sound maria( "Maria del Carmen Lopez-Garcia" );
+    name_sound garsia( "Juan  Garsia" ), smith( "-Smith-" );
+    name_sound utf8_maria( "Mar\xC3\xAD" "a del Carmen L\xC3\xB3pez-Garc\xC3\xAD" "a",
+        utf8 );
+
+    if ( maria.size() != 5 || maria.token( 3 ) != "LOPEZ" ||
+         garsia.size() != 2 || smith.size() != 1 ||
+         !maria.any_token_matches( garsia ) ||
+         !garsia.any_token_matches( maria ) ||
+         maria.any_token_matches( smith ) ||
+         !maria.any_token_matches( encode( "Karsia" ) ) ||
+         maria.any_token_matches( encode( "Smith" ) ) ||
+         maria.composite() != utf8_maria.composite() ||
+         maria.composite_code() != utf8_maria.composite_code() ||
+         maria.composite_code() == name_sound( "Maria del Carmen" ).composite_code() ||
+         name_sound( "Mary Tell" ).composite_code() ==
+             name_sound( "Marty Lee" ).composite_code() ||
+         name_sound( "H Smith" ).composite() != " SM0" ||
+         name_sound( "H Smith" ).composite_code() ==
+             name_sound( "Smith" ).composite_code() ||
+         name_sound( "Smith H" ).composite_code() ==
+             name_sound( "Smith" ).composite_code() ||
+         !name_sound( "" ).empty() || !name_sound( " - ,." ).empty() )
+    {
+        error << "name_sound splits or compares names wrong" << endl;
+        worked = false;
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// The edit distance of the codes packed in lhs and rhs, a row at a time
+static int slow_distance( uint64_t lhs, uint64_t rhs )
+{
+    string a, b;
+    for ( ; lhs != 0; lhs >>= 4 )
+    {
+        a.insert( a.begin(), (char)( lhs & 0xF ) );
+    }
+    for ( ; rhs != 0; rhs >>= 4 )
+    {
+        b.insert( b.begin(), (char)( rhs & 0xF ) );
+    }
+
+    vector<int> row( b.size() + 1 );
+    for ( size_t j = 0; j <= b.size(); j++ )
+    {
+        row[j] = j;
+    }
+    for ( size_t i = 1; i <= a.size(); i++ )
+    {
+        int diagonal = row[0];
+        row[0] = i;
+        for ( size_t j = 1; j <= b.size(); j++ )
+        {
+            int above = row[j];
+            row[j] = min( { above + 1, row[j - 1] + 1,
+                            diagonal + ( a[i - 1] != b[j - 1] ) } );
+            diagonal = above;
+        }
+    }
+
+    return row[b.size()];
+}
+
+// code_distance() against the textbook algorithm, and fuzzy_index against
+// comparing every key
+static void test_fuzzy( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<sound_key> keys;
+    string s;
+    bool worked = true;
+
+    // Random codes of every length, some of them close to each other
+    uint64_t state = 12345;
+    for ( int i = 0; i < 20000 && worked; i++ )
+    {
+        uint64_t codes[2] = { 0, 0 };
+        for ( int c = 0; c < 2; c++ )
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            int len = ( state >> 33 ) % ( packed_len + 1 );
+            for ( int j = 0; j < len; j++ )
+            {
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                codes[c] = ( codes[c] << 4 ) | ( 1 + ( state >> 40 ) % 3 );
+            }
+        }
+
+        int expected = slow_distance( codes[0], codes[1] );
+        for ( int bound = 0; bound <= packed_len; bound++ )
+        {
+            if ( code_distance( codes[0], codes[1], bound ) !=
+                 min( expected, bound + 1 ) )
+            {
+                error << "code_distance( " << hex << codes[0] << ", "
+                      << codes[1] << dec << ", " << bound << " ) isn't "
+                      << expected << endl;
+                worked = false;
+                break;
+            }
+        }
+    }
+
+    if ( key_distance( encode( "Carson" ), encode( "Karst" ) ) != 1 ||
+         key_distance( encode( "Smith" ), encode( "Schmidt" ) ) != 0 ||
+         sound_distance( sound( "Carson" ), sound( "Carsten" ) ) != 1 )
+    {
+        error << "key_distance gets near homophones wrong" << endl;
+        worked = false;
+    }
+
+    fuzzy_index index( 2 );
+    sound_index exact;
+    while ( getline( istrm, s ) )
+    {
+        keys.push_back( sound( s ).key() );
+        index.insert( s );
+        exact.insert( s );
+    }
+
+    for ( size_t n = 0; n < keys.size() && worked; n++ )
+    {
+        for ( int distance = 0; distance <= 2; distance++ )
+        {
+            vector<fuzzy_index::record_id> found, expected;
+
+            index.find( keys[n], distance, found );
+            sort( found.begin(), found.end() );
+            for ( size_t i = 0; i < keys.size(); i++ )
+            {
+                if ( key_distance( keys[n], keys[i] ) <= distance )
+                {
+                    expected.push_back( i );
+                }
+            }
+
+            if ( distance == 0 )
+            {
+                vector<sound_index::record_id> same;
+                exact.find( keys[n], same );
+                sort( same.begin(), same.end() );
+                if ( same != expected )
+                {
+                    error << "key_distance 0 isn't operator== for key " << n
+                          << endl;
+                    worked = false;
+                }
+            }
+
+            if ( found != expected )
+            {
+                error << "fuzzy_index finds " << found.size()
+                      << " records within " << distance << " of key " << n
+                      << " instead of " << expected.size() << endl;
+                worked = false;
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Clusters against joining every pair of names that sound the same, on
+// names enough to give every thread a share of the ones that link up
+static void test_cluster( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> lines;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        lines.push_back( s );
+    }
+    for ( size_t i = 0, n = lines.size(); i < 20 * n; i++ )
+    {
+        lines.push_back( lines[( i * 37 ) % n] + lines[( i * 11 ) % n] );
+    }
+
+    vector<string_view> names( lines.begin(), lines.end() );
+    vector<sound_key> keys;
+    for ( const string& name : lines )
+    {
+        keys.push_back( encode_long( name ) );
+    }
+
+    // Every name points at the first of the names it sounds like, and a
+    // pass from the front takes each to the first of its cluster
+    vector<size_t> expected( keys.size() );
+    for ( size_t i = 0; i < keys.size(); i++ )
+    {
+        expected[i] = i;
+        for ( size_t j = 0; j < i; j++ )
+        {
+            if ( keys[i] == keys[j] && expected[i] == i )
+            {
+                expected[i] = expected[j];
+            }
+            else if ( keys[i] == keys[j] &&
+                      expected[j] != expected[i] )
+            {
+                // i links two clusters; the later one joins the earlier
+                size_t from = max( expected[i], expected[j] );
+                size_t to = min( expected[i], expected[j] );
+                for ( size_t k = 0; k <= i; k++ )
+                {
+                    if ( expected[k] == from )
+                    {
+                        expected[k] = to;
+                    }
+                }
+            }
+        }
+    }
+
+    for ( int threads = 1; threads <= 7; threads += 3 )
+    {
+        vector<size_t> from_names, from_keys;
+        cluster_stats stats;
+
+        cluster_names( names, threads, from_names, stats );
+        cluster_keys( keys, threads, from_keys, stats );
+
+        size_t clusters = 0;
+        for ( size_t i = 0; i < expected.size(); i++ )
+        {
+            clusters += expected[i] == i;
+        }
+
+        if ( from_names != expected || from_keys != expected ||
+             stats.clusters != clusters || stats.names != keys.size() )
+        {
+            error << "clustering on " << threads << " threads gives "
+                  << stats.clusters << " clusters instead of " << clusters
+                  << endl;
+            worked = false;
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Joins against a nested loop, in memory and spilled, with either list
+// the smaller one
+static void test_join( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> lines;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        lines.push_back( s );
+    }
+    size_t n = lines.size();
+    for ( size_t i = 0; i < 10 * n; i++ )
+    {
+        lines.push_back( lines[( i * 37 ) % n] + lines[( i * 11 ) % n] );
+    }
+
+    vector<string_view> small( lines.begin(), lines.begin() + n );
+    vector<string_view> large( lines.begin() + n / 2, lines.end() );
+    vector<sound_key> small_keys, large_keys;
+    for ( string_view name : small )
+    {
+        small_keys.push_back( encode_long( name ) );
+    }
+    for ( string_view name : large )
+    {
+        large_keys.push_back( encode_long( name ) );
+    }
+
+    vector<join_pair> expected;
+    for ( size_t i = 0; i < small_keys.size(); i++ )
+    {
+        for ( size_t j = 0; j < large_keys.size(); j++ )
+        {
+            if ( small_keys[i] == large_keys[j] )
+            {
+                expected.push_back( join_pair{ i, j } );
+            }
+        }
+    }
+
+    // Small enough to spill, and the default
+    const size_t limits[] = { 64, (size_t)1 << 30 };
+
+    for ( int threads = 1; threads <= 4; threads += 3 )
+    {
+        for ( size_t limit : limits )
+        {
+            vector<join_pair> pairs, swapped, named;
+            join_stats stats;
+
+            if ( !join_keys( small_keys, large_keys, threads, pairs, stats,
+                     limit ) ||
+                 stats.spilled != ( limit == 64 ) ||
+                 stats.pairs != expected.size() ||
+                 !join_keys( large_keys, small_keys, threads, swapped, stats,
+                     limit ) ||
+                 !join_names( small, large, threads, named, stats, limit ) )
+            {
+                error << "can't join on " << threads << " threads" << endl;
+                exit(1);
+            }
+
+            for ( join_pair& p : swapped )
+            {
+                swap( p.lhs, p.rhs );
+            }
+            sort( pairs.begin(), pairs.end() );
+            sort( swapped.begin(), swapped.end() );
+            sort( named.begin(), named.end() );
+
+            if ( pairs != expected || swapped != expected ||
+                 named != expected )
+            {
+                error << "join on " << threads << " threads, "
+                      << ( limit == 64 ? "spilled" : "in memory" )
+                      << ", gives " << pairs.size() << " pairs instead of "
+                      << expected.size() << endl;
+                worked = false;
+            }
+        }
+    }
+
+    // With room for a few partitions' files at a time, a spilled join has
+    // to make more passes, and with none it has to say why it failed
+    struct rlimit files;
+    getrlimit( RLIMIT_NOFILE, &files );
+    struct rlimit few = files, none = files;
+    few.rlim_cur = 72;
+    none.rlim_cur = 3;
+    vector<join_pair> grouped, failed;
+    join_stats stats, failed_stats;
+
+    bool joined = setrlimit( RLIMIT_NOFILE, &few ) == 0 &&
+        join_keys( small_keys, large_keys, 1, grouped, stats, 64 );
+    bool refused = setrlimit( RLIMIT_NOFILE, &none ) == 0 &&
+        !join_keys( small_keys, large_keys, 1, failed, failed_stats, 64 );
+    setrlimit( RLIMIT_NOFILE, &files );
+
+    sort( grouped.begin(), grouped.end() );
+    if ( !joined || grouped != expected || stats.partitions <= 4 ||
+         stats.file_errno != 0 || !refused ||
+         failed_stats.file_errno != EMFILE )
+    {
+        error << "join spilled with few files to spare gives "
+              << grouped.size() << " pairs instead of " << expected.size()
+              << ", and fails with " << strerror( failed_stats.file_errno )
+              << endl;
+        worked = false;
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Sorted columns are in order of code and then row, every entry is in one
+// group, and merging two gives the same pairs as a nested loop, in order
+static void test_sort( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> lines;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        lines.push_back( s );
+    }
+    size_t n = lines.size();
+    for ( size_t i = 0; i < 10 * n; i++ )
+    {
+        lines.push_back( lines[( i * 37 ) % n] + lines[( i * 11 ) % n] );
+    }
+
+    vector<string_view> small( lines.begin(), lines.begin() + n );
+    vector<string_view> large( lines.begin() + n / 2, lines.end() );
+    vector<sound_key> small_keys, large_keys;
+    for ( string_view name : small )
+    {
+        small_keys.push_back( encode_long( name ) );
+    }
+    for ( string_view name : large )
+    {
+        large_keys.push_back( encode_long( name ) );
+    }
+
+    // By least shared code, then lhs row, then rhs row
+    vector<join_pair> expected;
+    for ( size_t i = 0; i < small_keys.size(); i++ )
+    {
+        for ( size_t j = 0; j < large_keys.size(); j++ )
+        {
+            if ( small_keys[i] == large_keys[j] )
+            {
+                expected.push_back( join_pair{ i, j } );
+            }
+        }
+    }
+    stable_sort( expected.begin(), expected.end(),
+        [&]( const join_pair& a, const join_pair& b ) {
+            return first_shared( small_keys[a.lhs], large_keys[a.rhs] ) <
+                first_shared( small_keys[b.lhs], large_keys[b.rhs] ); } );
+
+    for ( int threads = 1; threads <= 4; threads += 3 )
+    {
+        sorted_keys lhs( small, threads ), rhs( large_keys, threads );
+
+        size_t entries = 0;
+        for ( const sound_key& key : large_keys )
+        {
+            entries += 1 + ( key.alternate != key.primary );
+        }
+        bool sorted = rhs.rows() == large_keys.size() &&
+            rhs.size() == entries;
+        for ( size_t i = 0; sorted && i < rhs.size(); i++ )
+        {
+            const sorted_keys::entry& e( rhs[i] );
+            sorted = e.key.primary == large_keys[e.row].primary &&
+                e.key.alternate == large_keys[e.row].alternate &&
+                ( e.code == e.key.primary || e.code == e.key.alternate ) &&
+                ( i == 0 || rhs[i - 1].code < e.code ||
+                  ( rhs[i - 1].code == e.code && rhs[i - 1].row < e.row ) );
+        }
+
+        vector<sorted_keys::group> groups;
+        rhs.group_by( groups );
+        size_t covered = 0;
+        for ( size_t g = 0; sorted && g < groups.size(); g++ )
+        {
+            sorted = groups[g].begin == covered &&
+                groups[g].end > groups[g].begin &&
+                ( g == 0 || groups[g - 1].code < groups[g].code );
+            for ( size_t i = groups[g].begin; sorted && i < groups[g].end; i++ )
+            {
+                sorted = rhs[i].code == groups[g].code;
+            }
+            covered = groups[g].end;
+        }
+
+        if ( !sorted || covered != rhs.size() )
+        {
+            error << "sorted keys on " << threads << " threads out of order"
+                  << endl;
+            worked = false;
+        }
+
+        vector<join_pair> pairs;
+        merge_join( lhs, rhs, pairs );
+        if ( pairs != expected )
+        {
+            error << "merge join on " << threads << " threads gives "
+                  << pairs.size() << " pairs instead of " << expected.size()
+                  << endl;
+            worked = false;
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Clients of a server have to get the same answers as an encoder and the
+// index, one request at a time and many at once from another thread
+static void test_server( const char* filename )
+{
+    const char* index_file = "test_server.mtfn";
+    const char* socket_file = "test_server.sock";
+    ifstream istrm( filename );
+    sound_index index;
+    mapped_index mapped;
+    vector<string> lines;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        lines.push_back( s );
+        index.insert( s );
+    }
+    if ( !index.save( index_file ) || !mapped.open( index_file ) )
+    {
+        error << "can't save and map " << index_file << endl;
+        exit(1);
+    }
+
+    lookup_server server( mapped, 2, 200, 64 );
+    if ( !server.listen( socket_file ) )
+    {
+        error << "can't listen on " << socket_file << endl;
+        exit(1);
+    }
+    bool served = false;
+    thread running( [&] { served = server.run(); } );
+
+    vector<string_view> names( lines.begin(), lines.end() );
+    vector<sound_key> keys;
+    lookup_client many;
+    thread pipelined( [&] {
+        if ( !many.connect( socket_file ) || !many.encode( names, keys ) )
+        {
+            keys.clear();
+        } } );
+
+    lookup_client one;
+    encoder enc;
+    if ( !one.connect( socket_file ) )
+    {
+        error << "can't connect to " << socket_file << endl;
+        exit(1);
+    }
+    for ( size_t i = 0; i < lines.size(); i++ )
+    {
+        sound_key key;
+        vector<lookup_client::record_id> found, expected;
+        string name;
+
+        enc.encode( lines[i] );
+        mapped.find( lines[i], expected );
+        if ( !one.encode( lines[i], key ) || key.primary != enc.key().primary ||
+             key.alternate != enc.key().alternate ||
+             key.flags != enc.key().flags ||
+             !one.find( lines[i], found ) || found != expected ||
+             !one.name( i, name ) || name != lines[i] )
+        {
+            error << "server doesn't answer for " << lines[i] << endl;
+            worked = false;
+        }
+    }
+
+    // Mller in UTF-8, and a record past the end
+    sound_key key;
+    string name;
+    if ( !one.encode_utf8( "M\xC3\xBCller", key ) ||
+         key.primary != encode( "Muller" ).primary ||
+         one.name( lines.size(), name ) )
+    {
+        error << "server doesn't answer for UTF-8 or a missing record" << endl;
+        worked = false;
+    }
+
+    pipelined.join();
+    for ( size_t i = 0; i < lines.size(); i++ )
+    {
+        if ( keys.size() != lines.size() ||
+             keys[i].primary != encode_long( lines[i] ).primary ||
+             keys[i].alternate != encode_long( lines[i] ).alternate )
+        {
+            error << "server doesn't answer many at once for " << lines[i]
+                  << endl;
+            worked = false;
+            break;
+        }
+    }
+
+    server_stats stats;
+    if ( !one.stats( stats ) || stats.records != lines.size() ||
+         stats.connections != 2 || stats.requests != 4 * lines.size() + 2 ||
+         stats.batches == 0 || stats.batches > stats.requests ||
+         stats.p50_ns > stats.p99_ns || stats.p99_ns > stats.max_ns )
+    {
+        error << "server stats are wrong: " << stats.requests
+              << " requests in " << stats.batches << " batches" << endl;
+        worked = false;
+    }
+
+    server.stop();
+    running.join();
+    mapped.close();
+    remove( index_file );
+    remove( socket_file );
+
+    if ( !served || !worked )
+    {
+        exit(1);
+    }
+}
+
+// A Unix domain socket at path, listening if listening is set and
+// connected otherwise, or -1
+static int unix_socket( const char* path, bool listening )
+{
+    sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path, sizeof( addr.sun_path ) - 1 );
+
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( listening )
+    {
+        remove( path );
+        if ( bind( fd, (sockaddr*)&addr, sizeof( addr ) ) != 0 ||
+             listen( fd, 4 ) != 0 )
+        {
+            close( fd );
+            return -1;
+        }
+    }
+    else if ( connect( fd, (sockaddr*)&addr, sizeof( addr ) ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+static bool read_fully( int fd, void* buf, size_t len )
+{
+    for ( char* at = (char*)buf; len > 0; )
+    {
+        ssize_t got = read( fd, at, len );
+        if ( got <= 0 )
+        {
+            return false;
+        }
+        at += got;
+        len -= got;
+    }
+    return true;
+}
+
+// Reads a request and its body, and answers it with body once for each of
+// offsets, the id of the request plus the offset
+static bool answer_request( int fd, const vector<uint32_t>& offsets,
+    const string& body )
+{
+    lookup_request request;
+    string skipped;
+    if ( !read_fully( fd, &request, sizeof( request ) ) )
+    {
+        return false;
+    }
+    skipped.resize( request.len );
+    if ( !read_fully( fd, &skipped[0], skipped.size() ) )
+    {
+        return false;
+    }
+
+    string frames;
+    for ( uint32_t offset : offsets )
+    {
+        lookup_response response{ (uint32_t)body.size(), request.id + offset,
+            lookup_ok, { 0, 0, 0 } };
+        frames.append( (const char*)&response, sizeof( response ) );
+        frames += body;
+    }
+    return write( fd, frames.data(), frames.size() ) == (ssize_t)frames.size();
+}
+
+// A client has to drop a connection that answers with the wrong id or stops
+// in the middle of a batch, and connect again for the next call rather than
+// read what was left of the last one
+static void test_client_errors( void )
+{
+    const char* socket_file = "test_client.sock";
+    int listener = unix_socket( socket_file, true );
+    if ( listener < 0 )
+    {
+        error << "can't listen on " << socket_file << endl;
+        exit(1);
+    }
+
+    server_stats stale = {}, fresh = {};
+    stale.records = 1;
+    fresh.records = 42;
+    sound_key key = encode( "Smith" );
+    string stale_body( (const char*)&stale, sizeof( stale ) );
+    string fresh_body( (const char*)&fresh, sizeof( fresh ) );
+    char wire[lookup_key_len];
+    put_key( key, wire );
+    string key_body( wire, sizeof( wire ) );
+
+    thread fake( [&] {
+        char c;
+
+        // The wrong id, then a stale answer the client mustn't read
+        int fd = accept( listener, NULL, NULL );
+        answer_request( fd, { 1, 0 }, stale_body );
+        while ( read( fd, &c, 1 ) > 0 ) {}
+        close( fd );
+
+        // One answer of a batch of three
+        fd = accept( listener, NULL, NULL );
+        answer_request( fd, { 0 }, key_body );
+        close( fd );
+
+        fd = accept( listener, NULL, NULL );
+        answer_request( fd, { 0 }, fresh_body );
+        while ( read( fd, &c, 1 ) > 0 ) {}
+        close( fd );
+    } );
+
+    lookup_client client;
+    server_stats stats;
+    vector<string_view> names{ "Smith", "Schmidt", "Jones" };
+    vector<sound_key> keys;
+    bool connected = client.connect( socket_file );
+    bool wrong_id = client.stats( stats );
+    bool cut_short = client.encode( names, keys );
+    bool again = client.stats( stats );
+    client.close();
+
+    fake.join();
+    close( listener );
+    remove( socket_file );
+
+    if ( !connected || wrong_id || cut_short || !again ||
+         stats.records != fresh.records )
+    {
+        error << "client reads " << stats.records << " records after an"
+              << " answer with the wrong id and a batch cut short" << endl;
+        exit(1);
+    }
+}
+
+// Reads answers to encode requests until the server closes the socket,
+// returning how many there were, or -1 if any of them is wrong
+static long read_keys( int fd, const sound_key& expected )
+{
+    lookup_response response;
+    char wire[lookup_key_len];
+    long count = 0;
+
+    while ( read_fully( fd, &response, sizeof( response ) ) )
+    {
+        if ( response.status != lookup_ok ||
+             response.len != sizeof( wire ) ||
+             !read_fully( fd, wire, sizeof( wire ) ) ||
+             get_key( wire ).primary != expected.primary ||
+             get_key( wire ).alternate != expected.alternate ||
+             get_key( wire ).flags != expected.flags ||
+             wire[5] != 0 || wire[6] != 0 || wire[7] != 0 )
+        {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+// A server has to answer everything a client sent before shutting down its
+// end of the socket, and stop reading from a client that doesn't read its
+// answers, rather than keep them all
+static void test_server_flow( const char* filename )
+{
+    const char* index_file = "test_server.mtfn";
+    const char* socket_file = "test_server.sock";
+    ifstream istrm( filename );
+    sound_index index;
+    mapped_index mapped;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        index.insert( s );
+    }
+    if ( !index.save( index_file ) || !mapped.open( index_file ) )
+    {
+        error << "can't save and map " << index_file << endl;
+        exit(1);
+    }
+
+    lookup_server server( mapped, 2 );
+    if ( !server.listen( socket_file ) )
+    {
+        error << "can't listen on " << socket_file << endl;
+        exit(1);
+    }
+    thread running( [&] { server.run(); } );
+
+    const char* name = "Smith";
+    lookup_request request{ (uint32_t)strlen( name ), 0, lookup_encode, 0, 0 };
+    string frame( (const char*)&request, sizeof( request ) );
+    frame += name;
+    string frames;
+    for ( int i = 0; i < 1000; i++ )
+    {
+        frames += frame;
+    }
+
+    // Three requests and a half close
+    int fd = unix_socket( socket_file, false );
+    string three( frames, 0, 3 * frame.size() );
+    if ( fd < 0 ||
+         write( fd, three.data(), three.size() ) != (ssize_t)three.size() ||
+         shutdown( fd, SHUT_WR ) != 0 || read_keys( fd, encode( name ) ) != 3 )
+    {
+        error << "server doesn't answer a client that shut down its end"
+              << endl;
+        worked = false;
+    }
+    close( fd );
+
+    // Requests without reading, until the server stops taking them for a
+    // good while, which it has to long before 64MB of answers pile up
+    fd = unix_socket( socket_file, false );
+    size_t sent = 0;
+    int blocked = 0;
+    while ( fd >= 0 && blocked < 20 && sent < ( 64 << 20 ) )
+    {
+        ssize_t n = send( fd, frames.data() + sent % frames.size(),
+            frames.size() - sent % frames.size(), MSG_DONTWAIT );
+        if ( n > 0 )
+        {
+            sent += n;
+            blocked = 0;
+        }
+        else
+        {
+            blocked++;
+            this_thread::sleep_for( chrono::milliseconds( 10 ) );
+        }
+    }
+    if ( fd < 0 || sent >= ( 64 << 20 ) || shutdown( fd, SHUT_WR ) != 0 ||
+         read_keys( fd, encode( name ) ) != (long)( sent / frame.size() ) )
+    {
+        error << "server took " << sent << " bytes of requests without their"
+              << " answers being read" << endl;
+        worked = false;
+    }
+    close( fd );
+
+    server.stop();
+    running.join();
+    mapped.close();
+    remove( index_file );
+    remove( socket_file );
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// Without MTFN_PROFILE nothing is counted. With it, the cursor has to
+// have been moved over every letter of names encoded without a limit
+static void test_profile( const char* filename )
+{
+    ifstream istrm( filename );
+    encoder enc( false );
+    vector<rule_count> counts;
+    string s;
+    char name[1024];
+    uint64_t letters = 0, moved = 0, branches = 0;
+
+    reset_rule_counts();
+    while ( getline( istrm, s ) )
+    {
+        enc.encode( s );
+        letters += rules::normalize( s.data(), min( s.size(), sizeof( name ) ),
+            name );
+    }
+
+    rule_counts( counts );
+    for ( const rule_count& c : counts )
+    {
+        if ( c.event == rule_advance )
+        {
+            moved += c.hits * atoi( c.where.c_str() + 2 );
+        }
+        branches += c.event == rule_branch ? c.hits : 0;
+    }
+
+    if ( rules_profiled() ? moved != letters || branches == 0
+                          : !counts.empty() )
+    {
+        error << "rules counted " << counts.size() << " places, moving "
+              << moved << " letters instead of " << letters << endl;
+        exit(1);
+    }
+}
+
+// Histograms have to keep every value within an eighth, and metrics have
+// to count every call while they are on, on every thread, and none while
+// they are off. sounds_like() counts once, without what it calls.
+static void test_metrics( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> lines;
+    string s;
+    bool worked = true;
+
+    histogram h;
+    for ( uint64_t v = 1; v <= 100000; v += v / 16 + 1 )
+    {
+        int b = histogram::bucket( v );
+        if ( b >= histogram::buckets || histogram::bucket_top( b ) < v ||
+             histogram::bucket_top( b ) > v + v / 8 ||
+             ( b > 0 && histogram::bucket_top( b - 1 ) >= v ) )
+        {
+            error << "histogram puts " << v << " in bucket " << b << endl;
+            worked = false;
+        }
+    }
+    for ( uint64_t v = 1; v <= 1000; v++ )
+    {
+        h.add( v );
+    }
+    if ( h.count() != 1000 || h.max() != 1000 ||
+         h.percentile( 0.5 ) < 500 || h.percentile( 0.5 ) > 500 + 500 / 8 ||
+         h.percentile( 1.0 ) != 1000 )
+    {
+        error << "histogram p50 of 1 to 1000 is " << h.percentile( 0.5 )
+              << endl;
+        worked = false;
+    }
+
+    while ( getline( istrm, s ) )
+    {
+        lines.push_back( s );
+    }
+    size_t n = lines.size(), longest = 0;
+    uint64_t alternates = 0, compared = 0, alike = 0;
+
+    enable_metrics();
+    reset_metrics();
+
+    vector<sound> sounds;
+    for ( const string& line : lines )
+    {
+        sounds.push_back( sound( line ) );
+        alternates += sounds.back().has_alternate();
+        longest = max( longest, line.size() );
+    }
+    for ( size_t i = 0; i < n; i++ )
+    {
+        compared += sounds[i] == sounds[( i + 1 ) % n];
+        alike += sounds_like( lines[i], lines[( i + 7 ) % n] );
+    }
+    thread other( [&] {
+        for ( const string& line : lines )
+        {
+            sound snd( line );
+        } } );
+    other.join();
+
+    metrics_snapshot before, after;
+    snapshot_metrics( before );
+    enable_metrics( false );
+    sound( "Schmidt" ) == sound( "Smith" );
+    enable_metrics();
+    reset_metrics();
+    snapshot_metrics( after );
+    enable_metrics( false );
+
+    const call_metrics& encodes( before.calls[metric_encode] );
+    const call_metrics& compares( before.calls[metric_compare] );
+    const call_metrics& likes( before.calls[metric_sounds_like] );
+    if ( encodes.calls != 2 * n || encodes.flagged != 2 * alternates ||
+         encodes.lengths.count() != 2 * n ||
+         encodes.lengths.max() != longest ||
+         encodes.latency.count() != 2 * n ||
+         encodes.latency.percentile( 0.5 ) >
+             encodes.latency.percentile( 0.99 ) ||
+         encodes.latency.percentile( 0.99 ) > encodes.latency.max() ||
+         compares.calls != n || compares.flagged != compared ||
+         likes.calls != n || likes.flagged != alike ||
+         likes.latency.count() != n )
+    {
+        error << "metrics counted " << encodes.calls << " encodes, "
+              << compares.calls << " compares and " << likes.calls
+              << " sounds_like instead of " << 2 * n << ", " << n
+              << " and " << n << endl;
+        worked = false;
+    }
+
+    for ( const call_metrics& c : after.calls )
+    {
+        if ( c.calls != 0 || c.latency.count() != 0 )
+        {
+            error << "metrics counted calls after a reset" << endl;
+            worked = false;
+        }
+    }
+
+    // A name that throws part way through sounds_like() mustn't leave the
+    // calls after it on the same thread uncounted
+    struct unreadable
+    {
+        operator string() const { throw runtime_error( "unreadable" ); };
+    };
+    metrics_snapshot thrown;
+    enable_metrics();
+    try
+    {
+        sounds_like( unreadable(), string( "Smith" ) );
+    }
+    catch ( const runtime_error& )
+    {
+    }
+    sound( "Smith" );
+    snapshot_metrics( thrown );
+    reset_metrics();
+    enable_metrics( false );
+    if ( thrown.calls[metric_encode].calls != 1 ||
+         thrown.calls[metric_sounds_like].calls != 0 )
+    {
+        error << "metrics counted " << thrown.calls[metric_encode].calls
+              << " encodes after sounds_like() threw instead of 1" << endl;
+        worked = false;
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// The codes of a sound, with the primary codes for the alternate ones when
+// there aren't any
+static string alternate_of( const sound& snd )
+{
+    return snd.has_alternate() ? snd.alternate() : snd.primary();
+}
+
+// Codes limited to any key length have to be the start of the codes without
+// a limit and pack exactly, and leave the first stop_len codes, so the key,
+// as they are with limit_length. An index with longer keys has to find what
+// operator== does on sounds that long, which is never more than it finds
+// with the short keys, even where its keys are fingerprints.
+static void test_key_length( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> names;
+    string s;
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        names.push_back( s );
+    }
+
+    for ( const string& name : names )
+    {
+        sound unlimited( name, false ), four( name );
+
+        for ( int len = 1; len <= max_key_len && worked; len++ )
+        {
+            sound snd( name, key_length( len ) );
+
+            if ( snd.key_len() != len ||
+                 snd.primary() != unlimited.primary().substr( 0, len ) ||
+                 alternate_of( snd ) !=
+                     alternate_of( unlimited ).substr( 0, len ) ||
+                 snd.primary_code() != rules::pack( snd.primary().data(),
+                     snd.primary().size() ) ||
+                 is_fingerprint( snd.primary_code() ) ||
+                 ( len >= stop_len &&
+                   ( snd.key().primary != four.key().primary ||
+                     snd.key().alternate != four.key().alternate ) ) )
+            {
+                error << name << " limited to " << len << " codes is "
+                      << snd.primary() << "," << snd.alternate() << endl;
+                worked = false;
+            }
+        }
+    }
+
+    const key_length eight( 8 );
+    sound_index short_index, long_index( eight );
+    vector<sound> sounds;
+    for ( const string& name : names )
+    {
+        short_index.insert( name );
+        long_index.insert( name );
+        sounds.push_back( sound( name, eight ) );
+    }
+
+    size_t short_found = 0, long_found = 0;
+    for ( size_t i = 0; i < names.size() && worked; i++ )
+    {
+        vector<sound_index::record_id> shorter, longer, expected;
+
+        short_index.find( names[i], shorter );
+        long_index.find( names[i], longer );
+        for ( size_t j = 0; j < names.size(); j++ )
+        {
+            if ( sounds[i] == sounds[j] )
+            {
+                expected.push_back( j );
+            }
+            if ( ( sounds[i] == sounds[j] ) !=
+                 ( sounds[i].full_key() == sounds[j].full_key() ) )
+            {
+                error << names[i] << " and " << names[j]
+                      << " compare differently by full_key()" << endl;
+                worked = false;
+            }
+        }
+
+        sort( shorter.begin(), shorter.end() );
+        sort( longer.begin(), longer.end() );
+        if ( longer != expected ||
+             !includes( shorter.begin(), shorter.end(),
+                 longer.begin(), longer.end() ) )
+        {
+            error << "an index of 8 codes finds " << longer.size()
+                  << " records for " << names[i] << " instead of "
+                  << expected.size() << endl;
+            worked = false;
+        }
+        short_found += shorter.size();
+        long_found += longer.size();
+    }
+
+    if ( long_found >= short_found )
+    {
+        error << "8 codes found " << long_found << " records, and 4 found "
+              << short_found << endl;
+        worked = false;
+    }
+
+    // No limit, and a limit past what packs exactly, both leave keys that
+    // can be fingerprints, which the index mustn't take for the codes
+    if ( key_length( -1 ).codes != 0 ||
+         sound_index( key_length( 0 ) ).key_len() != 0 )
+    {
+        error << "a key length of 0 or less isn't unlimited" << endl;
+        worked = false;
+    }
+    for ( int len : { 0, max_key_len + 4 } )
+    {
+        const key_length codes( len );
+        sound_index index( codes );
+        vector<sound> longer;
+        for ( const string& name : names )
+        {
+            index.insert( name );
+            longer.push_back( sound( name, codes ) );
+        }
+
+        for ( size_t i = 0; i < names.size() && worked; i++ )
+        {
+            vector<sound_index::record_id> found, expected;
+
+            index.find( names[i], found );
+            for ( size_t j = 0; j < names.size(); j++ )
+            {
+                if ( longer[i] == longer[j] )
+                {
+                    expected.push_back( j );
+                }
+            }
+
+            sort( found.begin(), found.end() );
+            if ( found != expected )
+            {
+                error << "an index of " << len << " codes finds "
+                      << found.size() << " records for " << names[i]
+                      << " instead of " << expected.size() << endl;
+                worked = false;
+            }
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}
+
+// The rules with both of step()'s engines to hand
+class rule_engines : public rules
+{
+public:
+    rule_engines( bool limit_length ) : rules( limit_length ) {};
+
+    void step_switch( void ) { dispatch(); };
+    void step_table( void ) { walk_table(); };
+};
+
+// Runs a normalized name through the letter_*() functions and through the
+// table side by side, and says where they first disagree, if they do. After
+// every step both have to have the same codes, have moved the cursor as
+// far, and have asked whether the name is Slavo-Germanic, which
+// incremental_sound relies on.
+static bool same_with_table( const string& name, bool limit_length )
+{
+    rule_engines by_switch( limit_length ), by_table( limit_length );
+    vector<char> codes( 8 * name.size() + 8 * stop_len );
+    char* p = codes.data();
+    size_t quarter = codes.size() / 4;
+
+    by_switch.start( name.data(), name.size(), p, p + quarter );
+    by_table.start( name.data(), name.size(), p + 2 * quarter, p + 3 * quarter );
+    while ( !by_switch.is_ready() )
+    {
+        int cursor = by_switch.save().cursor;
+        by_switch.step_switch();
+        by_table.step_table();
+
+        rules::checkpoint s = by_switch.save(), t = by_table.save();
+        if ( s.cursor != t.cursor || s.has_alternate != t.has_alternate ||
+             s.asked_slavo_germanic != t.asked_slavo_germanic ||
+             by_switch.primary() != by_table.primary() ||
+             by_switch.alternate() != by_table.alternate() )
+        {
+            error << "the table makes " << name << " at " << cursor << " "
+                  << by_table.primary() << "," << by_table.alternate()
+                  << " to " << t.cursor << ( t.asked_slavo_germanic ?
+                  " asking" : "" ) << " instead of "
+                  << by_switch.primary() << "," << by_switch.alternate()
+                  << " to " << s.cursor << ( s.asked_slavo_germanic ?
+                  " asking" : "" ) << endl;
+            return false;
+        }
+    }
+
+    return by_table.is_ready();
+}
+
+// The table has to run the rules the same as the letter_*() functions, for
+// the test names, for letters at random, and for pieces of the test names
+// run together, which keep the letter combinations real names have
+static void test_table( const char* filename )
+{
+    ifstream istrm( filename );
+    vector<string> names;
+    string s;
+    char name[1024];
+    bool worked = true;
+
+    while ( getline( istrm, s ) )
+    {
+        int len = rules::normalize( s.data(),
+            min( s.size(), sizeof( name ) ), name );
+        names.push_back( string( name, len ) );
+    }
+
+    const string letters( "AAEEIIOOUUYBCCDFGGHHJKLLMNNPQRRSSTTVWXZ  \xC7\xD1" );
+    mt19937 random( 42 );
+    size_t real_names = names.size();
+    for ( int i = 0; i < 100000; i++ )
+    {
+        string made;
+        int len = random() % 16 + 1;
+        while ( (int)made.size() < len )
+        {
+            if ( i % 2 == 0 )
+            {
+                made += letters[random() % letters.size()];
+            }
+            else
+            {
+                const string& from( names[random() % real_names] );
+                size_t start = random() % ( from.size() + 1 );
+                made += from.substr( start, random() % 4 + 1 );
+            }
+        }
+        names.push_back( made );
+    }
+
+    for ( const string& n : names )
+    {
+        if ( !same_with_table( n, true ) || !same_with_table( n, false ) )
+        {
+            worked = false;
+            break;
+        }
+    }
+
+    if ( !worked )
+    {
+        exit(1);
+    }
+}